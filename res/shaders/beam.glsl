@@ -0,0 +1,13 @@
+//reads the beam prepass output, see beam.comp
+//BEAM_TILE and BEAM_IMAGE_UNIT are defined by the renderer
+layout(r32f, binding = BEAM_IMAGE_UNIT) uniform readonly image2D beamDistances;
+
+//where the primary ray of `pixel` from `ro` can start; matches beamStart() in
+//src/render/raytrace.cpp
+float beamStart(ivec2 pixel, vec3 ro) {
+    if ((flags & FRAME_BEAM) == 0) {
+        return 0.0;
+    }
+    float tileDistance = imageLoad(beamDistances, pixel / BEAM_TILE).r;
+    return max(tileDistance * 0.999 - length(ro - cameraPosition.xyz), 0.0);
+}
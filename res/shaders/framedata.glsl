@@ -0,0 +1,24 @@
+//per-frame camera data, mirrors FrameData in src/render/framedata.h
+//FRAME_DATA_BINDING is defined by the renderer
+layout(std140, binding = FRAME_DATA_BINDING) uniform FrameData {
+    mat4 viewProjection;
+    mat4 inverseViewProjection;
+    mat4 previousInverseViewProjection;
+    vec4 cameraPosition;
+    vec4 previousCameraPosition;
+    vec2 resolution;
+    float time;
+    int debugView;
+    int flags;
+};
+
+#define DEBUG_VIEW_SHADED 0
+#define DEBUG_VIEW_STEPS 1
+#define DEBUG_VIEW_NORMALS 2
+
+#define FRAME_BEAM 1
+#define FRAME_COUNT_STEPS 2
+#define FRAME_REPROJECT 4
+#define FRAME_LIGHTING 8
+#define FRAME_OCCLUSION 16
+#define FRAME_BRICKS 32
@@ -0,0 +1,266 @@
+//octree traversal shared by voxel.frag and voxel.comp
+//SVO_DEPTH, MAX_STEPS, OCTREE_BINDING, STATS_BINDING, LIGHTING_BINDING, BRICK_TEXTURE_UNIT,
+//BRICK_LEVEL, BRICK_SIZE and ATLAS_BRICKS are defined by the renderer. The traversal stack
+//lives in private arrays unless the includer defines DECLARE_STACK and STACK(array, level)
+//to put it elsewhere, e.g. in shared memory.
+
+#ifndef STACK
+#define DECLARE_STACK \
+    uint stackNode[SVO_DEPTH + 1]; \
+    float stackT[SVO_DEPTH + 1]; \
+    float stackExit[SVO_DEPTH + 1]; \
+    uint stackChild[SVO_DEPTH + 1];
+#define STACK(array, level) array[level]
+#endif
+
+//flattened octree, see SVO::flatten: a branch is its header then the offsets of its 8
+//children (0 where absent), a leaf is its header then 8 voxels of 4 words
+layout(std430, binding = OCTREE_BINDING) readonly buffer Octree {
+    uint nodes[];
+};
+
+//baked light per voxel face, see VoxelLighting::flatten: 48 words per node ordinal, one per
+//face of each voxel in a leaf
+layout(std430, binding = LIGHTING_BINDING) readonly buffer Lighting {
+    uint faceLight[];
+};
+
+//occupancy of the dense bricks, see BrickAtlas: BRICK_SIZE^3 texels per brick, ATLAS_BRICKS
+//bricks per side
+layout(binding = BRICK_TEXTURE_UNIT) uniform usampler3D brickAtlas;
+
+//steps taken by primary rays, summed while FRAME_COUNT_STEPS is set; the renderer clears
+//and reads it back every frame
+layout(std430, binding = STATS_BINDING) buffer TraceStats {
+    uint totalSteps;
+    uint tracedPixels;
+};
+
+void countSteps(uint steps) {
+    if ((flags & FRAME_COUNT_STEPS) != 0) {
+        atomicAdd(totalSteps, steps);
+        atomicAdd(tracedPixels, 1u);
+    }
+}
+
+const uint NODE_TYPE_MASK = 0xC0000000u;
+const uint BRICK_NODE = 0xC0000000u;
+const uint INDEX_MASK = 0x3FFFFFFFu;
+const float INF = 1.0 / 0.0;
+const float EPSILON = 1e-9;
+//baked lighting intensities, as in src/render/raytrace.cpp
+const vec3 SUN_LIGHT = vec3(0.65);
+const vec3 SKY_LIGHT = vec3(0.28, 0.33, 0.42);
+//light left on a fully occluded face
+const float OCCLUSION_FLOOR = 0.35;
+
+struct Hit {
+    bool hit;
+    float t;
+    uvec4 color;
+    vec3 normal;
+    uint steps;
+    uint leaf;  //buffer offset of the hit voxel's leaf
+    uint voxel; //octant of the voxel in the leaf
+};
+
+//octant of the node whose mid planes the ray crosses at tMid, at time t
+uint firstChild(vec3 tMid, float t, vec3 rd) {
+    bvec3 upper = equal(lessThanEqual(tMid, vec3(t)), greaterThanEqual(rd, vec3(0.0)));
+    return uint(upper.x) << 2 | uint(upper.y) << 1 | uint(upper.z);
+}
+
+vec3 octantOffset(uint child) {
+    return vec3(uvec3(child >> 2, child >> 1, child) & 1u);
+}
+
+uint cellOctant(ivec3 cell) {
+    return uint(cell.x & 1) << 2 | uint(cell.y & 1) << 1 | uint(cell.z & 1);
+}
+
+//steps voxel by voxel through the brick node at brickNode, whose corner is brickOrigin,
+//from t to tExit, reading occupancy from the atlas; on a hit the voxel's leaf is found
+//through the node's own children, so the hit is the one descending would give
+bool traceBrick(vec3 ro, vec3 rd, vec3 invDir, uint brickNode, vec3 brickOrigin, float t, float tExit, inout Hit hit) {
+    uint brick = nodes[brickNode] & INDEX_MASK;
+    ivec3 atlasOrigin = ivec3(brick % ATLAS_BRICKS, brick / ATLAS_BRICKS % ATLAS_BRICKS, brick / (ATLAS_BRICKS * ATLAS_BRICKS)) * BRICK_SIZE;
+    //the voxel the ray is in at t, picked the way firstChild picks octants
+    ivec3 cell = ivec3(0);
+    for (int size = BRICK_SIZE / 2; size >= 1; size /= 2) {
+        vec3 tMid = (brickOrigin + vec3(cell + size) - ro) * invDir;
+        cell += ivec3(equal(lessThanEqual(tMid, vec3(t)), greaterThanEqual(rd, vec3(0.0)))) * size;
+    }
+    vec3 far = vec3(greaterThanEqual(rd, vec3(0.0)));
+    ivec3 stepDir = ivec3(far) * 2 - 1;
+    while (hit.steps < MAX_STEPS) {
+        hit.steps++;
+        vec3 cellOrigin = brickOrigin + vec3(cell);
+        vec3 tNext = (cellOrigin + far - ro) * invDir;
+        float cellExit = min(tNext.x, min(tNext.y, tNext.z));
+        if (texelFetch(brickAtlas, atlasOrigin + cell, 0).r != 0u) {
+            uint middle = nodes[brickNode + 1u + cellOctant(cell >> 2)];
+            uint leaf = middle != 0u ? nodes[middle + 1u + cellOctant(cell >> 1)] : 0u;
+            if (leaf != 0u) {
+                uint base = leaf + 1u + 4u * cellOctant(cell);
+                hit.hit = true;
+                hit.t = t;
+                hit.color = uvec4(nodes[base], nodes[base + 1u], nodes[base + 2u], nodes[base + 3u]);
+                hit.leaf = leaf;
+                hit.voxel = cellOctant(cell);
+                vec3 entry = (cellOrigin + vec3(lessThan(rd, vec3(0.0))) - ro) * invDir;
+                int axis = entry.x >= entry.y && entry.x >= entry.z ? 0 : entry.y >= entry.z ? 1 : 2;
+                hit.normal[axis] = rd[axis] < 0.0 ? 1.0 : -1.0;
+                return true;
+            }
+        }
+        if (cellExit >= tExit) {
+            return false;
+        }
+        int axis = cellExit == tNext.x ? 0 : cellExit == tNext.y ? 1 : 2;
+        cell[axis] += stepDir[axis];
+        if (cell[axis] < 0 || cell[axis] >= BRICK_SIZE) {
+            return false; //rounding put the exit just past tExit
+        }
+        t = cellExit;
+    }
+    return false;
+}
+
+//walks the octree front to back, visiting the children of each node in the order the ray
+//crosses them; src/render/raytrace.cpp is the CPU reference and must stay step for step
+//identical. Starts tStart along the ray, e.g. where the beam prepass says nothing is nearer.
+Hit traceOctree(vec3 ro, vec3 rd, float tStart) {
+    Hit hit = Hit(false, 0.0, uvec4(0u), vec3(0.0), 0u, 0u, 0u);
+    if (nodes.length() == 0) {
+        return hit;
+    }
+    rd = mix(rd, vec3(EPSILON), lessThan(abs(rd), vec3(EPSILON)));
+    vec3 invDir = 1.0 / rd;
+
+    //the root spans [-2^SVO_DEPTH, 2^SVO_DEPTH)
+    float rootHalf = float(1u << SVO_DEPTH);
+    vec3 lo = (vec3(-rootHalf) - ro) * invDir;
+    vec3 hi = (vec3(rootHalf) - ro) * invDir;
+    vec3 tNear = min(lo, hi);
+    vec3 tFar = max(lo, hi);
+    float t = max(max(tNear.x, max(tNear.y, tNear.z)), tStart);
+    float tExit = min(tFar.x, min(tFar.y, tFar.z));
+    if (t >= tExit) {
+        return hit;
+    }
+
+    //resume state of each branch on the path, indexed by level
+    DECLARE_STACK
+
+    int level = SVO_DEPTH;
+    uint node = 0u;
+    vec3 nodeOrigin = vec3(-rootHalf);
+    uint child = firstChild((nodeOrigin + rootHalf - ro) * invDir, t, rd);
+
+    while (hit.steps < MAX_STEPS) {
+        hit.steps++;
+        float childSize = float(1u << level);
+        vec3 tMid = (nodeOrigin + childSize - ro) * invDir;
+        vec3 tNext = mix(vec3(INF), tMid, greaterThan(tMid, vec3(t)));
+        float childExit = min(tExit, min(tNext.x, min(tNext.y, tNext.z)));
+        vec3 childOrigin = nodeOrigin + octantOffset(child) * childSize;
+        uint crossed = uint(tNext.x == childExit) << 2 | uint(tNext.y == childExit) << 1 | uint(tNext.z == childExit);
+
+        if (level == 0) {
+            uint base = node + 1u + 4u * child;
+            uvec4 voxel = uvec4(nodes[base], nodes[base + 1u], nodes[base + 2u], nodes[base + 3u]);
+            if (voxel != uvec4(0u)) {
+                hit.hit = true;
+                hit.t = t;
+                hit.color = voxel;
+                hit.leaf = node;
+                hit.voxel = child;
+                //the face entered through is the one whose slab is crossed last
+                vec3 entry = (childOrigin + vec3(lessThan(rd, vec3(0.0))) - ro) * invDir;
+                int axis = entry.x >= entry.y && entry.x >= entry.z ? 0 : entry.y >= entry.z ? 1 : 2;
+                hit.normal[axis] = rd[axis] < 0.0 ? 1.0 : -1.0;
+                return hit;
+            }
+        } else {
+            uint pointer = nodes[node + 1u + child];
+            if (pointer != 0u) {
+                if (level == BRICK_LEVEL + 1 && (flags & FRAME_BRICKS) != 0 && (nodes[pointer] & NODE_TYPE_MASK) == BRICK_NODE) {
+                    //dense subtree: step through its voxels in the atlas instead
+                    if (traceBrick(ro, rd, invDir, pointer, childOrigin, t, childExit, hit)) {
+                        return hit;
+                    }
+                } else {
+                    //remember where to carry on in this node, then descend
+                    STACK(stackNode, level) = node;
+                    STACK(stackT, level) = childExit;
+                    STACK(stackExit, level) = tExit;
+                    STACK(stackChild, level) = child ^ crossed;
+                    node = pointer;
+                    nodeOrigin = childOrigin;
+                    tExit = childExit;
+                    level--;
+                    child = firstChild((nodeOrigin + float(1u << level) - ro) * invDir, t, rd);
+                    continue;
+                }
+            }
+        }
+
+        if (childExit < tExit) {
+            child ^= crossed;
+            t = childExit;
+            continue;
+        }
+        //left this node, pop to the nearest ancestor with children still ahead
+        do {
+            if (++level > SVO_DEPTH) {
+                return hit;
+            }
+            //nodes are aligned to their size, so the parent's corner follows from the child's
+            float nodeSize = float(2u << level);
+            nodeOrigin = floor((nodeOrigin + rootHalf) / nodeSize) * nodeSize - rootHalf;
+            node = STACK(stackNode, level);
+            t = STACK(stackT, level);
+            tExit = STACK(stackExit, level);
+            child = STACK(stackChild, level);
+        } while (t >= tExit);
+    }
+    return hit;
+}
+
+//matches shadeHit() in src/render/raytrace.cpp
+vec3 shade(Hit hit, vec3 rd) {
+    if (debugView == DEBUG_VIEW_STEPS) {
+        float h = min(float(hit.steps) / float(MAX_STEPS), 1.0);
+        return vec3(h, 4.0 * h * (1.0 - h), 1.0 - h);
+    }
+    if (!hit.hit) {
+        float up = clamp(normalize(rd).y, 0.0, 1.0);
+        return mix(vec3(0.70, 0.80, 0.92), vec3(0.32, 0.50, 0.80), up);
+    }
+    if (debugView == DEBUG_VIEW_NORMALS) {
+        return hit.normal * 0.5 + 0.5;
+    }
+    //colours are the low byte of each channel, the AO of faces -x, +x, -y and +y, -z, +z
+    //sits above it in r and g, see src/render/occlusion.h
+    vec3 albedo = vec3(hit.color.rgb & 255u) / 255.0;
+    int axis = hit.normal.x != 0.0 ? 0 : hit.normal.y != 0.0 ? 1 : 2;
+    uint face = uint(axis * 2) + (hit.normal[axis] > 0.0 ? 1u : 0u);
+    float occlusion = 1.0;
+    if ((flags & FRAME_OCCLUSION) != 0) {
+        uint word = face < 3u ? hit.color.r : hit.color.g;
+        occlusion = OCCLUSION_FLOOR + (1.0 - OCCLUSION_FLOOR) * float((word >> (8u + 8u * (face % 3u))) & 255u) / 255.0;
+    }
+
+    uint ordinal = nodes[hit.leaf] & INDEX_MASK;
+    if ((flags & FRAME_LIGHTING) != 0 && (ordinal + 1u) * 48u <= uint(faceLight.length())) {
+        uint lit = faceLight[ordinal * 48u + hit.voxel * 6u + face];
+        float sun = float(lit & 255u) / 255.0;
+        float sky = float((lit >> 8) & 255u) / 255.0;
+        vec3 bounce = vec3(float((lit >> 16) & 31u) / 31.0, float((lit >> 21) & 63u) / 63.0, float(lit >> 27) / 31.0);
+        vec3 light = SUN_LIGHT * sun + SKY_LIGHT * sky + SUN_LIGHT * bounce;
+        return albedo * light * occlusion;
+    }
+    vec3 sun = normalize(vec3(0.4, 0.8, 0.3));
+    float light = 0.35 + 0.65 * max(dot(hit.normal, sun), 0.0);
+    return albedo * light * occlusion;
+}
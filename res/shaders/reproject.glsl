@@ -0,0 +1,43 @@
+//temporal reprojection, voxel pass side: records each pixel's hit distance for the next
+//frame and reads the seeds reproject.comp scattered from the last one
+//HISTORY_IMAGE_UNIT and SEED_IMAGE_UNIT are defined by the renderer
+layout(r32f, binding = HISTORY_IMAGE_UNIT) uniform writeonly image2D hitDistances;
+layout(r32ui, binding = SEED_IMAGE_UNIT) uniform readonly uimage2D seeds;
+
+const uint NO_SEED = 0xFFFFFFFFu;
+//a neighbouring ray meets the same surface a little nearer than the reprojected hit, by up
+//to about a voxel plus the slope over the pixel footprint
+const float SEED_MARGIN = 2.0;
+const float SEED_RELATIVE_MARGIN = 0.01;
+
+//where the primary ray of `pixel` from `ro` can start, from the nearest surface reprojected
+//into its 3x3 neighbourhood. If any neighbour got nothing, or lies off screen, the pixel
+//may see something that was hidden or off screen last frame, so it is traced in full.
+float reprojectedStart(ivec2 pixel, vec3 ro) {
+    if ((flags & FRAME_REPROJECT) == 0) {
+        return 0.0;
+    }
+    uint nearest = NO_SEED;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            ivec2 neighbour = pixel + ivec2(x, y);
+            if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, ivec2(resolution)))) {
+                return 0.0;
+            }
+            uint seed = imageLoad(seeds, neighbour).r;
+            if (seed == NO_SEED) {
+                return 0.0;
+            }
+            //non-negative floats order the same as their bits
+            nearest = min(nearest, seed);
+        }
+    }
+    float seedDistance = uintBitsToFloat(nearest);
+    return max(seedDistance * (1.0 - SEED_RELATIVE_MARGIN) - SEED_MARGIN - length(ro - cameraPosition.xyz), 0.0);
+}
+
+//distance from the camera to the surface hit, infinite where the ray found nothing
+void storeHitDistance(ivec2 pixel, vec3 ro, Hit hit) {
+    float hitDistance = hit.hit ? length(ro - cameraPosition.xyz) + hit.t : INF;
+    imageStore(hitDistances, pixel, vec4(hitDistance));
+}
@@ -3,11 +3,7 @@
 layout(location = 0) in vec4 position; // input attribute for vertex position
 // in vec4 position;
 
-//original Model View Projection matrix, used for rendering rectangle on the whole view area
-uniform mat4 matrix_original;       
-
-//inverted Model View Projection matrix used desired camera for rendering scene - for ray computation
-uniform mat4 inverse_matrix;
+#include "framedata.glsl"
 
 //coordinates of the ray's start and end in homogeneous world coordinates
 //for using further in fragment shader for computing origin and the direction of the ray
@@ -31,7 +27,7 @@ void main(){
    
     //compute ray's start and end as inversion of this coordinates
     //in near and far clip planes
-    near_4 = inverse_matrix * (vec4(pos, -1.0, 1.0));       
-    far_4 = inverse_matrix * (vec4(pos, +1.0, 1.0));
+    near_4 = inverseViewProjection * (vec4(pos, -1.0, 1.0));
+    far_4 = inverseViewProjection * (vec4(pos, +1.0, 1.0));
 
 }
@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <cstdlib>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -9,6 +10,10 @@
 #include <ft2build.h>
 #include "render/renderer.h"
 #include "render/camera.h"
+#include "util/profiler.h"
+#include "util/pacing.h"
+#include "util/benchmark.h"
+#include "render/camerapath.h"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
@@ -16,7 +21,9 @@
 const unsigned int SCR_WIDTH = 1920;
 const unsigned int SCR_HEIGHT = 1080;
 
-void checkErrors() {
+// Prints any pending GL errors; returns false if there were some.
+bool checkErrors() {
+        bool ok = true;
         GLenum code;
         while ((code = glGetError()) != GL_NO_ERROR) {
             std::cerr << "GLERROR[" << code << "] ";
@@ -34,10 +41,20 @@ void checkErrors() {
                 break;
             }
             std::cerr << std::endl;
-            exit(EXIT_FAILURE);
+            ok = false;
         }
+        return ok;
 };
 
+// Command line: `--replay <path>` replays a recorded camera path as a benchmark, writing
+// the timings to `--out <file>`; `--headless` does so in a hidden window and exits. The
+// hidden window still needs a display (on Linux an X11 or Wayland one, e.g. xvfb-run for
+// CI), there is no surfaceless context.
+struct AppOptions {
+    std::string replay;
+    std::string output = "benchmark.json";
+    bool headless = false;
+};
 
 class App {
 private:
@@ -49,10 +66,33 @@ private:
     bool firstMouse = true;
     float lastX = SCR_WIDTH / 2.0f;
     float lastY = SCR_HEIGHT / 2.0f;
+    bool m_compareRequested = false;
+    // Frame pacing: vsync, a frame limiter, or uncapped for measuring render throughput.
+    // The simulation runs on its own fixed tick either way.
+    enum class Pacing { VSync, Capped, Uncapped };
+    Pacing m_pacing = Pacing::VSync;
+    int m_targetFps = 144;
+    FrameLimiter m_limiter;
+    FixedTimestep m_timestep;
+    int m_frameTicks = 0;
+    // camera position at the last two ticks; frames are drawn between them
+    glm::vec3 m_previousPosition;
+    glm::vec3 m_simPosition;
+    // Camera path recording, one key per simulation tick, and replay, one key per frame.
+    // During a replay m_replayFrame counts frames from the first key; the last key is held
+    // for GpuTimer::FRAMES more frames until every frame's GPU time has come back.
+    AppOptions m_options;
+    CameraPath m_cameraPath;
+    bool m_recording = false;
+    long m_replayFrame = -1;
+    std::vector<FrameTiming> m_replayTimings;
+    bool m_replayDynamicResolution = false;
+    Pacing m_replayPacing = Pacing::VSync;
+    int m_exitCode = EXIT_SUCCESS;
 
 
 public:
-    App() {
+    explicit App(const AppOptions& options) : m_options(options) {
         m_window = initWindow("OpenGL", SCR_WIDTH, SCR_HEIGHT);
         m_renderer = std::make_unique<Renderer>();
        };
@@ -60,23 +100,24 @@ public:
 
     GLFWwindow* initWindow(const std::string &title, int width, int height) {
         
+        // set first so a failing glfwInit says why
+        glfwSetErrorCallback([](int code, const char *error) {
+            std::cerr << "[" << code << "] " << error << std::endl;
+        });
         if (!glfwInit()) {
             std::cerr << "GLFW failed to initialize." << std::endl;
             exit(EXIT_FAILURE);
         }
 
-        glfwSetErrorCallback([](int code, const char *error) {
-            std::cerr << "[" << code << "] " << error << std::endl;
-        });
-
         glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
         glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
         glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); 
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, m_options.headless ? GLFW_FALSE : GLFW_TRUE);
         
         GLFWwindow* window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
         if (window == nullptr) {
-            std::cout << "Failed to create GLFW window" << std::endl;
+            std::cerr << "Failed to create GLFW window" << std::endl;
             glfwTerminate();
             exit(EXIT_FAILURE);
         }
@@ -140,6 +181,67 @@ public:
 
     };
 
+    void setPacing(Pacing pacing) {
+        m_pacing = pacing;
+        glfwSwapInterval(pacing == Pacing::VSync ? 1 : 0);
+        m_limiter.setTargetFps(pacing == Pacing::Capped ? m_targetFps : 0.0);
+    };
+
+    bool replaying() const { return m_replayFrame >= 0; }
+
+    // Replays the camera path in `filepath` uncapped and at a fixed resolution, so runs
+    // are comparable, and writes the timings to m_options.output when it ends.
+    bool startReplay(const std::string& filepath) {
+        if (!m_cameraPath.load(filepath) || m_cameraPath.empty()) {
+            std::cerr << "Nothing to replay in " << filepath << std::endl;
+            return false;
+        }
+        m_recording = false;
+        m_replayFrame = 0;
+        m_replayTimings.clear();
+        m_replayDynamicResolution = m_renderer->dynamicResolutionEnabled();
+        m_replayPacing = m_pacing;
+        m_renderer->setDynamicResolutionEnabled(false);
+        m_renderer->gpuTimer().setAlwaysOn(true);
+        setPacing(Pacing::Uncapped);
+        return true;
+    };
+
+    // Called after render() each frame of a replay with the CPU time so far
+    void advanceReplay(float cpuMs) {
+        if (!m_renderer->ready()) {
+            return; // still loading: don't start the clock yet
+        }
+        const size_t frame = size_t(m_replayFrame);
+        if (frame < m_cameraPath.size()) {
+            m_replayTimings.push_back({ cpuMs, 0.0f });
+        }
+        if (frame >= GpuTimer::FRAMES && frame - GpuTimer::FRAMES < m_replayTimings.size()) {
+            m_replayTimings[frame - GpuTimer::FRAMES].gpuMs = m_renderer->gpuTimer().lastFrameMs();
+        }
+        if (++m_replayFrame < long(m_cameraPath.size() + GpuTimer::FRAMES)) {
+            return;
+        }
+        m_replayFrame = -1;
+        const bool written = writeBenchmark(m_options.output, m_replayTimings);
+        std::vector<float> cpu, gpu;
+        for (const FrameTiming& timing : m_replayTimings) {
+            cpu.push_back(timing.cpuMs);
+            gpu.push_back(timing.gpuMs);
+        }
+        const TimingSummary cpuSummary = summarizeTimings(cpu);
+        const TimingSummary gpuSummary = summarizeTimings(gpu);
+        std::cout << "Replayed " << m_replayTimings.size() << " frames: CPU mean " << cpuSummary.mean << " p99 " << cpuSummary.p99
+                  << " worst " << cpuSummary.worst << " ms, GPU mean " << gpuSummary.mean << " p99 " << gpuSummary.p99 << " worst "
+                  << gpuSummary.worst << " ms, written to " << m_options.output << std::endl;
+        m_renderer->setDynamicResolutionEnabled(m_replayDynamicResolution);
+        setPacing(m_replayPacing);
+        if (m_options.headless) {
+            m_exitCode = written ? EXIT_SUCCESS : EXIT_FAILURE;
+            glfwSetWindowShouldClose(m_window, GLFW_TRUE);
+        }
+    };
+
     void processMouseMovement(GLFWwindow* window, double xpos, double ypos) {
         if (io.WantCaptureMouse) {
             return;
@@ -174,6 +276,175 @@ public:
         ImGui::NewFrame();
         ImGui::Begin("Render Data");
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+        if (const WorldLoader* loader = m_renderer->loader()) {
+            ImGui::ProgressBar(loader->progress(), ImVec2(-1.0f, 0.0f), loader->status());
+        }
+        ImGui::Text("GPU upload: %.2f MB this frame", m_renderer->uploadBytes() / (1024.0 * 1024.0));
+        ImGui::Text("Shaders: %.1f ms (%s)", m_renderer->shader()->linkMs(),
+                    m_renderer->shader()->linkedFromCache() ? "binary cache" : "compiled");
+        if (ImGui::CollapsingHeader("Voxel pass")) {
+            int path = static_cast<int>(m_renderer->voxelPath());
+            ImGui::RadioButton("Fragment", &path, static_cast<int>(Renderer::VoxelPath::Fragment));
+            ImGui::SameLine();
+            ImGui::RadioButton("Compute (8x8 tiles)", &path, static_cast<int>(Renderer::VoxelPath::Compute));
+            m_renderer->setVoxelPath(static_cast<Renderer::VoxelPath>(path));
+            ImGui::Text("GPU: %.3f ms%s", m_renderer->gpuTimer().lastFrameMs(),
+                        m_renderer->gpuTimer().active() ? "" : " (enable the profiler to measure)");
+            bool dynamicResolution = m_renderer->dynamicResolutionEnabled();
+            if (ImGui::Checkbox("Dynamic resolution", &dynamicResolution)) {
+                m_renderer->setDynamicResolutionEnabled(dynamicResolution);
+            }
+            if (dynamicResolution) {
+                ResolutionController &resolution = m_renderer->resolution();
+                ImGui::SliderFloat("GPU budget", &resolution.targetMs, 2.0f, 33.0f, "%.1f ms");
+                ImGui::SliderFloat("Min scale", &resolution.minScale, 0.25f, 1.0f, "%.2f");
+                ImGui::SliderFloat("Max scale", &resolution.maxScale, 0.25f, 1.0f, "%.2f");
+            }
+            const glm::ivec2 renderSize = m_renderer->renderSize();
+            ImGui::Text("Rendering at %dx%d (scale %.2f)", renderSize.x, renderSize.y,
+                        m_renderer->dynamicResolutionEnabled() ? m_renderer->resolution().scale() : 1.0f);
+            bool beam = m_renderer->beamEnabled();
+            if (ImGui::Checkbox("Beam prepass", &beam)) {
+                m_renderer->setBeamEnabled(beam);
+            }
+            ImGui::SameLine();
+            bool counting = m_renderer->countingSteps();
+            if (ImGui::Checkbox("Count steps", &counting)) {
+                m_renderer->setCountingSteps(counting);
+            }
+            bool reproject = m_renderer->reprojectionEnabled();
+            if (ImGui::Checkbox("Temporal reprojection", &reproject)) {
+                m_renderer->setReprojectionEnabled(reproject);
+            }
+            if (reproject) {
+                int interval = m_renderer->refreshInterval();
+                if (ImGui::SliderInt("Full refresh every", &interval, 1, 240, "%d frames")) {
+                    m_renderer->setRefreshInterval(interval);
+                }
+            }
+            if (counting) {
+                ImGui::Text("Steps per pixel: %.2f", m_renderer->stepsPerPixel());
+            }
+            bool lighting = m_renderer->lightingEnabled();
+            if (ImGui::Checkbox("Baked lighting", &lighting)) {
+                m_renderer->setLightingEnabled(lighting);
+            }
+            ImGui::SameLine();
+            bool occlusion = m_renderer->occlusionEnabled();
+            if (ImGui::Checkbox("Ambient occlusion", &occlusion)) {
+                m_renderer->setOcclusionEnabled(occlusion);
+            }
+            bool bricks = m_renderer->bricksEnabled();
+            if (ImGui::Checkbox("Brick atlas", &bricks)) {
+                m_renderer->setBricksEnabled(bricks);
+            }
+            ImGui::SameLine();
+            ImGui::Text("%zu dense bricks", m_renderer->brickCount());
+            if (ImGui::Button("Carve at view centre")) {
+                // a small sphere where the camera looks, to exercise incremental relighting
+                const Camera *camera = m_renderer->camera();
+                const RayHit hit = m_renderer->pick(camera->position, camera->front);
+                if (hit.hit) {
+                    const glm::ivec3 centre(glm::floor(camera->position + camera->front * hit.t));
+                    m_renderer->editWorld([centre](SVO &svo) {
+                        for (int x = -4; x <= 4; ++x) {
+                            for (int y = -4; y <= 4; ++y) {
+                                for (int z = -4; z <= 4; ++z) {
+                                    const glm::ivec3 pos = centre + glm::ivec3(x, y, z);
+                                    // only clear solid voxels, inserting into air would grow empty leaves
+                                    if (x * x + y * y + z * z <= 16 && svo.get(pos) != rgb32_t(0)) {
+                                        svo.insert(pos, rgb32_t(0));
+                                    }
+                                }
+                            }
+                        }
+                    });
+                }
+            }
+            int view = m_renderer->debugView();
+            if (ImGui::Combo("View", &view, "Shaded\0Traversal steps\0Normals\0")) {
+                m_renderer->setDebugView(view);
+            }
+            if (ImGui::Button("Compare with CPU reference")) {
+                m_compareRequested = true;
+            }
+        }
+        if (ImGui::CollapsingHeader("Octree")) {
+            const SVOStats stats = m_renderer->world().stats();
+            constexpr double MB = 1024.0 * 1024.0;
+            ImGui::Text("Depth: %zu, bounds (%d, %d, %d) to (%d, %d, %d)", stats.depth, stats.minIncl.x, stats.minIncl.y,
+                        stats.minIncl.z, stats.maxIncl.x, stats.maxIncl.y, stats.maxIncl.z);
+            ImGui::Text("Voxels: %zu in %zu leaves (%.1f%% fill)", stats.voxels, stats.leaves, stats.fillRatio() * 100.0);
+            ImGui::Text("Branches: %zu", stats.branches);
+            ImGui::Text("Memory: %.2f MB (branches %.2f, leaves %.2f, of which payload %.2f)", stats.totalBytes() / MB,
+                        stats.branchBytes / MB, stats.leafBytes / MB, stats.payloadBytes / MB);
+            if (ImGui::TreeNode("Nodes per level")) {
+                for (size_t level = stats.depth + 1; level-- > 0;) {
+                    ImGui::Text("Level %2zu: %zu", level, stats.nodesPerLevel[level]);
+                }
+                ImGui::TreePop();
+            }
+        }
+        if (ImGui::CollapsingHeader("Profiler")) {
+            bool recording = profiler::enabled();
+            if (ImGui::Checkbox("Record scopes", &recording)) {
+                profiler::setEnabled(recording);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Export trace")) {
+                profiler::writeChromeTrace("trace.json");
+            }
+            const profiler::FrameSummary frames = profiler::frameSummary();
+            char overlay[64];
+            snprintf(overlay, sizeof(overlay), "p50 %.2f  p95 %.2f  p99 %.2f ms", frames.p50, frames.p95, frames.p99);
+            ImGui::PlotLines("##frametimes", frames.history.data(), static_cast<int>(frames.history.size()), 0, overlay,
+                             0.0f, frames.p99 * 1.5f, ImVec2(-1.0f, 80.0f));
+            if (recording) {
+                ImGui::Text("GPU: %.3f ms", m_renderer->gpuTimer().lastFrameMs());
+                std::vector<profiler::Event> events;
+                profiler::lastFrame(events);
+                for (const profiler::Event& event : events) {
+                    ImGui::Text("%*s%s: %.3f ms", static_cast<int>(event.depth * 2), "", event.name, (event.end - event.start) * 1e-6);
+                }
+            }
+        }
+        if (ImGui::CollapsingHeader("Frame pacing")) {
+            int pacing = static_cast<int>(m_pacing);
+            bool changed = ImGui::RadioButton("VSync", &pacing, static_cast<int>(Pacing::VSync));
+            ImGui::SameLine();
+            changed |= ImGui::RadioButton("Capped", &pacing, static_cast<int>(Pacing::Capped));
+            ImGui::SameLine();
+            changed |= ImGui::RadioButton("Uncapped", &pacing, static_cast<int>(Pacing::Uncapped));
+            if (pacing == static_cast<int>(Pacing::Capped)) {
+                changed |= ImGui::SliderInt("Target", &m_targetFps, 30, 500, "%d FPS");
+            }
+            if (changed) {
+                setPacing(static_cast<Pacing>(pacing));
+            }
+            ImGui::Text("Simulation: %.0f Hz, %d ticks this frame", 1.0 / m_timestep.tick(), m_frameTicks);
+            if (m_pacing == Pacing::Capped) {
+                ImGui::Text("Limiter wait: %.2f ms", m_limiter.lastWaitMs());
+            }
+        }
+        if (ImGui::CollapsingHeader("Camera path")) {
+            if (replaying()) {
+                ImGui::Text("Replaying frame %ld of %zu", m_replayFrame, m_cameraPath.size());
+            } else if (ImGui::Button(m_recording ? "Stop recording" : "Record")) {
+                if (m_recording) {
+                    m_cameraPath.save("camera.path");
+                } else {
+                    m_cameraPath.clear();
+                }
+                m_recording = !m_recording;
+            }
+            if (!replaying() && !m_recording) {
+                ImGui::SameLine();
+                if (ImGui::Button("Replay benchmark")) {
+                    startReplay("camera.path");
+                }
+            }
+            ImGui::Text("%zu keys, saved to camera.path; timings go to %s", m_cameraPath.size(), m_options.output.c_str());
+        }
         // camera data pos is  glm::vec3
         ImGui::Text("Camera Position: (%.2f, %.2f, %.2f)", m_renderer->camera()->position.x, m_renderer->camera()->position.y, m_renderer->camera()->position.z);
         ImGui::Text("Camera Direction: (%.2f, %.2f, %.2f)", m_renderer->camera()->front.x, m_renderer->camera()->front.y, m_renderer->camera()->front.z);
@@ -187,26 +458,81 @@ public:
         ImGui::Render();
     };
 
-    void run() {
+    // Runs until the window closes and returns the exit code. The renderer (and with it any
+    // world still loading) is destroyed first, while its GL context is still current.
+    int run() {
+        if (!m_options.replay.empty() && !startReplay(m_options.replay) && m_options.headless) {
+            glfwSetWindowShouldClose(m_window, GLFW_TRUE);
+            m_exitCode = EXIT_FAILURE;
+        }
         m_lastTime = glfwGetTime();
+        m_simPosition = m_previousPosition = m_renderer->camera()->position;
         while (!glfwWindowShouldClose(m_window)) {
             m_currentTime = glfwGetTime();
-            float deltaTime = m_currentTime - m_lastTime;
+            const double frameTime = m_currentTime - m_lastTime;
             m_lastTime = m_currentTime;
-            glfwPollEvents();
-            processInput(m_window, deltaTime);
-            imguiRender();
+            {
+                PROFILE_SCOPE("Input");
+                glfwPollEvents();
+            }
+            {
+                PROFILE_SCOPE("Simulation");
+                Camera* camera = m_renderer->camera();
+                if (replaying()) {
+                    m_cameraPath.apply(std::min(size_t(m_replayFrame), m_cameraPath.size() - 1), *camera);
+                    m_simPosition = m_previousPosition = camera->position;
+                } else {
+                    camera->position = m_simPosition; // undo last frame's interpolation
+                    m_frameTicks = m_timestep.advance(frameTime);
+                    for (int i = 0; i < m_frameTicks; ++i) {
+                        m_previousPosition = camera->position;
+                        processInput(m_window, float(m_timestep.tick()));
+                        if (m_recording) {
+                            m_cameraPath.record(*camera);
+                        }
+                    }
+                    m_simPosition = camera->position;
+                    camera->position = glm::mix(m_previousPosition, m_simPosition, float(m_timestep.alpha()));
+                }
+            }
+            {
+                PROFILE_SCOPE("ImGui");
+                imguiRender();
+            }
             m_renderer->render();
-            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-            glfwSwapBuffers(m_window);
-            checkErrors();
+            if (m_compareRequested) {
+                m_renderer->compareWithReference("reference");
+                m_compareRequested = false;
+            }
+            if (!m_options.headless) {
+                PROFILE_SCOPE("ImGui draw");
+                GpuScope gpuScope(m_renderer->gpuTimer(), "ImGui");
+                ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            }
+            if (replaying()) {
+                advanceReplay(float((glfwGetTime() - m_currentTime) * 1000.0));
+            }
+            {
+                PROFILE_SCOPE("Swap");
+                glfwSwapBuffers(m_window);
+            }
+            {
+                PROFILE_SCOPE("Frame limiter");
+                m_limiter.wait();
+            }
+            if (!checkErrors()) {
+                m_exitCode = EXIT_FAILURE;
+                break;
+            }
+            profiler::frameMark();
         }
+        m_renderer.reset();
         ImGui_ImplOpenGL3_Shutdown();
         ImGui_ImplGlfw_Shutdown();
         ImGui::DestroyContext();
         glfwDestroyWindow(m_window);
         glfwTerminate();
-        exit(EXIT_SUCCESS);
+        return m_exitCode;
     };
     
     static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -216,9 +542,33 @@ public:
 };
 
 
-int main() {
-    auto app = App();
-    app.run();
-    return 0;
+int main(int argc, char** argv) {
+    AppOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--replay" && i + 1 < argc) {
+            options.replay = argv[++i];
+        } else if (arg == "--out" && i + 1 < argc) {
+            options.output = argv[++i];
+        } else if (arg == "--headless") {
+            options.headless = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--replay <camera path> [--out <json>] [--headless]]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.headless && options.replay.empty()) {
+        std::cerr << "--headless needs a path to --replay" << std::endl;
+        return EXIT_FAILURE;
+    }
+#ifdef __linux__
+    if (options.headless && std::getenv("DISPLAY") == nullptr && std::getenv("WAYLAND_DISPLAY") == nullptr) {
+        std::cerr << "--headless still opens a hidden window and needs a display, but neither DISPLAY nor "
+                     "WAYLAND_DISPLAY is set; run it under a virtual one, e.g. xvfb-run" << std::endl;
+        return EXIT_FAILURE;
+    }
+#endif
+    App app(options);
+    return app.run();
 }
 
@@ -1,48 +1,159 @@
 #include "buffer.h"
-#include <glad/glad.h>
+#include "../util/profiler.h"
 
-Buffer::Buffer(size_t size) {
-    create(size);
-    bind();
-    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)size, nullptr, GL_DYNAMIC_DRAW);
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// indexed targets need region offsets aligned to what the driver asks for
+size_t offsetAlignment(BufferTarget target) {
+    GLint alignment = 1;
+    if (target == BufferTarget::Uniform) {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    } else if (target == BufferTarget::ShaderStorage) {
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    }
+    return size_t(std::max(alignment, 1));
+}
+
+GLenum glTarget(BufferTarget target) {
+    switch (target) {
+    case BufferTarget::Uniform:
+        return GL_UNIFORM_BUFFER;
+    case BufferTarget::ShaderStorage:
+        return GL_SHADER_STORAGE_BUFFER;
+    default:
+        return GL_ARRAY_BUFFER;
+    }
 }
 
-Buffer::Buffer(const void *data, size_t size) {
-    create(size);
-    bind();
-    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)size, data, GL_STATIC_DRAW);
+} // namespace
+
+Buffer::Buffer(BufferTarget target, size_t size, const void *data, Usage usage, uint32_t regions) : m_target(target), m_size(size) {
+    regions = usage == Usage::Stream ? std::max(regions, 1u) : 1u;
+    const size_t alignment = regions > 1 ? offsetAlignment(target) : 1;
+    m_stride = (size + alignment - 1) / alignment * alignment;
+    // immutable storage can't be empty; a zero-sized buffer still gets a few bytes
+    const size_t bytes = std::max<size_t>(m_stride * regions, 4);
+
+    glCreateBuffers(1, &m_id);
+    switch (usage) {
+    case Usage::Static: {
+        // static storage takes no later writes, so padded contents are copied in up front
+        std::vector<uint8_t> padded;
+        if (data != nullptr && size < bytes) {
+            padded.assign(bytes, 0);
+            std::memcpy(padded.data(), data, size);
+            data = padded.data();
+        }
+        glNamedBufferStorage(m_id, GLsizeiptr(bytes), data, 0);
+        break;
+    }
+    case Usage::Dynamic:
+        glNamedBufferStorage(m_id, GLsizeiptr(bytes), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        if (data != nullptr && size > 0) {
+            glNamedBufferSubData(m_id, 0, GLsizeiptr(size), data);
+        }
+        break;
+    case Usage::Stream: {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glNamedBufferStorage(m_id, GLsizeiptr(bytes), nullptr, flags);
+        m_mapped = static_cast<uint8_t *>(glMapNamedBufferRange(m_id, 0, GLsizeiptr(bytes), flags));
+        if (m_mapped == nullptr) {
+            std::cerr << "Failed to map a streaming buffer of " << bytes << " bytes" << std::endl;
+            throw std::runtime_error("Failed to map a streaming buffer");
+        }
+        for (uint32_t i = 0; data != nullptr && i < regions; ++i) {
+            std::memcpy(m_mapped + i * m_stride, data, size);
+        }
+        m_fences.assign(regions, nullptr);
+        break;
+    }
+    }
 }
 
 Buffer::~Buffer() {
-    glDeleteVertexArrays(1, &vertexArrayID);
-    glDeleteBuffers(1, &bufferID);
+    release();
+}
+
+Buffer::Buffer(Buffer &&other) noexcept {
+    *this = std::move(other);
 }
 
-void Buffer::create(size_t size) {
-    this->m_size = size;
-    glGenVertexArrays(1, &vertexArrayID);
-    glGenBuffers(1, &bufferID);
+Buffer &Buffer::operator=(Buffer &&other) noexcept {
+    if (this != &other) {
+        release();
+        m_target = other.m_target;
+        m_id = std::exchange(other.m_id, 0);
+        m_size = std::exchange(other.m_size, 0);
+        m_stride = std::exchange(other.m_stride, 0);
+        m_mapped = std::exchange(other.m_mapped, nullptr);
+        m_fences = std::move(other.m_fences);
+        other.m_fences.clear();
+        m_region = std::exchange(other.m_region, 0);
+        m_stalls = std::exchange(other.m_stalls, 0);
+    }
+    return *this;
 }
 
-void Buffer::bind() const {
-    glBindVertexArray(vertexArrayID);
-    glBindBuffer(GL_ARRAY_BUFFER, bufferID);
+void Buffer::release() {
+    for (GLsync fence : m_fences) {
+        if (fence != nullptr) {
+            glDeleteSync(fence);
+        }
+    }
+    m_fences.clear();
+    if (m_mapped != nullptr) {
+        glUnmapNamedBuffer(m_id);
+        m_mapped = nullptr;
+    }
+    if (m_id != 0) {
+        glDeleteBuffers(1, &m_id);
+        m_id = 0;
+    }
 }
 
-void Buffer::unbind() {
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+void Buffer::update(const void *data, size_t size, size_t offset) {
+    glNamedBufferSubData(m_id, GLintptr(offset), GLsizeiptr(size), data);
 }
 
-size_t Buffer::getSize() const {
-    return m_size;
+void Buffer::setSize(size_t size) {
+    if (size > m_stride) {
+        std::cerr << "Buffer size " << size << " is past its capacity of " << m_stride << " bytes" << std::endl;
+        throw std::runtime_error("Buffer size past capacity");
+    }
+    m_size = size;
 }
 
-void Buffer::setData(const void *data, size_t offset, size_t size) {
-    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)offset, (GLsizei)size, data);
+void *Buffer::next() {
+    // everything reading the current region has been submitted by now
+    m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_region = (m_region + 1) % uint32_t(m_fences.size());
+    if (GLsync &fence = m_fences[m_region]; fence != nullptr) {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            PROFILE_SCOPE("Buffer stall");
+            ++m_stalls;
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    return m_mapped + m_region * m_stride;
 }
 
-void Buffer::setAttribute(uint index, uint count, size_t size, size_t offset) {
-    glEnableVertexAttribArray(index);
-    glVertexAttribPointer(index, (GLint)count, GL_FLOAT, GL_FALSE, (GLsizei)size, reinterpret_cast<void *>(offset));
+void Buffer::bind(GLuint index) const {
+    if (m_target == BufferTarget::Vertex) {
+        glBindBuffer(GL_ARRAY_BUFFER, m_id);
+        return;
+    }
+    if (m_size == 0) {
+        // a range can't be empty, and binding the padding would make it look like data
+        glBindBufferBase(glTarget(m_target), index, 0);
+        return;
+    }
+    glBindBufferRange(glTarget(m_target), index, m_id, GLintptr(m_region * m_stride), GLsizeiptr(m_size));
 }
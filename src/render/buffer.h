@@ -1,29 +1,70 @@
 #pragma once
 
-
 #include <cstddef>
-#include <sys/types.h>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+
+enum class BufferTarget { Vertex, Uniform, ShaderStorage };
 
+// OpenGL buffer with immutable storage, created and updated through DSA. Storage can't be
+// resized: to grow past capacity(), assign a new Buffer. Dynamic buffers can be created
+// larger than their contents and setSize() then says how much of them is in use.
+//
+// Stream buffers are persistently and coherently mapped and split into `regions` copies
+// of `size` bytes used round robin, one per frame in flight. next() fences the region the
+// frame just used and hands out the next one, waiting only if the GPU is still reading it,
+// so with enough regions rewriting a buffer every frame never stalls.
 class Buffer {
-    private:
-        size_t m_size = 0;
+public:
+    enum class Usage {
+        Static,  // contents given at creation
+        Dynamic, // rewritten with update()
+        Stream,  // rewritten every frame through next()
+    };
 
-    protected:
-        uint bufferID = 0, vertexArrayID = 0;
+    Buffer() = default;
+    // `data`, when given, is `size` bytes and fills every region.
+    Buffer(BufferTarget target, size_t size, const void *data = nullptr, Usage usage = Usage::Static, uint32_t regions = 1);
+    ~Buffer();
 
-        void create(size_t size);
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+    Buffer(Buffer &&other) noexcept;
+    Buffer &operator=(Buffer &&other) noexcept;
 
-    public:
-        explicit Buffer(size_t maxSize);
-        Buffer(const void *data, size_t size);
-        virtual ~Buffer();
+    GLuint id() const { return m_id; }
+    // Bytes in one region
+    size_t size() const { return m_size; }
+    // Bytes one region can hold
+    size_t capacity() const { return m_stride; }
 
-        void bind() const;
-        static void unbind();
+    // Dynamic buffers only
+    void update(const void *data, size_t size, size_t offset = 0);
+    // Dynamic buffers only: the bytes in use, which bind() exposes, up to capacity()
+    void setSize(size_t size);
 
-        size_t getSize() const;
+    // Stream buffers only: moves on to the next region and returns where to write it.
+    void *next();
+    template <typename T>
+    T *next() { return static_cast<T *>(next()); }
+    // Times next() had to wait for the GPU; nonzero means more regions are needed
+    size_t stalls() const { return m_stalls; }
 
-        static void setData(const void *data, size_t offset, size_t size);
-        static void setAttribute(uint index, uint count, size_t size, size_t offset);
-};
+    // Binds the current region to an indexed uniform or storage binding point, or as the
+    // GL_ARRAY_BUFFER for vertex buffers (`index` is then ignored). An empty buffer leaves
+    // the binding point unbound.
+    void bind(GLuint index = 0) const;
 
+private:
+    BufferTarget m_target = BufferTarget::Vertex;
+    GLuint m_id = 0;
+    size_t m_size = 0;
+    size_t m_stride = 0; // bytes between regions, aligned for binding ranges
+    uint8_t *m_mapped = nullptr;
+    std::vector<GLsync> m_fences; // per region, set when the GPU may still read it
+    uint32_t m_region = 0;
+    size_t m_stalls = 0;
+
+    void release();
+};
@@ -58,6 +58,14 @@ public:
     glm::mat4 getViewProjectionMatrix(float width, float height);
     void processKeyboard(Camera_Movement direction, float deltaTime);
     void processMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true);
+
+    // sets the Euler angles directly, e.g. when replaying a recorded path
+    void setOrientation(float yaw, float pitch)
+    {
+        this->yaw = yaw;
+        this->pitch = pitch;
+        updateCameraVectors();
+    }
     
 private:
     // calculates the front vector from the Camera's (updated) Euler Angles
@@ -0,0 +1,62 @@
+#include "camerapath.h"
+#include "camera.h"
+
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+const char *HEADER = "voxels-camera-path 1";
+
+} // namespace
+
+void CameraPath::record(const Camera &camera) {
+    m_keys.push_back({ camera.position, camera.yaw, camera.pitch });
+}
+
+void CameraPath::apply(size_t index, Camera &camera) const {
+    const CameraKey &key = m_keys[index];
+    camera.position = key.position;
+    camera.setOrientation(key.yaw, key.pitch);
+}
+
+bool CameraPath::save(const std::string &filepath) const {
+    std::ofstream out(filepath);
+    if (!out) {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        return false;
+    }
+    // enough digits that a saved path replays bit for bit
+    out.precision(std::numeric_limits<float>::max_digits10);
+    out << HEADER << "\n";
+    for (const CameraKey &key : m_keys) {
+        out << key.position.x << ' ' << key.position.y << ' ' << key.position.z << ' ' << key.yaw << ' ' << key.pitch << "\n";
+    }
+    return bool(out);
+}
+
+bool CameraPath::load(const std::string &filepath) {
+    std::ifstream in(filepath);
+    if (!in) {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        return false;
+    }
+    std::string header;
+    std::getline(in, header);
+    if (header != HEADER) {
+        std::cerr << "Not a camera path: " << filepath << std::endl;
+        return false;
+    }
+    std::vector<CameraKey> keys;
+    CameraKey key;
+    while (in >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch) {
+        keys.push_back(key);
+    }
+    if (!in.eof()) {
+        std::cerr << "Malformed camera path: " << filepath << " (after " << keys.size() << " keys)" << std::endl;
+        return false;
+    }
+    m_keys = std::move(keys);
+    return true;
+}
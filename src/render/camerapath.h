@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+class Camera;
+
+// Camera state sampled once per simulation tick, recorded from live input and replayed
+// frame by frame so that benchmark runs see exactly the same views on every build.
+struct CameraKey {
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+};
+
+class CameraPath {
+public:
+    void clear() { m_keys.clear(); }
+    void record(const Camera &camera);
+    // Moves `camera` to key `index`
+    void apply(size_t index, Camera &camera) const;
+    size_t size() const { return m_keys.size(); }
+    bool empty() const { return m_keys.empty(); }
+
+    // Plain text: a header line, then "x y z yaw pitch" per key.
+    bool save(const std::string &filepath) const;
+    bool load(const std::string &filepath);
+
+private:
+    std::vector<CameraKey> m_keys;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Per-frame values shared by every pass, uploaded once per frame to the uniform buffer at
+// FRAME_DATA_BINDING. Mirrors the std140 `FrameData` block in the shaders: keep the
+// members 16-byte aligned and in the same order.
+struct FrameData {
+    glm::mat4 viewProjection;
+    glm::mat4 inverseViewProjection;
+    glm::mat4 previousInverseViewProjection; // last frame's, for reprojecting its hits
+    glm::vec4 cameraPosition;         // w unused
+    glm::vec4 previousCameraPosition; // w unused
+    glm::vec2 resolution;
+    float time;
+    int debugView; // a DebugView
+    int flags;     // FrameFlags
+    int pad[3];
+};
+
+static_assert(sizeof(FrameData) == 256, "FrameData must match the std140 layout of the shader block");
+
+// What the voxel pass outputs, selected per frame
+enum DebugView : int {
+    DEBUG_VIEW_SHADED = 0,
+    DEBUG_VIEW_STEPS = 1,   // traversal steps per pixel, blue (few) to red (MAX_STEPS)
+    DEBUG_VIEW_NORMALS = 2,
+};
+
+enum FrameFlags : int {
+    FRAME_BEAM = 1 << 0,        // start primary rays at the beam prepass distance
+    FRAME_COUNT_STEPS = 1 << 1, // accumulate traversal steps into the stats buffer
+    FRAME_REPROJECT = 1 << 2,   // start primary rays near last frame's hits (GPU only)
+    FRAME_LIGHTING = 1 << 3,    // shade from the baked lighting buffer instead of N.L
+    FRAME_OCCLUSION = 1 << 4,   // darken faces by the AO baked into the voxels
+    FRAME_BRICKS = 1 << 5,      // step through brick nodes in the brick atlas
+};
+
+// Binding points shared with the shaders, which get them as defines
+constexpr unsigned int FRAME_DATA_BINDING = 0; // uniform buffer
+constexpr unsigned int OCTREE_BINDING = 0;     // shader storage buffer, SVO::flatten layout
+constexpr unsigned int STATS_BINDING = 1;      // shader storage buffer, TraceStats
+constexpr unsigned int LIGHTING_BINDING = 2;   // shader storage buffer, VoxelLighting::flatten layout
+constexpr unsigned int BEAM_IMAGE_UNIT = 1;    // r32f image of beam distances per tile
+constexpr unsigned int HISTORY_IMAGE_UNIT = 2; // r32f image of hit distances per pixel
+constexpr unsigned int SEED_IMAGE_UNIT = 3;    // r32ui image of reprojected hit distances
+constexpr unsigned int BRICK_TEXTURE_UNIT = 0; // r8ui 3D texture, the BrickAtlas
@@ -0,0 +1,79 @@
+#include "gputimer.h"
+#include "../util/profiler.h"
+
+GpuTimer::~GpuTimer() {
+    for (Frame &frame : m_frames) {
+        for (Pass &pass : frame.passes) {
+            glDeleteQueries(2, pass.queries);
+        }
+    }
+}
+
+bool GpuTimer::active() const {
+    return m_alwaysOn || profiler::enabled();
+}
+
+void GpuTimer::beginFrame() {
+    m_current = (m_current + 1) % FRAMES;
+    collect(m_frames[m_current]);
+    m_open.clear();
+}
+
+void GpuTimer::begin(const char *name) {
+    Frame &frame = m_frames[m_current];
+    if (frame.used == frame.passes.size()) {
+        Pass pass{};
+        glGenQueries(2, pass.queries);
+        frame.passes.push_back(pass);
+    }
+    Pass &pass = frame.passes[frame.used];
+    pass.name = name;
+    pass.depth = uint32_t(m_open.size());
+    glQueryCounter(pass.queries[0], GL_TIMESTAMP);
+    m_open.push_back(frame.used++);
+}
+
+void GpuTimer::end() {
+    if (m_open.empty()) {
+        return;
+    }
+    glQueryCounter(m_frames[m_current].passes[m_open.back()].queries[1], GL_TIMESTAMP);
+    m_open.pop_back();
+}
+
+void GpuTimer::collect(Frame &frame) {
+    if (frame.used == 0) {
+        m_lastFrameMs = 0.0f; // nothing was timed
+        return;
+    }
+    // GPU timestamps are in their own clock; line them up with the CPU clock now
+    GLint64 gpuNow = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    const int64_t offset = profiler::now() - gpuNow;
+
+    float total = 0.0f;
+    for (size_t i = 0; i < frame.used; ++i) {
+        const Pass &pass = frame.passes[i];
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(pass.queries[0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(pass.queries[1], GL_QUERY_RESULT, &end);
+        profiler::record("GPU", { pass.name, int64_t(start) + offset, int64_t(end) + offset, pass.depth });
+        if (pass.depth == 0) {
+            total += float(double(end - start) * 1e-6);
+        }
+    }
+    m_lastFrameMs = total;
+    frame.used = 0;
+}
+
+GpuScope::GpuScope(GpuTimer &timer, const char *name) : m_timer(timer.active() ? &timer : nullptr) {
+    if (m_timer != nullptr) {
+        m_timer->begin(name);
+    }
+}
+
+GpuScope::~GpuScope() {
+    if (m_timer != nullptr) {
+        m_timer->end();
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+
+// GL timestamp queries around GPU passes. Each frame's queries are read back FRAMES
+// frames later, by which time they have finished, so timing never stalls the pipeline.
+// Results go to the profiler's "GPU" track. Queries are only issued while the profiler is
+// enabled, or always when something else depends on the timings (setAlwaysOn).
+class GpuTimer {
+public:
+    GpuTimer() = default;
+    ~GpuTimer();
+
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    // Call once per frame before any pass; collects the frame whose slot is reused.
+    void beginFrame();
+    void begin(const char *name);
+    void end();
+
+    // GPU time of the newest collected frame: the sum of its outermost passes.
+    float lastFrameMs() const { return m_lastFrameMs; }
+
+    // Keep issuing queries with the profiler off, e.g. for dynamic resolution
+    bool alwaysOn() const { return m_alwaysOn; }
+    void setAlwaysOn(bool on) { m_alwaysOn = on; }
+    bool active() const;
+
+    // Frames between a pass running and its time showing up in lastFrameMs()
+    static constexpr size_t FRAMES = 4;
+
+private:
+
+    struct Pass {
+        const char *name;
+        GLuint queries[2];
+        uint32_t depth;
+    };
+
+    struct Frame {
+        std::vector<Pass> passes; // queries are kept and reused across frames
+        size_t used = 0;
+    };
+
+    std::array<Frame, FRAMES> m_frames;
+    size_t m_current = 0;
+    std::vector<size_t> m_open;
+    float m_lastFrameMs = 0.0f;
+    bool m_alwaysOn = false;
+
+    void collect(Frame &frame);
+};
+
+class GpuScope {
+public:
+    GpuScope(GpuTimer &timer, const char *name);
+    ~GpuScope();
+
+    GpuScope(const GpuScope &) = delete;
+    GpuScope &operator=(const GpuScope &) = delete;
+
+private:
+    GpuTimer *m_timer;
+};
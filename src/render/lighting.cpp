@@ -0,0 +1,211 @@
+#include "lighting.h"
+#include "occlusion.h"
+#include "raytrace.h"
+#include "../util/parallel.h"
+#include "../util/profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
+namespace {
+
+constexpr float PI = 3.14159265358979f;
+// rays start this far off the face so they don't hit their own voxel
+constexpr float RAY_OFFSET = 1e-3f;
+
+// positions made non-negative, 21 bits per axis
+const Vec3i32 KEY_OFFSET(1 << SVO::depth);
+
+uint64_t leafKey(Vec3i32 origin) {
+    const glm::uvec3 u(origin + KEY_OFFSET);
+    return uint64_t(u.x) << 42 | uint64_t(u.y) << 21 | uint64_t(u.z);
+}
+
+Vec3i32 keyOrigin(uint64_t key) {
+    constexpr uint64_t mask = (1u << 21) - 1;
+    return Vec3i32(glm::uvec3(unsigned(key >> 42 & mask), unsigned(key >> 21 & mask), unsigned(key & mask))) - KEY_OFFSET;
+}
+
+// lowest voxel of the leaf holding pos; leaves are 2x2x2 and aligned
+Vec3i32 leafOrigin(Vec3i32 pos) {
+    return pos - (pos & 1);
+}
+
+// i-th of n points spread over the unit square
+glm::vec2 sample2D(int i, int n) {
+    const float golden = 0.6180339887f;
+    return glm::vec2((float(i) + 0.5f) / float(n), std::fmod(float(i) * golden + 0.5f, 1.0f));
+}
+
+glm::vec3 faceNormal(int face) {
+    glm::vec3 normal(0.0f);
+    normal[face / 2] = face & 1 ? 1.0f : -1.0f;
+    return normal;
+}
+
+// does a ray reach `range` without hitting anything
+bool unoccluded(std::span<const uint32_t> nodes, glm::vec3 origin, glm::vec3 direction, float range, RayHit& hit) {
+    hit = traceFlattened(nodes, SVO::depth, origin, direction);
+    return !hit.hit || hit.t > range;
+}
+
+uint32_t lightFace(std::span<const uint32_t> nodes, const LightingOptions& options, Vec3i32 pos, int face) {
+    const glm::vec3 normal = faceNormal(face);
+    const glm::vec3 tangent = faceNormal(((face / 2 + 1) % 3) * 2 + 1);
+    const glm::vec3 bitangent = faceNormal(((face / 2 + 2) % 3) * 2 + 1);
+    const glm::vec3 centre = glm::vec3(pos) + 0.5f + normal * (0.5f + RAY_OFFSET);
+    const glm::vec3 sunDirection = glm::normalize(options.sunDirection);
+    RayHit hit;
+
+    float sun = 0.0f;
+    const float cosine = glm::dot(normal, sunDirection);
+    if (cosine > 0.0f) {
+        int visible = 0;
+        for (int i = 0; i < options.sunSamples; ++i) {
+            const glm::vec2 offset = (sample2D(i, options.sunSamples) - 0.5f) * 0.9f;
+            visible += unoccluded(nodes, centre + tangent * offset.x + bitangent * offset.y, sunDirection, options.range, hit);
+        }
+        sun = cosine * float(visible) / float(std::max(options.sunSamples, 1));
+    }
+
+    // cosine-weighted hemisphere; rays that hit something bring back its sunlit colour
+    int open = 0;
+    glm::vec3 bounce(0.0f);
+    for (int i = 0; i < options.skySamples; ++i) {
+        const glm::vec2 u = sample2D(i, options.skySamples);
+        const float r = std::sqrt(u.x);
+        const float phi = 2.0f * PI * u.y;
+        const glm::vec3 direction = tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(1.0f - u.x);
+        if (unoccluded(nodes, centre, direction, options.range, hit)) {
+            ++open;
+            continue;
+        }
+        const float hitCosine = glm::dot(hit.normal, sunDirection);
+        if (hitCosine <= 0.0f) {
+            continue;
+        }
+        const glm::vec3 hitPoint = centre + direction * hit.t + hit.normal * RAY_OFFSET;
+        const glm::vec3 albedo = glm::vec3(hit.color & COLOR_MASK) / 255.0f;
+        RayHit shadow;
+        if (unoccluded(nodes, hitPoint, sunDirection, options.range, shadow)) {
+            bounce += albedo * hitCosine;
+        }
+    }
+    const float samples = float(std::max(options.skySamples, 1));
+    return packFaceLight(sun, float(open) / samples, bounce / samples);
+}
+
+} // namespace
+
+uint32_t packFaceLight(float sun, float sky, glm::vec3 bounce) {
+    const auto quantize = [](float value, float scale) { return uint32_t(std::clamp(value, 0.0f, 1.0f) * scale + 0.5f); };
+    return quantize(sun, 255.0f) | quantize(sky, 255.0f) << 8 | quantize(bounce.r, 31.0f) << 16 | quantize(bounce.g, 63.0f) << 21 |
+           quantize(bounce.b, 31.0f) << 27;
+}
+
+glm::vec3 unpackFaceBounce(uint32_t packed) {
+    return glm::vec3(float((packed >> 16) & 31u) / 31.0f, float((packed >> 21) & 63u) / 63.0f, float(packed >> 27) / 31.0f);
+}
+
+size_t VoxelLighting::bake(const SVO& svo, std::span<const uint32_t> nodes, std::atomic<float>* progress, const std::atomic<bool>* cancel) {
+    std::vector<Vec3i32> leaves;
+    svo.forEachLeaf([&](uint32_t, Vec3i32 origin) { leaves.push_back(origin); });
+    m_leaves.clear();
+    m_dirty.clear();
+    relight(svo, nodes, leaves, progress, cancel);
+    return leaves.size();
+}
+
+void VoxelLighting::invalidate(Vec3i32 lo, Vec3i32 hi) {
+    m_dirty.emplace_back(lo, hi);
+}
+
+size_t VoxelLighting::update(const SVO& svo, std::span<const uint32_t> nodes) {
+    if (m_dirty.empty()) {
+        return 0;
+    }
+    PROFILE_SCOPE("Relight");
+    // everything whose rays could reach the edit, plus the faces the edit covered or
+    // exposed; bounce rays add a shadow ray of their own, so that's twice the range
+    const int reach = int(std::ceil(2.0f * m_options.range)) + 1;
+    std::unordered_set<uint64_t> seen;
+    std::vector<Vec3i32> leaves;
+    for (auto [lo, hi] : m_dirty) {
+        // leaves the edit emptied are gone from the tree; every other one in reach is found
+        // below and relit, which replaces its entry. Whichever of the box and the table is
+        // smaller is walked, so a large edit over a sparse world stays cheap.
+        const Vec3i32 first = leafOrigin(lo);
+        const glm::ivec3 cells = glm::max((hi - first) / 2 + 1, glm::ivec3(0));
+        if (size_t(cells.x) * size_t(cells.y) * size_t(cells.z) > m_leaves.size()) {
+            std::erase_if(m_leaves, [&](const auto& entry) {
+                const Vec3i32 origin = keyOrigin(entry.first);
+                return glm::all(glm::lessThanEqual(first, origin)) && glm::all(glm::lessThanEqual(origin, hi));
+            });
+        } else {
+            for (int x = first.x; x <= hi.x; x += 2) {
+                for (int y = first.y; y <= hi.y; y += 2) {
+                    for (int z = first.z; z <= hi.z; z += 2) {
+                        m_leaves.erase(leafKey(Vec3i32(x, y, z)));
+                    }
+                }
+            }
+        }
+        lo -= reach;
+        hi += reach;
+        svo.forEach(lo, hi, [&](Vec3i32 pos, const rgb32_t&) {
+            const Vec3i32 origin = leafOrigin(pos);
+            if (seen.insert(leafKey(origin)).second) {
+                leaves.push_back(origin);
+            }
+        });
+    }
+    m_dirty.clear();
+    relight(svo, nodes, leaves);
+    return leaves.size();
+}
+
+void VoxelLighting::relight(const SVO& svo, std::span<const uint32_t> nodes, std::span<const Vec3i32> leaves, std::atomic<float>* progress,
+                            const std::atomic<bool>* cancel) {
+    std::vector<std::array<uint32_t, LIGHT_WORDS_PER_LEAF>> lit(leaves.size());
+    std::atomic<size_t> done{ 0 };
+    parallelFor(leaves.size(), [&](size_t index, unsigned) {
+        auto& words = lit[index];
+        words.fill(0);
+        if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) {
+            return;
+        }
+        for (uint32_t i = 0; i < 8; ++i) {
+            const Vec3i32 pos = leaves[index] + Vec3i32((i >> 2) & 1, (i >> 1) & 1, i & 1);
+            if (svo.get(pos) == rgb32_t(0)) {
+                continue;
+            }
+            // only faces next to an empty voxel can be seen
+            const std::array<const rgb32_t*, 6> neighbors = svo.neighbors6(pos);
+            for (int face = 0; face < FACE_COUNT; ++face) {
+                if (neighbors[face] == nullptr || *neighbors[face] == rgb32_t(0)) {
+                    words[i * FACE_COUNT + face] = lightFace(nodes, m_options, pos, face);
+                }
+            }
+        }
+        if (progress != nullptr) {
+            progress->store(float(++done) / float(leaves.size()), std::memory_order_relaxed);
+        }
+    }, m_options.threads);
+    if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) {
+        return;
+    }
+    for (size_t i = 0; i < leaves.size(); ++i) {
+        m_leaves[leafKey(leaves[i])] = lit[i];
+    }
+}
+
+void VoxelLighting::flatten(const SVO& svo, std::vector<uint32_t>& buffer) const {
+    buffer.clear();
+    svo.forEachLeaf([&](uint32_t ordinal, Vec3i32 origin) {
+        buffer.resize(size_t(ordinal + 1) * LIGHT_WORDS_PER_LEAF, 0);
+        if (auto it = m_leaves.find(leafKey(origin)); it != m_leaves.end()) {
+            std::copy(it->second.begin(), it->second.end(), buffer.begin() + ptrdiff_t(ordinal) * LIGHT_WORDS_PER_LEAF);
+        }
+    });
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "voxel.h"
+
+struct LightingOptions {
+    glm::vec3 sunDirection = glm::normalize(glm::vec3(0.4f, 0.8f, 0.3f)); // towards the sun
+    int sunSamples = 4;  // shadow rays per face, spread over it
+    int skySamples = 16; // cosine-weighted hemisphere rays per face
+    // Occluders further than this are ignored, which bounds how far an edit can change
+    // lighting: it relights voxels up to twice this away (a bounce and its shadow ray)
+    float range = 32.0f;
+    unsigned threads = 0; // 0 picks the hardware concurrency
+};
+
+// Packed light of one voxel face: direct sun (visibility times cosine) in bits 0-7, sky
+// visibility in bits 8-15 and bounced light as RGB565 in bits 16-31.
+uint32_t packFaceLight(float sun, float sky, glm::vec3 bounce);
+glm::vec3 unpackFaceBounce(uint32_t packed);
+
+// Face order used everywhere for per-face data: -x, +x, -y, +y, -z, +z, as neighbors6.
+constexpr int FACE_COUNT = 6;
+constexpr int LIGHT_WORDS_PER_LEAF = 8 * FACE_COUNT;
+
+// Baked per-face lighting for every exposed voxel, computed by casting rays through the
+// flattened tree on the CPU. Kept per leaf so that edits only relight around themselves:
+// invalidate() (usually from an SVO edit listener) queues a region and update() relights
+// the voxels within `range` of it.
+class VoxelLighting {
+public:
+    explicit VoxelLighting(LightingOptions options = {}) : m_options(options) {}
+
+    const LightingOptions& options() const { return m_options; }
+
+    // Lights every voxel of `svo`; `nodes` is its SVO::flatten output. Returns the number
+    // of leaves lit. `progress`, when given, goes from 0 to 1 as leaves complete. Once
+    // `cancel` is set the remaining leaves are skipped and nothing is stored.
+    size_t bake(const SVO& svo, std::span<const uint32_t> nodes, std::atomic<float>* progress = nullptr,
+                const std::atomic<bool>* cancel = nullptr);
+    // Queues [lo, hi] as edited.
+    void invalidate(Vec3i32 lo, Vec3i32 hi);
+    bool dirty() const { return !m_dirty.empty(); }
+    // Relights the voxels near the regions queued since the last bake or update, against
+    // the tree as it is now. Returns the number of leaves relit.
+    size_t update(const SVO& svo, std::span<const uint32_t> nodes);
+
+    // Per-node table for the GPU, indexed by the ordinal in each node's header:
+    // LIGHT_WORDS_PER_LEAF words per node, voxel * FACE_COUNT + face within it. Branch
+    // entries are left zero so the lookup needs no remapping.
+    void flatten(const SVO& svo, std::vector<uint32_t>& buffer) const;
+
+private:
+    LightingOptions m_options;
+    std::unordered_map<uint64_t, std::array<uint32_t, LIGHT_WORDS_PER_LEAF>> m_leaves; // by leaf origin
+    std::vector<std::pair<Vec3i32, Vec3i32>> m_dirty;
+
+    void relight(const SVO& svo, std::span<const uint32_t> nodes, std::span<const Vec3i32> leaves, std::atomic<float>* progress = nullptr,
+                 const std::atomic<bool>* cancel = nullptr);
+};
@@ -0,0 +1,105 @@
+#include "occlusion.h"
+#include "../util/parallel.h"
+#include "../util/profiler.h"
+
+#include <array>
+#include <bit>
+#include <vector>
+
+namespace {
+
+// Bit masks over the 3x3x3 neighbourhood, bit (dx + 1) * 9 + (dy + 1) * 3 + (dz + 1),
+// of the cells in front of each face: the four sharing an edge with the face's neighbour
+// and the four sharing only a corner.
+struct FaceMasks {
+    std::array<uint32_t, 6> edges{};
+    std::array<uint32_t, 6> corners{};
+};
+
+constexpr FaceMasks faceMasks = [] {
+    FaceMasks masks;
+    for (int face = 0; face < 6; ++face) {
+        const int axis = face / 2;
+        const int side = face & 1 ? 1 : -1;
+        for (int cell = 0; cell < 27; ++cell) {
+            const int offset[3] = { cell / 9 - 1, cell / 3 % 3 - 1, cell % 3 - 1 };
+            if (offset[axis] != side) {
+                continue;
+            }
+            const int inPlane = (offset[0] != 0) + (offset[1] != 0) + (offset[2] != 0) - 1;
+            if (inPlane == 1) {
+                masks.edges[face] |= 1u << cell;
+            } else if (inPlane == 2) {
+                masks.corners[face] |= 1u << cell;
+            }
+        }
+    }
+    return masks;
+}();
+
+// which word and bit of the voxel hold a face's AO
+constexpr int occlusionWord(int face) {
+    return face < 3 ? 0 : 1;
+}
+constexpr int occlusionShift(int face) {
+    return 8 + 8 * (face % 3);
+}
+
+// AO of all six faces of the voxel whose neighbourhood occupancy is `occupied`. The masks
+// make this a handful of ANDs and popcounts per face rather than 48 lookups.
+std::array<uint32_t, 6> occlusionFromMask(uint32_t occupied) {
+    std::array<uint32_t, 6> occlusion;
+    for (int face = 0; face < 6; ++face) {
+        const int blocked = 2 * std::popcount(occupied & faceMasks.edges[face]) + std::popcount(occupied & faceMasks.corners[face]);
+        occlusion[face] = uint32_t((12 - blocked) * 255 / 12);
+    }
+    return occlusion;
+}
+
+} // namespace
+
+uint32_t faceOcclusion(const rgb32_t& voxel, int face) {
+    return (voxel[occlusionWord(face)] >> occlusionShift(face)) & 0xFF;
+}
+
+void setFaceOcclusion(rgb32_t& voxel, int face, uint32_t occlusion) {
+    uint32_t& word = voxel[occlusionWord(face)];
+    word = (word & ~(0xFFu << occlusionShift(face))) | (occlusion & 0xFF) << occlusionShift(face);
+}
+
+size_t bakeOcclusion(SVO& svo, Vec3i32 lo, Vec3i32 hi, unsigned threads, const std::atomic<bool>* cancel) {
+    PROFILE_SCOPE("Bake occlusion");
+    std::vector<Vec3i32> positions;
+    svo.forEach(lo, hi, [&](Vec3i32 pos, const rgb32_t&) { positions.push_back(pos); });
+
+    // computed for every voxel before any is written, so workers only ever read the tree
+    std::vector<std::array<uint32_t, 6>> occlusion(positions.size());
+    const auto cancelled = [cancel] { return cancel != nullptr && cancel->load(std::memory_order_relaxed); };
+    parallelFor(positions.size(), [&](size_t i, unsigned) {
+        if (cancelled()) {
+            return;
+        }
+        const std::array<const rgb32_t*, 26> neighbors = svo.neighbors26(positions[i]);
+        uint32_t occupied = 0;
+        for (int n = 0; n < 26; ++n) {
+            // neighbors26 skips the centre, bit 13
+            const int cell = n < 13 ? n : n + 1;
+            occupied |= uint32_t(neighbors[n] != nullptr && *neighbors[n] != rgb32_t(0)) << cell;
+        }
+        occlusion[i] = occlusionFromMask(occupied);
+    }, threads);
+    if (cancelled()) {
+        return 0;
+    }
+
+    svo.updateBatch(positions, [&](size_t i, rgb32_t& voxel) {
+        for (int face = 0; face < 6; ++face) {
+            setFaceOcclusion(voxel, face, occlusion[i][face]);
+        }
+    });
+    return positions.size();
+}
+
+size_t bakeOcclusion(SVO& svo, unsigned threads, const std::atomic<bool>* cancel) {
+    return bakeOcclusion(svo, svo.minIncl(), svo.maxIncl(), threads, cancel);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "voxel.h"
+
+// Per-face ambient occlusion baked into the colour voxels themselves. Colour channels only
+// use their low byte, so the AO bytes of faces -x, +x, -y (neighbors6 order) live in bits
+// 8-31 of r and those of +y, -z, +z in bits 8-31 of g. 255 is fully open. Anything reading
+// colours must mask them with COLOR_MASK.
+constexpr uint32_t COLOR_MASK = 0xFF;
+
+// AO byte of `face` of a voxel
+uint32_t faceOcclusion(const rgb32_t& voxel, int face);
+void setFaceOcclusion(rgb32_t& voxel, int face, uint32_t occlusion);
+
+// Recomputes the AO of every voxel in [lo, hi] from its 26 neighbours: each face looks at
+// the 3x3 cells in front of it, edges counting twice as much as corners. A voxel's AO only
+// depends on voxels one step away, so after an edit of [lo, hi] it's enough to rebake
+// [lo - 1, hi + 1]. Writes go through SVO::updateBatch and so don't notify edit
+// listeners. Returns the number of voxels baked; once `cancel` is set the bake stops and
+// leaves the tree unchanged.
+size_t bakeOcclusion(SVO& svo, Vec3i32 lo, Vec3i32 hi, unsigned threads = 0, const std::atomic<bool>* cancel = nullptr);
+size_t bakeOcclusion(SVO& svo, unsigned threads = 0, const std::atomic<bool>* cancel = nullptr);
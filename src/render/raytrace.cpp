@@ -0,0 +1,433 @@
+#include "raytrace.h"
+#include "lighting.h"
+#include "occlusion.h"
+#include "texture.h"
+#include "voxel.h"
+#include "../util/parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+constexpr float INF = std::numeric_limits<float>::infinity();
+constexpr float EPSILON = 1e-9f;
+// baked lighting intensities, as in octree.glsl
+const glm::vec3 SUN_LIGHT(0.65f);
+const glm::vec3 SKY_LIGHT(0.28f, 0.33f, 0.42f);
+constexpr float OCCLUSION_FLOOR = 0.35f;
+
+// Octant of the node centred where the ray crosses the mid planes at tMid, at time t
+uint32_t firstChild(glm::vec3 tMid, float t, glm::vec3 direction) {
+    uint32_t child = 0;
+    for (int a = 0; a < 3; ++a) {
+        const bool upper = (tMid[a] <= t) == (direction[a] >= 0.0f);
+        child |= uint32_t(upper) << (2 - a);
+    }
+    return child;
+}
+
+glm::vec3 octantOffset(uint32_t child) {
+    return glm::vec3(float((child >> 2) & 1u), float((child >> 1) & 1u), float(child & 1u));
+}
+
+uint32_t cellOctant(glm::ivec3 cell) {
+    return uint32_t(cell.x & 1) << 2 | uint32_t(cell.y & 1) << 1 | uint32_t(cell.z & 1);
+}
+
+// Steps voxel by voxel through the brick node at `brickNode`, whose corner is `origin`,
+// from t to tExit, reading occupancy from the atlas texels. On a hit the voxel's leaf is
+// found through the node's own children, so the hit is the one descending would give.
+bool traceBrick(std::span<const uint32_t> nodes, std::span<const uint8_t> bricks, glm::vec3 origin, glm::vec3 direction,
+                glm::vec3 invDir, uint32_t brickNode, glm::vec3 brickOrigin, float t, float tExit, RayHit& hit) {
+    const uint32_t brick = nodes[brickNode] & INDEX_MASK;
+    const uint8_t* texels = bricks.data() + size_t(brick) * BRICK_VOXELS;
+    // the voxel the ray is in at t, picked the way firstChild picks octants
+    glm::ivec3 cell(0);
+    for (int size = BRICK_SIZE / 2; size >= 1; size /= 2) {
+        for (int a = 0; a < 3; ++a) {
+            const float tMid = (brickOrigin[a] + float(cell[a] + size) - origin[a]) * invDir[a];
+            cell[a] += (tMid <= t) == (direction[a] >= 0.0f) ? size : 0;
+        }
+    }
+    glm::vec3 far;
+    glm::ivec3 step;
+    for (int a = 0; a < 3; ++a) {
+        far[a] = direction[a] >= 0.0f ? 1.0f : 0.0f;
+        step[a] = direction[a] >= 0.0f ? 1 : -1;
+    }
+    while (hit.steps < TRACE_MAX_STEPS) {
+        ++hit.steps;
+        const glm::vec3 cellOrigin = brickOrigin + glm::vec3(cell);
+        const glm::vec3 tNext = (cellOrigin + far - origin) * invDir;
+        const float cellExit = std::min(tNext.x, std::min(tNext.y, tNext.z));
+        if (texels[size_t((cell.z * BRICK_SIZE + cell.y) * BRICK_SIZE + cell.x)] != 0) {
+            const uint32_t middle = nodes[brickNode + 1 + cellOctant(cell >> 2)];
+            const uint32_t leaf = middle != 0 ? nodes[middle + 1 + cellOctant(cell >> 1)] : 0;
+            const uint32_t base = leaf + 1 + 4 * cellOctant(cell);
+            if (leaf != 0) {
+                hit.hit = true;
+                hit.t = t;
+                hit.color = glm::uvec4(nodes[base], nodes[base + 1], nodes[base + 2], nodes[base + 3]);
+                hit.leaf = leaf;
+                hit.voxel = cellOctant(cell);
+                glm::vec3 entry;
+                for (int a = 0; a < 3; ++a) {
+                    entry[a] = (cellOrigin[a] + (direction[a] < 0.0f ? 1.0f : 0.0f) - origin[a]) * invDir[a];
+                }
+                const int axis = entry.x >= entry.y && entry.x >= entry.z ? 0 : entry.y >= entry.z ? 1 : 2;
+                hit.normal[axis] = direction[axis] < 0.0f ? 1.0f : -1.0f;
+                return true;
+            }
+        }
+        if (cellExit >= tExit) {
+            return false;
+        }
+        const int axis = cellExit == tNext.x ? 0 : cellExit == tNext.y ? 1 : 2;
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= BRICK_SIZE) {
+            return false; // rounding put the exit just past tExit
+        }
+        t = cellExit;
+    }
+    return false;
+}
+
+} // namespace
+
+RayHit traceFlattened(std::span<const uint32_t> nodes, size_t depth, glm::vec3 origin, glm::vec3 direction, float tStart,
+                      std::span<const uint8_t> bricks) {
+    RayHit hit;
+    if (nodes.empty()) {
+        return hit;
+    }
+    for (int a = 0; a < 3; ++a) {
+        if (std::abs(direction[a]) < EPSILON) {
+            direction[a] = EPSILON;
+        }
+    }
+    const glm::vec3 invDir = 1.0f / direction;
+
+    // the root spans [-2^depth, 2^depth)
+    const float rootHalf = float(1u << depth);
+    const glm::vec3 lo = (glm::vec3(-rootHalf) - origin) * invDir;
+    const glm::vec3 hi = (glm::vec3(rootHalf) - origin) * invDir;
+    const glm::vec3 tNear = glm::min(lo, hi);
+    const glm::vec3 tFar = glm::max(lo, hi);
+    float t = std::max(std::max(tNear.x, std::max(tNear.y, tNear.z)), tStart);
+    float tExit = std::min(tFar.x, std::min(tFar.y, tFar.z));
+    if (t >= tExit) {
+        return hit;
+    }
+
+    // resume state of each branch on the path, indexed by level
+    struct Frame {
+        uint32_t node;
+        float t;
+        float tExit;
+        uint32_t child;
+    };
+    std::array<Frame, 21> stack;
+
+    size_t level = depth;
+    uint32_t node = 0;
+    glm::vec3 nodeOrigin(-rootHalf);
+    uint32_t child = firstChild((nodeOrigin + rootHalf - origin) * invDir, t, direction);
+
+    while (hit.steps < TRACE_MAX_STEPS) {
+        ++hit.steps;
+        const float childSize = float(1u << level);
+        const glm::vec3 tMid = (nodeOrigin + childSize - origin) * invDir;
+        glm::vec3 tNext;
+        for (int a = 0; a < 3; ++a) {
+            tNext[a] = tMid[a] > t ? tMid[a] : INF;
+        }
+        const float childExit = std::min(tExit, std::min(tNext.x, std::min(tNext.y, tNext.z)));
+        const glm::vec3 childOrigin = nodeOrigin + octantOffset(child) * childSize;
+        const uint32_t crossed = uint32_t(tNext.x == childExit) << 2 | uint32_t(tNext.y == childExit) << 1 | uint32_t(tNext.z == childExit);
+
+        if (level == 0) {
+            const uint32_t base = node + 1 + 4 * child;
+            const glm::uvec4 voxel(nodes[base], nodes[base + 1], nodes[base + 2], nodes[base + 3]);
+            if (voxel != glm::uvec4(0)) {
+                hit.hit = true;
+                hit.t = t;
+                hit.color = voxel;
+                hit.leaf = node;
+                hit.voxel = child;
+                // the face entered through is the one whose slab is crossed last
+                glm::vec3 entry;
+                for (int a = 0; a < 3; ++a) {
+                    entry[a] = (childOrigin[a] + (direction[a] < 0.0f ? 1.0f : 0.0f) - origin[a]) * invDir[a];
+                }
+                const int axis = entry.x >= entry.y && entry.x >= entry.z ? 0 : entry.y >= entry.z ? 1 : 2;
+                hit.normal[axis] = direction[axis] < 0.0f ? 1.0f : -1.0f;
+                return hit;
+            }
+        } else if (const uint32_t pointer = nodes[node + 1 + child]; pointer != 0) {
+            if (level == BRICK_LEVEL + 1 && !bricks.empty() && (nodes[pointer] & NODE_TYPE_MASK) == BRICK_NODE) {
+                // dense subtree: step through its voxels in the atlas instead
+                if (traceBrick(nodes, bricks, origin, direction, invDir, pointer, childOrigin, t, childExit, hit)) {
+                    return hit;
+                }
+            } else {
+                // remember where to carry on in this node, then descend
+                stack[level] = { node, childExit, tExit, child ^ crossed };
+                node = pointer;
+                nodeOrigin = childOrigin;
+                tExit = childExit;
+                --level;
+                child = firstChild((nodeOrigin + float(1u << level) - origin) * invDir, t, direction);
+                continue;
+            }
+        }
+
+        if (childExit < tExit) {
+            child ^= crossed;
+            t = childExit;
+            continue;
+        }
+        // left this node, pop to the nearest ancestor with children still ahead
+        do {
+            if (++level > depth) {
+                return hit;
+            }
+            // nodes are aligned to their size, so the parent's corner follows from the child's
+            const float nodeSize = float(2u << level);
+            nodeOrigin = glm::floor((nodeOrigin + rootHalf) / nodeSize) * nodeSize - rootHalf;
+            const Frame& frame = stack[level];
+            node = frame.node;
+            t = frame.t;
+            tExit = frame.tExit;
+            child = frame.child;
+        } while (t >= tExit);
+    }
+    return hit;
+}
+
+float beamDistance(std::span<const uint32_t> nodes, size_t depth, glm::vec3 apex, glm::vec3 axis, float tanHalfAngle, uint32_t& steps) {
+    if (nodes.empty()) {
+        return INF;
+    }
+    for (int a = 0; a < 3; ++a) {
+        if (std::abs(axis[a]) < EPSILON) {
+            axis[a] = EPSILON;
+        }
+    }
+    const glm::vec3 invDir = 1.0f / axis;
+
+    // entry along the axis into the box grown by the cone radius at its far side, or INF
+    const auto enter = [&](glm::vec3 lo, float size) {
+        const glm::vec3 hi = lo + size;
+        const float r = tanHalfAngle * glm::length(glm::max(glm::abs(lo - apex), glm::abs(hi - apex)));
+        const glm::vec3 a = (lo - r - apex) * invDir;
+        const glm::vec3 b = (hi + r - apex) * invDir;
+        const glm::vec3 tNear = glm::min(a, b);
+        const glm::vec3 tFar = glm::max(a, b);
+        const float t0 = std::max(std::max(tNear.x, std::max(tNear.y, tNear.z)), 0.0f);
+        const float t1 = std::min(tFar.x, std::min(tFar.y, tFar.z));
+        return t0 < t1 ? t0 : INF;
+    };
+
+    // nodes still to visit, nearest on top; a node that doesn't fit counts as a hit at
+    // its entry, which keeps the bound conservative
+    struct Entry {
+        uint32_t node;
+        uint32_t level;
+        glm::vec3 origin;
+        float t;
+    };
+    std::array<Entry, BEAM_STACK> stack;
+    uint32_t size = 0;
+    float best = INF;
+
+    const float rootHalf = float(1u << depth);
+    const float rootT = enter(glm::vec3(-rootHalf), 2.0f * rootHalf);
+    if (rootT < best) {
+        stack[size++] = { 0, uint32_t(depth), glm::vec3(-rootHalf), rootT };
+    }
+    while (size > 0) {
+        const Entry entry = stack[--size];
+        if (entry.t >= best) {
+            continue;
+        }
+        ++steps;
+        const float childSize = float(1u << entry.level);
+        // the beam is wider than the node here, descending can't tighten the bound
+        if (entry.level > 0 && childSize <= tanHalfAngle * entry.t) {
+            best = entry.t;
+            continue;
+        }
+        std::array<float, 8> childT;
+        for (uint32_t i = 0; i < 8; ++i) {
+            childT[i] = INF;
+            const uint32_t word = entry.level == 0 ? entry.node + 1 + 4 * i : entry.node + 1 + i;
+            const bool present = entry.level == 0 ? (nodes[word] | nodes[word + 1] | nodes[word + 2] | nodes[word + 3]) != 0 : nodes[word] != 0;
+            if (!present) {
+                continue;
+            }
+            const float t = enter(entry.origin + octantOffset(i) * childSize, childSize);
+            if (entry.level == 0) {
+                best = std::min(best, t); // voxels are solid
+            } else if (t < best) {
+                childT[i] = t;
+            }
+        }
+        if (entry.level == 0) {
+            continue;
+        }
+        // push the farthest first so the nearest child is visited next
+        for (;;) {
+            uint32_t farthest = 8;
+            for (uint32_t i = 0; i < 8; ++i) {
+                if (childT[i] < INF && (farthest == 8 || childT[i] > childT[farthest])) {
+                    farthest = i;
+                }
+            }
+            if (farthest == 8) {
+                break;
+            }
+            if (size == BEAM_STACK) {
+                best = std::min(best, childT[farthest]);
+            } else {
+                stack[size++] = { nodes[entry.node + 1 + farthest], entry.level - 1, entry.origin + octantOffset(farthest) * childSize, childT[farthest] };
+            }
+            childT[farthest] = INF;
+        }
+    }
+    return best;
+}
+
+void beamCone(const FrameData& frame, glm::vec2 lo, glm::vec2 hi, glm::vec3& axis, float& tanHalfAngle) {
+    const glm::vec3 apex(frame.cameraPosition);
+    std::array<glm::vec3, 4> corners;
+    glm::vec3 sum(0.0f);
+    for (int i = 0; i < 4; ++i) {
+        const glm::vec2 pixel(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y);
+        const glm::vec4 far4 = frame.inverseViewProjection * glm::vec4(pixel / frame.resolution * 2.0f - 1.0f, 1.0f, 1.0f);
+        corners[i] = glm::normalize(glm::vec3(far4) / far4.w - apex);
+        sum += corners[i];
+    }
+    axis = glm::normalize(sum);
+    float cosine = 1.0f;
+    for (const glm::vec3& corner : corners) {
+        cosine = std::min(cosine, glm::dot(axis, corner));
+    }
+    tanHalfAngle = std::sqrt(std::max(1.0f - cosine * cosine, 0.0f)) / cosine * 1.01f + 1e-6f;
+}
+
+float beamStart(float distance, glm::vec3 apex, glm::vec3 origin) {
+    return std::max(distance * 0.999f - glm::length(origin - apex), 0.0f);
+}
+
+glm::vec3 shadeHit(std::span<const uint32_t> nodes, const RayHit& hit, glm::vec3 direction, int debugView, int shading, std::span<const uint32_t> lighting) {
+    if (debugView == DEBUG_VIEW_STEPS) {
+        const float h = std::min(float(hit.steps) / float(TRACE_MAX_STEPS), 1.0f);
+        return glm::vec3(h, 4.0f * h * (1.0f - h), 1.0f - h);
+    }
+    if (!hit.hit) {
+        const float up = glm::clamp(glm::normalize(direction).y, 0.0f, 1.0f);
+        return glm::mix(glm::vec3(0.70f, 0.80f, 0.92f), glm::vec3(0.32f, 0.50f, 0.80f), up);
+    }
+    if (debugView == DEBUG_VIEW_NORMALS) {
+        return hit.normal * 0.5f + 0.5f;
+    }
+    const glm::vec3 albedo = glm::vec3(hit.color & COLOR_MASK) / 255.0f;
+    const int axis = hit.normal.x != 0.0f ? 0 : hit.normal.y != 0.0f ? 1 : 2;
+    const int face = axis * 2 + (hit.normal[axis] > 0.0f ? 1 : 0);
+    float occlusion = 1.0f;
+    if (shading & FRAME_OCCLUSION) {
+        occlusion = OCCLUSION_FLOOR + (1.0f - OCCLUSION_FLOOR) * float(faceOcclusion(hit.color, face)) / 255.0f;
+    }
+
+    const uint32_t ordinal = nodes[hit.leaf] & INDEX_MASK;
+    if ((shading & FRAME_LIGHTING) && size_t(ordinal + 1) * LIGHT_WORDS_PER_LEAF <= lighting.size()) {
+        const uint32_t packed = lighting[ordinal * LIGHT_WORDS_PER_LEAF + hit.voxel * FACE_COUNT + uint32_t(face)];
+        const float sun = float(packed & 255u) / 255.0f;
+        const float sky = float((packed >> 8) & 255u) / 255.0f;
+        const glm::vec3 light = SUN_LIGHT * sun + SKY_LIGHT * sky + SUN_LIGHT * unpackFaceBounce(packed);
+        return albedo * light * occlusion;
+    }
+    const glm::vec3 sun = glm::normalize(glm::vec3(0.4f, 0.8f, 0.3f));
+    const float light = 0.35f + 0.65f * std::max(glm::dot(hit.normal, sun), 0.0f);
+    return albedo * light * occlusion;
+}
+
+ReferenceStats renderReference(std::span<const uint32_t> nodes, size_t depth, const FrameData& frame, std::vector<uint8_t>& image,
+                               std::span<const uint32_t> lighting, std::span<const uint8_t> bricks) {
+    const int width = int(frame.resolution.x);
+    const int height = int(frame.resolution.y);
+    const int tilesX = (width + BEAM_TILE - 1) / BEAM_TILE;
+    const int tilesY = (height + BEAM_TILE - 1) / BEAM_TILE;
+    const bool beam = (frame.flags & FRAME_BEAM) != 0;
+    const glm::vec3 apex(frame.cameraPosition);
+    image.assign(size_t(width) * size_t(height) * 4, 0);
+
+    ReferenceStats stats;
+    stats.pixels = size_t(width) * size_t(height);
+    std::vector<uint64_t> steps(workerCount(), 0);
+    std::vector<uint64_t> beamSteps(workerCount(), 0);
+
+    std::vector<float> beamDistances(size_t(tilesX) * size_t(tilesY), 0.0f);
+    if (beam) {
+        stats.tiles = beamDistances.size();
+        parallelFor(beamDistances.size(), [&](size_t tile, unsigned worker) {
+            const glm::vec2 lo(float(int(tile) % tilesX * BEAM_TILE), float(int(tile) / tilesX * BEAM_TILE));
+            const glm::vec2 hi = glm::min(lo + float(BEAM_TILE), frame.resolution);
+            glm::vec3 axis;
+            float tanHalfAngle;
+            beamCone(frame, lo, hi, axis, tanHalfAngle);
+            uint32_t visited = 0;
+            beamDistances[tile] = beamDistance(nodes, depth, apex, axis, tanHalfAngle, visited);
+            beamSteps[worker] += visited;
+        });
+    }
+
+    parallelFor(size_t(height), [&](size_t y, unsigned worker) {
+        for (int x = 0; x < width; ++x) {
+            // same rays as the vertex shader interpolates: unproject the near and far planes
+            const glm::vec2 ndc((float(x) + 0.5f) / float(width) * 2.0f - 1.0f, (float(y) + 0.5f) / float(height) * 2.0f - 1.0f);
+            const glm::vec4 near4 = frame.inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+            const glm::vec4 far4 = frame.inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+            const glm::vec3 origin = glm::vec3(near4) / near4.w;
+            const glm::vec3 direction = glm::normalize(glm::vec3(far4) / far4.w - origin);
+
+            float tStart = 0.0f;
+            if (beam) {
+                tStart = beamStart(beamDistances[size_t(int(y) / BEAM_TILE * tilesX + x / BEAM_TILE)], apex, origin);
+            }
+            const RayHit hit = traceFlattened(nodes, depth, origin, direction, tStart, frame.flags & FRAME_BRICKS ? bricks : std::span<const uint8_t>());
+            steps[worker] += hit.steps;
+            const glm::vec3 color = glm::clamp(shadeHit(nodes, hit, direction, frame.debugView, frame.flags, lighting), 0.0f, 1.0f);
+            uint8_t* pixel = &image[(y * size_t(width) + size_t(x)) * 4];
+            for (int c = 0; c < 3; ++c) {
+                pixel[c] = uint8_t(color[c] * 255.0f + 0.5f);
+            }
+            pixel[3] = 255;
+        }
+    });
+    for (size_t i = 0; i < steps.size(); ++i) {
+        stats.steps += steps[i];
+        stats.beamSteps += beamSteps[i];
+    }
+    return stats;
+}
+
+bool writeImage(const std::string& filepath, int width, int height, std::span<const uint8_t> rgba) {
+    std::ofstream out(filepath, std::ios::binary);
+    if (!out) {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        return false;
+    }
+    out << "P6\n" << width << " " << height << "\n255\n";
+    for (int y = height; y-- > 0;) {
+        for (int x = 0; x < width; ++x) {
+            out.write(reinterpret_cast<const char*>(&rgba[(size_t(y) * size_t(width) + size_t(x)) * 4]), 3);
+        }
+    }
+    return bool(out);
+}
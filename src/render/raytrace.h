@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "framedata.h"
+
+// CPU reference for the octree traversal in res/shaders/octree.glsl. The two are kept
+// step for step identical, so images from the GPU (e.g. under Mesa's llvmpipe) can be
+// diffed against renderReference() and step counts compared exactly.
+
+// Traversal gives up after this many steps; injected into the shader as MAX_STEPS
+constexpr uint32_t TRACE_MAX_STEPS = 512;
+// Pixels per side of a beam prepass tile; injected as BEAM_TILE
+constexpr int BEAM_TILE = 8;
+// Nodes the beam traversal can have queued; injected as BEAM_STACK
+constexpr uint32_t BEAM_STACK = 64;
+
+struct RayHit {
+    bool hit = false;
+    float t = 0.0f;           // along the unnormalised direction passed in
+    glm::uvec4 color = glm::uvec4(0);
+    glm::vec3 normal = glm::vec3(0.0f);
+    uint32_t steps = 0;
+    uint32_t leaf = 0;  // buffer offset of the hit voxel's leaf
+    uint32_t voxel = 0; // octant of the voxel in the leaf
+};
+
+// Casts a ray through a tree in the SVO::flatten layout whose root is at level `depth`,
+// starting `tStart` along it. Brick nodes are stepped through in `bricks`, the texels of a
+// BrickAtlas, when given and descended like any branch otherwise; the hit is the same.
+RayHit traceFlattened(std::span<const uint32_t> nodes, size_t depth, glm::vec3 origin, glm::vec3 direction, float tStart = 0.0f,
+                      std::span<const uint8_t> bricks = {});
+
+// Beam prepass: a lower bound on the distance from `apex` to anything in the tree inside
+// the cone around `axis` (unit length) with the given half angle tangent. Nodes are
+// inflated by the cone radius at their far side and tested against the axis, so the bound
+// holds for every ray in the cone. Infinity if the cone hits nothing. Adds the nodes
+// visited to `steps`.
+float beamDistance(std::span<const uint32_t> nodes, size_t depth, glm::vec3 apex, glm::vec3 axis, float tanHalfAngle, uint32_t& steps);
+
+// The cone from `apex` through the pixel rectangle [lo, hi) of `frame`: its axis and
+// half angle tangent, slightly widened to absorb rounding.
+void beamCone(const FrameData& frame, glm::vec2 lo, glm::vec2 hi, glm::vec3& axis, float& tanHalfAngle);
+
+// Where a pixel ray from `origin` (on the near plane) can start, given its tile's beam
+// distance from the camera.
+float beamStart(float distance, glm::vec3 apex, glm::vec3 origin);
+
+struct ReferenceStats {
+    size_t pixels = 0;
+    uint64_t steps = 0;     // primary ray steps
+    size_t tiles = 0;
+    uint64_t beamSteps = 0; // nodes visited by the beam prepass
+};
+
+// Final colour of a pixel in the given DebugView, as the shader computes it. `shading`
+// holds the FrameFlags that affect it: with FRAME_LIGHTING and a VoxelLighting::flatten
+// table in `lighting` hits are lit from it rather than by N.L, and FRAME_OCCLUSION applies
+// the AO baked into the voxels.
+glm::vec3 shadeHit(std::span<const uint32_t> nodes, const RayHit& hit, glm::vec3 direction, int debugView, int shading = 0,
+                   std::span<const uint32_t> lighting = {});
+
+// Renders `frame` into `image` as RGBA8, bottom row first like glReadPixels, running the
+// beam prepass first when frame.flags has FRAME_BEAM, stepping through `bricks` with
+// FRAME_BRICKS and shading with frame.flags as shadeHit() does.
+ReferenceStats renderReference(std::span<const uint32_t> nodes, size_t depth, const FrameData& frame, std::vector<uint8_t>& image,
+                               std::span<const uint32_t> lighting = {}, std::span<const uint8_t> bricks = {});
+
+// Writes an RGBA8 image, bottom row first, as a binary PPM.
+bool writeImage(const std::string& filepath, int width, int height, std::span<const uint8_t> rgba);
@@ -1,11 +1,22 @@
 #include "renderer.h"
 #include "voxel.h"
+#include "raytrace.h"
+#include "occlusion.h"
+#include "texture.h"
+#include "../world/terrain.h"
+#include "../util/profiler.h"
 #include <glm/fwd.hpp>
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <ostream>
-#include <random>
+#include <stdexcept>
+#include <string>
 #include "glfw/glfw.h"
 
+// frames the CPU can be ahead of the GPU before rewriting a streamed buffer waits
+constexpr uint32_t FRAMES_IN_FLIGHT = 3;
+
 // Example quad vertices for rendering
 float quadVertices[] = {
     // positions   // texCoords
@@ -19,22 +30,23 @@ float quadVertices[] = {
 };
 
 Renderer::Renderer() {
-    m_camera = std::make_unique<Camera>();
+    m_startTime = glfwGetTime();
+    m_gpuTimer.setAlwaysOn(m_dynamicResolution);
+    // above the middle of the generated terrain, looking down on it
+    m_camera = std::make_unique<Camera>(glm::vec3(0.0f, 48.0f, 160.0f), glm::vec3(0.0f, 1.0f, 0.0f), YAW, -20.0f);
     m_shader = std::make_unique<Shader>();
     SVO svo;
     initializeOctree();
 
     // Setup VAO and VBO for rendering the quad
-    unsigned int VBO;
+    m_quadVBO = Buffer(BufferTarget::Vertex, sizeof(quadVertices), quadVertices);
     glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
 
     // Bind VAO
     glBindVertexArray(VAO);
 
     // Bind VBO
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
+    m_quadVBO.bind();
 
     // Set vertex attribute pointers
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
@@ -45,85 +57,457 @@ Renderer::Renderer() {
     // Unbind VAO
     glBindVertexArray(0);
 
-    // Compile and link shader
+    // Compile and link shaders; this overlaps with the world build and finishes in render()
+    m_computeShader = std::make_unique<Shader>();
+    m_beamShader = std::make_unique<Shader>();
+    m_reprojectShader = std::make_unique<Shader>();
+    for (Shader *shader : { m_shader.get(), m_computeShader.get(), m_beamShader.get(), m_reprojectShader.get() }) {
+        shader->define("FRAME_DATA_BINDING", std::to_string(FRAME_DATA_BINDING));
+        shader->define("OCTREE_BINDING", std::to_string(OCTREE_BINDING));
+        shader->define("STATS_BINDING", std::to_string(STATS_BINDING));
+        shader->define("LIGHTING_BINDING", std::to_string(LIGHTING_BINDING));
+        shader->define("BEAM_IMAGE_UNIT", std::to_string(BEAM_IMAGE_UNIT));
+        shader->define("HISTORY_IMAGE_UNIT", std::to_string(HISTORY_IMAGE_UNIT));
+        shader->define("SEED_IMAGE_UNIT", std::to_string(SEED_IMAGE_UNIT));
+        shader->define("BRICK_TEXTURE_UNIT", std::to_string(BRICK_TEXTURE_UNIT));
+        shader->define("BRICK_LEVEL", std::to_string(BRICK_LEVEL));
+        shader->define("BRICK_SIZE", std::to_string(BRICK_SIZE));
+        shader->define("ATLAS_BRICKS", std::to_string(ATLAS_BRICKS));
+        shader->define("BEAM_TILE", std::to_string(BEAM_TILE));
+        shader->define("BEAM_STACK", std::to_string(BEAM_STACK));
+        shader->define("SVO_DEPTH", std::to_string(SVO::depth));
+        shader->define("MAX_STEPS", std::to_string(TRACE_MAX_STEPS) + "u");
+    }
     m_shader->compile(GL_VERTEX_SHADER, "../res/shaders/vertex.glsl");
     m_shader->compile(GL_FRAGMENT_SHADER, "../res/shaders/voxel.frag");
-    m_shader->link();
-    m_shader->bind();
+    m_shader->linkAsync();
+    m_computeShader->compile(GL_COMPUTE_SHADER, "../res/shaders/voxel.comp");
+    m_computeShader->linkAsync();
+    m_beamShader->compile(GL_COMPUTE_SHADER, "../res/shaders/beam.comp");
+    m_beamShader->linkAsync();
+    m_reprojectShader->compile(GL_COMPUTE_SHADER, "../res/shaders/reproject.comp");
+    m_reprojectShader->linkAsync();
+    m_shaderWatcher = std::make_unique<FileWatcher>("../res/shaders");
+
+    // Per-frame uniforms are written straight into a mapped ring and rebound every frame
+    m_frameUBO = Buffer(BufferTarget::Uniform, sizeof(FrameData), nullptr, Buffer::Usage::Stream, FRAMES_IN_FLIGHT);
 
-    // Set initial uniforms
-    m_shader->setCameraPosition(m_camera->position);
-    m_shader->setCameraMatrix(m_camera->getViewMatrix());
+    // TraceStats: total steps and pixels traced
+    const GLuint noStats[2] = { 0, 0 };
+    m_statsSSBO = Buffer(BufferTarget::ShaderStorage, sizeof(noStats), noStats, Buffer::Usage::Dynamic);
+    m_statsSSBO.bind(STATS_BINDING);
     std::cout << "Renderer initialized" << std::endl;
 }
 
 Renderer::~Renderer() {
+    if (m_relightThread.joinable()) {
+        m_relightThread.join();
+    }
     glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &ssbo);
+    glDeleteTextures(1, &m_beamTexture);
+    glDeleteTextures(1, &m_historyTexture);
+    glDeleteTextures(1, &m_seedTexture);
+    glDeleteFramebuffers(1, &m_outputFBO);
+    glDeleteTextures(1, &m_outputTexture);
 }
 
 
 void Renderer::initializeOctree() {
-    int cubeSize = 10;
-    int halfCubeSize = cubeSize / 2;
-
-    // Seed the random number generator
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 255);
-
-    // Calculate the center of the current octree
-    Vec3i32 center = (svo.maxIncl() + svo.minIncl()) / 2;
-
-    // Calculate the bounds of the cube
-    Vec3i32 minBound = center - Vec3i32(halfCubeSize);
-    Vec3i32 maxBound = center + Vec3i32(halfCubeSize - 1);
-
-    // Insert voxels in the calculated bounds with random pastel colors
-    for (int x = minBound.x; x <= maxBound.x; ++x) {
-        for (int y = minBound.y; y <= maxBound.y; ++y) {
-            for (int z = minBound.z; z <= maxBound.z; ++z) {
-                // Generate a random pastel color
-                uint8_t r = dis(gen) / 2 + 128;  // Pastel color (lighter shade)
-                uint8_t g = dis(gen) / 2 + 128;
-                uint8_t b = dis(gen) / 2 + 128;
-                rgb32_t color = glm::uvec4(r, g, b, 255);
-
-                svo.insert(Vec3i32(x, y, z), color);
-            }
+    // the world is built off-thread; frames draw with an empty buffer until it arrives
+    m_ssbo = Buffer(BufferTarget::ShaderStorage, 0, nullptr, Buffer::Usage::Dynamic);
+    m_lightSSBO = Buffer(BufferTarget::ShaderStorage, 0, nullptr, Buffer::Usage::Dynamic);
+    m_loader = std::make_unique<WorldLoader>(TerrainOptions{});
+}
+
+// Called at the start of every frame, so a swap never happens mid-frame.
+void Renderer::pollWorld() {
+    m_uploadBytes = 0;
+    if (m_relightThread.joinable()) {
+        if (!m_relit.load(std::memory_order_acquire)) {
+            return; // the loader mustn't replace the tree while it's being read
+        }
+        m_relightThread.join();
+        // the atlas slots changed with the tree, so they go up together
+        m_uploadBytes += m_bricks.upload();
+        updateSSBO(std::move(m_relitNodes), std::move(m_relitLighting));
+        if (!m_pendingEdits.empty()) {
+            startRelight();
+            return;
+        }
+    }
+
+    std::vector<uint32_t> nodes;
+    std::vector<uint32_t> lighting;
+    if (m_loader && m_loader->take(svo, nodes, m_lighting, lighting, m_bricks)) {
+        // the loaded tree replaced ours, listener included
+        svo.addEditListener([this](Vec3i32 lo, Vec3i32 hi) {
+            m_editDirty.emplace_back(lo, hi);
+            m_lighting.invalidate(lo, hi);
+        });
+        m_uploadBytes += m_bricks.upload();
+        updateSSBO(std::move(nodes), std::move(lighting));
+        m_worldLoaded = true;
+    }
+}
+
+void Renderer::editWorld(const std::function<void(SVO&)>& edit) {
+    m_pendingEdits.push_back(edit);
+    if (!m_relightThread.joinable()) {
+        startRelight();
+    }
+}
+
+// Applies the queued edits, then hands the relight to a worker thread; pollWorld swaps
+// the result in.
+void Renderer::startRelight() {
+    PROFILE_SCOPE("Edit world");
+    for (const auto& edit : m_pendingEdits) {
+        edit(svo);
+    }
+    m_pendingEdits.clear();
+    // AO only reaches one voxel; the rebake doesn't notify listeners, so it isn't an edit
+    for (auto [lo, hi] : m_editDirty) {
+        bakeOcclusion(svo, lo - 1, hi + 1);
+        m_bricks.update(svo, lo, hi);
+    }
+    m_editDirty.clear();
+    m_relitNodes.clear();
+    svo.flatten(m_relitNodes);
+    m_bricks.annotate(m_relitNodes);
+    m_relit.store(false, std::memory_order_relaxed);
+    m_relightThread = std::thread([this] {
+        profiler::setThreadName("Relight");
+        m_lighting.update(svo, m_relitNodes);
+        m_relitLighting.clear();
+        m_lighting.flatten(svo, m_relitLighting);
+        m_relit.store(true, std::memory_order_release);
+    });
+}
+
+// Makes `buffer`, which holds `previous`, hold `words`. Only the span between the first and
+// last differing word is sent; flatten() shifts every offset after a change, so that's
+// usually the tail of the buffer from the edit on. Storage outgrown is replaced with half
+// again as much. Returns the bytes sent.
+static size_t uploadWords(Buffer &buffer, const std::vector<uint32_t> &previous, const std::vector<uint32_t> &words) {
+    const size_t bytes = words.size() * sizeof(uint32_t);
+    if (bytes > buffer.capacity()) {
+        buffer = Buffer(BufferTarget::ShaderStorage, bytes + bytes / 2, nullptr, Buffer::Usage::Dynamic);
+        buffer.update(words.data(), bytes);
+        buffer.setSize(bytes);
+        return bytes;
+    }
+    size_t first = 0;
+    const size_t common = std::min(previous.size(), words.size());
+    while (first < common && previous[first] == words[first]) {
+        ++first;
+    }
+    size_t last = words.size();
+    if (previous.size() == words.size()) {
+        while (last > first && previous[last - 1] == words[last - 1]) {
+            --last;
         }
     }
-    // Flatten the octree and update the SSBO
-    updateSSBO();
+    // GL orders the write after the frames already submitted, so those still see the old words
+    if (last > first) {
+        buffer.update(words.data() + first, (last - first) * sizeof(uint32_t), first * sizeof(uint32_t));
+    }
+    buffer.setSize(bytes);
+    return (last - first) * sizeof(uint32_t);
 }
 
-void Renderer::updateSSBO() {
-    std::vector<uint32_t> buffer;
-    svo.flatten(buffer);
+void Renderer::updateSSBO(std::vector<uint32_t>&& nodes, std::vector<uint32_t>&& lighting) {
+    PROFILE_SCOPE("Upload world");
+    std::cout << "Flattened octree with buffer size: " << nodes.size() << std::endl;
+    m_uploadBytes += uploadWords(m_ssbo, m_nodes, nodes);
+    m_uploadBytes += uploadWords(m_lightSSBO, m_lightWords, lighting);
+    m_nodes = std::move(nodes);
+    m_lightWords = std::move(lighting);
+    m_historyValid = false;
+}
 
-    std::cout << "Flattened octree with buffer size: " << buffer.size() << std::endl;
+static bool checkFrameData(const Shader &shader) {
+    const int blockSize = shader.uniformBlockSize("FrameData");
+    // drivers may or may not round the block up to a whole vec4, so compare it rounded
+    if ((blockSize + 15) / 16 * 16 != int(sizeof(FrameData))) {
+        std::cerr << "FrameData block is " << blockSize << " bytes in the shader, " << sizeof(FrameData) << " on the CPU" << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    glGenBuffers(1, &ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, buffer.size() * sizeof(uint32_t), buffer.data(), GL_STATIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo);
+// Finishes the programs once the driver is done with them; until then frames are only cleared.
+bool Renderer::pollShader() {
+    if (m_shaderReady) {
+        return true;
+    }
+    for (Shader *shader : { m_shader.get(), m_computeShader.get(), m_beamShader.get(), m_reprojectShader.get() }) {
+        if (!shader->ready()) {
+            return false;
+        }
+    }
+    for (Shader *shader : { m_shader.get(), m_computeShader.get(), m_beamShader.get(), m_reprojectShader.get() }) {
+        if (!shader->finishLink() || !checkFrameData(*shader)) {
+            throw std::runtime_error("Failed to build the voxel shaders");
+        }
+    }
+    m_shaderReady = true;
+    std::cout << "First frame drawn " << (glfwGetTime() - m_startTime) * 1000.0 << " ms after startup" << std::endl;
+    return true;
+}
+
+// Starts a rebuild when a shader file changes and swaps it in once it links. A broken edit
+// only logs its errors; the previous program keeps drawing.
+void Renderer::pollShaderReload() {
+    std::vector<std::string> changed;
+    if (m_shaderWatcher && m_shaderWatcher->poll(changed)) {
+        for (const std::string &path : changed) {
+            std::cout << "Shader source changed: " << path << std::endl;
+        }
+        // a newer edit supersedes a rebuild still in flight
+        m_pendingShader = m_shader->reload();
+        m_pendingComputeShader = m_computeShader->reload();
+        m_pendingBeamShader = m_beamShader->reload();
+        m_pendingReprojectShader = m_reprojectShader->reload();
+    }
+    const auto swapIfReady = [](std::unique_ptr<Shader> &current, std::unique_ptr<Shader> &pending) {
+        if (!pending || !pending->ready()) {
+            return;
+        }
+        std::unique_ptr<Shader> shader = std::move(pending);
+        if (!shader->finishLink() || !checkFrameData(*shader)) {
+            std::cerr << "Shader reload failed, keeping the previous program" << std::endl;
+            return;
+        }
+        current = std::move(shader);
+        std::cout << "Shader reloaded in " << current->linkMs() << " ms" << std::endl;
+    };
+    swapIfReady(m_shader, m_pendingShader);
+    swapIfReady(m_computeShader, m_pendingComputeShader);
+    swapIfReady(m_beamShader, m_pendingBeamShader);
+    swapIfReady(m_reprojectShader, m_pendingReprojectShader);
+}
+
+void Renderer::resizeOutput(int width, int height) {
+    if (m_outputSize == glm::ivec2(width, height)) {
+        return;
+    }
+    // immutable storage can't be resized, so both objects are recreated
+    glDeleteFramebuffers(1, &m_outputFBO);
+    glDeleteTextures(1, &m_outputTexture);
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_outputTexture);
+    glTextureStorage2D(m_outputTexture, 1, GL_RGBA8, width, height);
+    glCreateFramebuffers(1, &m_outputFBO);
+    glNamedFramebufferTexture(m_outputFBO, GL_COLOR_ATTACHMENT0, m_outputTexture, 0);
+    m_outputSize = glm::ivec2(width, height);
+}
+
+void Renderer::resizeBeam(int width, int height) {
+    const glm::ivec2 tiles((width + BEAM_TILE - 1) / BEAM_TILE, (height + BEAM_TILE - 1) / BEAM_TILE);
+    if (m_beamSize == tiles) {
+        return;
+    }
+    glDeleteTextures(1, &m_beamTexture);
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_beamTexture);
+    glTextureStorage2D(m_beamTexture, 1, GL_R32F, tiles.x, tiles.y);
+    m_beamSize = tiles;
+}
+
+void Renderer::resizeHistory(int width, int height) {
+    if (m_historySize == glm::ivec2(width, height)) {
+        return;
+    }
+    glDeleteTextures(1, &m_historyTexture);
+    glDeleteTextures(1, &m_seedTexture);
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_historyTexture);
+    glTextureStorage2D(m_historyTexture, 1, GL_R32F, width, height);
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_seedTexture);
+    glTextureStorage2D(m_seedTexture, 1, GL_R32UI, width, height);
+    m_historySize = glm::ivec2(width, height);
+    m_historyValid = false;
+}
+
+// Scatters the hit distances the last frame recorded into this frame's seeds. Pixels no
+// hit lands on keep NO_SEED and, with their neighbours, are traced in full.
+void Renderer::reproject() {
+    const GLuint noSeed = 0xFFFFFFFFu;
+    glClearTexImage(m_seedTexture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &noSeed);
+    if ((m_frameData.flags & FRAME_REPROJECT) == 0) {
+        return;
+    }
+    GpuScope gpuScope(m_gpuTimer, "Reprojection");
+    glUseProgram(m_reprojectShader->getProgram());
+    // the last voxel pass wrote the history as an image
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindImageTexture(HISTORY_IMAGE_UNIT, m_historyTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(SEED_IMAGE_UNIT, m_seedTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    glDispatchCompute(GLuint(m_historySize.x + 7) / 8, GLuint(m_historySize.y + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+// Picks up the previous frame's step totals and clears them for this one. The readback
+// waits for that frame to finish, which is acceptable for a debug counter.
+void Renderer::readStats() {
+    if (!m_countSteps) {
+        m_stepsPerPixel = 0.0;
+        return;
+    }
+    GLuint stats[2] = { 0, 0 };
+    glGetNamedBufferSubData(m_statsSSBO.id(), 0, sizeof(stats), stats);
+    m_stepsPerPixel = stats[1] > 0 ? double(stats[0]) / double(stats[1]) : 0.0;
+    glClearNamedBufferData(m_statsSSBO.id(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
 }
 
 void Renderer::render() {
+    PROFILE_SCOPE("Renderer::render");
+    m_gpuTimer.beginFrame();
+    pollWorld();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (!pollShader()) {
+        return;
+    }
+    pollShaderReload();
+    // nothing to trace until the world arrives, and an empty buffer can't be bound
+    if (m_ssbo.size() == 0) {
+        return;
+    }
     glEnable(GL_DEPTH_TEST);
-    int width, height;
-    glfwGetFramebufferSize(glfwGetCurrentContext(), &width, &height);
-    glViewport(0, 0, width, height);
-    glm::mat4 matrix_og = m_camera->getViewProjectionMatrix(width, height);
-    auto inverse = glm::inverse(matrix_og);
-    m_shader->setUniform("matrix_original", matrix_og);
-    m_shader->setUniform("inverse_matrix", inverse);
-    m_shader->setTime(glfwGetTime());
+    int windowWidth, windowHeight;
+    glfwGetFramebufferSize(glfwGetCurrentContext(), &windowWidth, &windowHeight);
+    // the pass renders offscreen at this size and everything sized per pixel follows it
+    const float scale = m_dynamicResolution ? m_resolution.update(m_gpuTimer.lastFrameMs()) : 1.0f;
+    const int width = std::max(int(float(windowWidth) * scale + 0.5f), 1);
+    const int height = std::max(int(float(windowHeight) * scale + 0.5f), 1);
+    resizeOutput(width, height);
+    resizeHistory(width, height);
+    const bool reprojecting = m_reproject && m_historyValid && m_framesSinceRefresh + 1 < m_refreshInterval;
+    m_framesSinceRefresh = reprojecting ? m_framesSinceRefresh + 1 : 0;
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo);
+    m_frameData.previousInverseViewProjection = m_frameData.inverseViewProjection;
+    m_frameData.previousCameraPosition = m_frameData.cameraPosition;
+    m_frameData.viewProjection = m_camera->getViewProjectionMatrix(width, height);
+    m_frameData.inverseViewProjection = glm::inverse(m_frameData.viewProjection);
+    m_frameData.cameraPosition = glm::vec4(m_camera->position, 1.0f);
+    m_frameData.resolution = glm::vec2(width, height);
+    m_frameData.time = float(glfwGetTime());
+    m_frameData.flags = (m_beam ? FRAME_BEAM : 0) | (m_countSteps ? FRAME_COUNT_STEPS : 0) | (reprojecting ? FRAME_REPROJECT : 0) |
+                        (m_lightingEnabled && m_lightSSBO.size() > 0 ? FRAME_LIGHTING : 0) |
+                        (m_occlusionEnabled ? FRAME_OCCLUSION : 0) |
+                        (m_bricksEnabled ? FRAME_BRICKS : 0);
+    *m_frameUBO.next<FrameData>() = m_frameData;
+    m_frameUBO.bind(FRAME_DATA_BINDING);
+    readStats();
 
-    glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+    m_ssbo.bind(OCTREE_BINDING);
+    m_lightSSBO.bind(LIGHTING_BINDING);
+    glBindTextureUnit(BRICK_TEXTURE_UNIT, m_bricks.texture());
+
+    reproject();
+    glBindImageTexture(HISTORY_IMAGE_UNIT, m_historyTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glBindImageTexture(SEED_IMAGE_UNIT, m_seedTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32UI);
+    // the voxel pass below records this frame's hits
+    m_historyValid = true;
+
+    resizeBeam(width, height);
+    if (m_beam) {
+        GpuScope gpuScope(m_gpuTimer, "Beam prepass");
+        glUseProgram(m_beamShader->getProgram());
+        glBindImageTexture(BEAM_IMAGE_UNIT, m_beamTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute(GLuint(m_beamSize.x + 7) / 8, GLuint(m_beamSize.y + 7) / 8, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glBindImageTexture(BEAM_IMAGE_UNIT, m_beamTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+
+    if (m_path == VoxelPath::Compute) {
+        GpuScope gpuScope(m_gpuTimer, "Voxel pass (compute)");
+        glUseProgram(m_computeShader->getProgram());
+        glBindImageTexture(0, m_outputTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        glDispatchCompute(GLuint(width + 7) / 8, GLuint(height + 7) / 8, 1);
+        glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+    } else {
+        GpuScope gpuScope(m_gpuTimer, "Voxel pass (fragment)");
+        glBindFramebuffer(GL_FRAMEBUFFER, m_outputFBO);
+        glViewport(0, 0, width, height);
+        glUseProgram(m_shader->getProgram());
+        glBindVertexArray(VAO);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    GpuScope gpuScope(m_gpuTimer, "Upscale");
+    glViewport(0, 0, windowWidth, windowHeight);
+    const GLenum filter = width == windowWidth && height == windowHeight ? GL_NEAREST : GL_LINEAR;
+    glBlitNamedFramebuffer(m_outputFBO, 0, 0, 0, width, height, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, filter);
+}
+
+void Renderer::setDynamicResolutionEnabled(bool enabled) {
+    if (enabled != m_dynamicResolution) {
+        m_resolution.reset(m_resolution.maxScale);
+    }
+    m_dynamicResolution = enabled;
+    m_gpuTimer.setAlwaysOn(enabled);
+}
+
+Renderer::ReferenceComparison Renderer::compareWithReference(const std::string& prefix) {
+    PROFILE_SCOPE("Compare with reference");
+    ReferenceComparison result;
+    const int width = int(m_frameData.resolution.x);
+    const int height = int(m_frameData.resolution.y);
+    std::vector<uint8_t> gpu(size_t(width) * size_t(height) * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTextureImage(m_outputTexture, 0, GL_RGBA, GL_UNSIGNED_BYTE, GLsizei(gpu.size()), gpu.data());
+
+    // the reference has no history, so with reprojection on this also checks that no
+    // pixel started past its surface
+
+    // the buffers the GPU drew from, rather than the copies kept around on the CPU
+    // (storage is padded past size(), so only size() bytes are data)
+    const auto readBack = [](const Buffer& buffer) {
+        std::vector<uint32_t> words(buffer.size() / sizeof(uint32_t));
+        glGetNamedBufferSubData(buffer.id(), 0, GLsizeiptr(words.size() * sizeof(uint32_t)), words.data());
+        return words;
+    };
+    const std::vector<uint32_t> nodes = readBack(m_ssbo);
+    const std::vector<uint32_t> lighting = readBack(m_lightSSBO);
+    // the atlas as the GPU has it, gathered back into brick order
+    std::vector<uint8_t> bricks(m_bricks.texels().size());
+    if (m_bricks.texture() != 0) {
+        const int atlasSize = ATLAS_BRICKS * BRICK_SIZE;
+        std::vector<uint8_t> atlas(size_t(atlasSize) * atlasSize * atlasSize);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTextureImage(m_bricks.texture(), 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, GLsizei(atlas.size()), atlas.data());
+        for (size_t i = 0; i < bricks.size(); ++i) {
+            const int cell = int(i % BRICK_VOXELS);
+            const glm::ivec3 texel = atlasTexel(uint32_t(i / BRICK_VOXELS), glm::ivec3(cell % BRICK_SIZE, cell / BRICK_SIZE % BRICK_SIZE, cell / (BRICK_SIZE * BRICK_SIZE)));
+            bricks[i] = atlas[(size_t(texel.z) * atlasSize + size_t(texel.y)) * atlasSize + size_t(texel.x)];
+        }
+    }
+
+    std::vector<uint8_t> cpu;
+    const ReferenceStats stats = renderReference(nodes, SVO::depth, m_frameData, cpu, lighting, bricks);
+    result.stepsPerPixel = double(stats.steps) / double(std::max<size_t>(stats.pixels, 1));
+    result.beamStepsPerTile = double(stats.beamSteps) / double(std::max<size_t>(stats.tiles, 1));
+    // the same frame traced from the near plane, for the steps the prepass saves
+    FrameData unbeamed = m_frameData;
+    unbeamed.flags &= ~FRAME_BEAM;
+    std::vector<uint8_t> unbeamedImage;
+    const ReferenceStats unbeamedStats = renderReference(nodes, SVO::depth, unbeamed, unbeamedImage, lighting, bricks);
+    result.stepsPerPixelNoBeam = double(unbeamedStats.steps) / double(std::max<size_t>(unbeamedStats.pixels, 1));
+
+    result.pixels = size_t(width) * size_t(height);
+    for (size_t i = 0; i < result.pixels; ++i) {
+        int difference = 0;
+        for (size_t c = 0; c < 3; ++c) {
+            difference = std::max(difference, std::abs(int(gpu[i * 4 + c]) - int(cpu[i * 4 + c])));
+        }
+        result.maxDifference = std::max(result.maxDifference, difference);
+        result.mismatched += difference > 2;
+    }
+    writeImage(prefix + "_gpu.ppm", width, height, gpu);
+    writeImage(prefix + "_cpu.ppm", width, height, cpu);
+    std::cout << "GPU vs CPU reference: " << result.mismatched << " of " << result.pixels << " pixels differ (max "
+              << result.maxDifference << "/255), images in " << prefix << "_{gpu,cpu}.ppm" << std::endl;
+    std::cout << "CPU reference steps per pixel: " << result.stepsPerPixel << " (" << result.stepsPerPixelNoBeam
+              << " without the beam prepass, which visited " << result.beamStepsPerTile << " nodes per tile)" << std::endl;
+    return result;
 }
@@ -1,10 +1,23 @@
 #pragma once
 
 #include <glad/glad.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
 #include <glm/glm.hpp>
 #include "shader.h"
 #include "camera.h"
 #include "voxel.h"
+#include "gputimer.h"
+#include "buffer.h"
+#include "framedata.h"
+#include "lighting.h"
+#include "texture.h"
+#include "raytrace.h"
+#include "resolution.h"
+#include "../world/loader.h"
+#include "../util/filewatcher.h"
 
 class Renderer {
 public:
@@ -13,15 +26,167 @@ public:
     void render();    
     Camera* camera() { return m_camera.get(); }
     Shader* shader() { return m_shader.get(); }
+    const WorldLoader* loader() const { return m_loader.get(); }
+    const SVO& world() const { return svo; }
+    GpuTimer& gpuTimer() { return m_gpuTimer; }
+    // True once the generated world is uploaded and the shaders have linked, i.e. frames
+    // show the actual scene
+    bool ready() const { return m_worldLoaded && m_shaderReady; }
+    // Bytes sent to the GPU by the last render() call
+    size_t uploadBytes() const { return m_uploadBytes; }
+
+    // Applies `edit` to the world and rebakes AO around what it changed, then relights on a
+    // worker thread; the result is uploaded at the start of the frame after it finishes,
+    // and frames show the world as it was until then. Edits made while a relight runs are
+    // applied once it's swapped in.
+    // Edits made before the world has loaded are lost when it arrives.
+    void editWorld(const std::function<void(SVO&)>& edit);
+    // First voxel along a ray through the world as the GPU has it
+    RayHit pick(glm::vec3 origin, glm::vec3 direction) const { return traceFlattened(m_nodes, SVO::depth, origin, direction); }
+    // Shade from the baked per-face lighting rather than a fixed N.L
+    bool lightingEnabled() const { return m_lightingEnabled; }
+    void setLightingEnabled(bool enabled) { m_lightingEnabled = enabled; }
+    // Darken faces by the AO baked into the voxels
+    bool occlusionEnabled() const { return m_occlusionEnabled; }
+    void setOcclusionEnabled(bool enabled) { m_occlusionEnabled = enabled; }
+    // Step through dense 8^3 regions in the brick atlas texture rather than the octree
+    bool bricksEnabled() const { return m_bricksEnabled; }
+    void setBricksEnabled(bool enabled) { m_bricksEnabled = enabled; }
+    size_t brickCount() const { return m_bricks.bricks(); }
+
+    // The voxel pass runs either as a full-screen fragment shader or as a compute shader in
+    // 8x8 tiles. Both draw into an offscreen image that is blitted to the screen.
+    enum class VoxelPath { Fragment, Compute };
+    VoxelPath voxelPath() const { return m_path; }
+    void setVoxelPath(VoxelPath path) { m_path = path; }
+
+    // Beam prepass: a compute pass over 8x8 pixel tiles finds how far each tile's rays can
+    // safely skip before the voxel pass starts tracing them
+    bool beamEnabled() const { return m_beam; }
+    void setBeamEnabled(bool enabled) { m_beam = enabled; }
+    // Step counting sums primary ray steps on the GPU; it costs an atomic per pixel and a
+    // readback per frame, so it's off by default
+    bool countingSteps() const { return m_countSteps; }
+    void setCountingSteps(bool counting) { m_countSteps = counting; }
+    // Average traversal steps per pixel of the previous frame, 0 when not counting
+    double stepsPerPixel() const { return m_stepsPerPixel; }
+
+    // Temporal reprojection: last frame's hits are moved into this frame's view and rays
+    // start just short of them. Every `refreshInterval` frames, and after a resize or world
+    // swap, every pixel is traced in full instead, so errors can't build up.
+    bool reprojectionEnabled() const { return m_reproject; }
+    void setReprojectionEnabled(bool enabled) { m_reproject = enabled; }
+    int refreshInterval() const { return m_refreshInterval; }
+    void setRefreshInterval(int frames) { m_refreshInterval = std::max(frames, 1); }
+
+    // Dynamic resolution: the voxel pass renders at a fraction of the window size, picked
+    // each frame to keep the GPU frame time within resolution().targetMs, and is stretched
+    // to the window. Needs GPU timings, so the timer runs even with the profiler off.
+    bool dynamicResolutionEnabled() const { return m_dynamicResolution; }
+    void setDynamicResolutionEnabled(bool enabled);
+    ResolutionController& resolution() { return m_resolution; }
+    // Size the voxel pass rendered the last frame at
+    glm::ivec2 renderSize() const { return m_outputSize; }
+
+    int debugView() const { return m_frameData.debugView; }
+    void setDebugView(int view) { m_frameData.debugView = view; }
+
+    struct ReferenceComparison {
+        size_t pixels = 0;
+        size_t mismatched = 0; // any channel more than 2/255 off
+        int maxDifference = 0;
+        double stepsPerPixel = 0.0;       // CPU reference, with the beam prepass if enabled
+        double stepsPerPixelNoBeam = 0.0; // CPU reference without it
+        double beamStepsPerTile = 0.0;
+    };
+    // Reads back the frame render() just drew, at the size it was rendered at, and diffs it
+    // against the CPU reference tracer, writing both images to <prefix>_gpu.ppm and
+    // <prefix>_cpu.ppm.
+    ReferenceComparison compareWithReference(const std::string& prefix);
 
 private:
     std::unique_ptr<Shader> m_shader; 
+    std::unique_ptr<Shader> m_computeShader;
+    std::unique_ptr<Shader> m_beamShader;
+    std::unique_ptr<Shader> m_reprojectShader;
     std::unique_ptr<Camera> m_camera;
 
-    GLuint ssbo;
     GLuint VAO;
+    Buffer m_quadVBO;
+    // Shader hot reload: edits under res/shaders relink into the pending programs, which
+    // replace the current ones only if they link
+    std::unique_ptr<FileWatcher> m_shaderWatcher;
+    std::unique_ptr<Shader> m_pendingShader;
+    std::unique_ptr<Shader> m_pendingComputeShader;
+    std::unique_ptr<Shader> m_pendingBeamShader;
+    std::unique_ptr<Shader> m_pendingReprojectShader;
+    bool m_shaderReady = false;
+    VoxelPath m_path = VoxelPath::Fragment;
+    // voxel pass target, recreated when the render size changes
+    GLuint m_outputTexture = 0;
+    GLuint m_outputFBO = 0;
+    glm::ivec2 m_outputSize = glm::ivec2(0);
+    // beam distance per tile, recreated with the render size like the output
+    bool m_dynamicResolution = true;
+    ResolutionController m_resolution;
+    GLuint m_beamTexture = 0;
+    glm::ivec2 m_beamSize = glm::ivec2(0);
+    bool m_beam = true;
+    // hit distance per pixel, written by the voxel pass for the next frame, and the seeds
+    // reprojected from it
+    GLuint m_historyTexture = 0;
+    GLuint m_seedTexture = 0;
+    glm::ivec2 m_historySize = glm::ivec2(0);
+    bool m_historyValid = false;
+    bool m_reproject = true;
+    int m_refreshInterval = 30;
+    int m_framesSinceRefresh = 0;
+    Buffer m_statsSSBO;
+    bool m_countSteps = false;
+    double m_stepsPerPixel = 0.0;
+    double m_startTime = 0.0;
+    // streamed: one region per frame in flight, so rewriting it never waits on the GPU
+    Buffer m_frameUBO;
+    FrameData m_frameData{};
     SVO svo;
 
+    // World and lighting SSBOs, dynamic and rewritten in place: an upload sends only the
+    // span of words that changed, and new storage is only allocated when the data outgrows it.
+    Buffer m_ssbo;
+    Buffer m_lightSSBO;
+    size_t m_uploadBytes = 0;
+    // the world as last uploaded, for picking and relighting, and its lighting, to diff the
+    // next upload against
+    std::vector<uint32_t> m_nodes;
+    std::vector<uint32_t> m_lightWords;
+    VoxelLighting m_lighting;
+    bool m_lightingEnabled = true;
+    // regions edited since the last editWorld, whose AO and bricks are stale
+    std::vector<std::pair<Vec3i32, Vec3i32>> m_editDirty;
+    bool m_occlusionEnabled = true;
+    BrickAtlas m_bricks;
+    // off until a GPU measurement shows the brick path beating the octree walk
+    bool m_bricksEnabled = false;
+    std::unique_ptr<WorldLoader> m_loader;
+    bool m_worldLoaded = false;
+    // Relighting after an edit, on its own thread. It reads svo and owns m_lighting and the
+    // m_relit buffers until m_relit is set, so edits wait in m_pendingEdits meanwhile.
+    std::vector<std::function<void(SVO&)>> m_pendingEdits;
+    std::thread m_relightThread;
+    std::atomic<bool> m_relit{ false };
+    std::vector<uint32_t> m_relitNodes;
+    std::vector<uint32_t> m_relitLighting;
+    GpuTimer m_gpuTimer;
+
     void initializeOctree();
-    void updateSSBO();
+    void pollWorld();
+    void startRelight();
+    void updateSSBO(std::vector<uint32_t>&& nodes, std::vector<uint32_t>&& lighting);
+    bool pollShader();
+    void pollShaderReload();
+    void resizeOutput(int width, int height);
+    void resizeBeam(int width, int height);
+    void resizeHistory(int width, int height);
+    void reproject();
+    void readStats();
 };
@@ -0,0 +1,56 @@
+#include "resolution.h"
+#include "gputimer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// weight of a new timing in the running average, which smooths out single slow frames
+constexpr float SMOOTHING = 0.25f;
+// the scale only goes up when the estimate leaves this much of the budget spare
+constexpr float HEADROOM = 0.85f;
+
+// rounds down, so the quantized scale never costs more than the estimate
+float quantize(float scale) {
+    return std::floor(scale / ResolutionController::STEP + 1e-3f) * ResolutionController::STEP;
+}
+
+} // namespace
+
+float ResolutionController::update(float gpuMs) {
+    const float lo = std::min(minScale, maxScale);
+    const float hi = std::max(minScale, maxScale);
+    m_scale = std::clamp(m_scale, lo, hi);
+    if (m_settling > 0) {
+        --m_settling;
+        return m_scale;
+    }
+    if (gpuMs <= 0.0f || targetMs <= 0.0f) {
+        return m_scale;
+    }
+    m_filteredMs = m_filteredMs > 0.0f ? m_filteredMs + (gpuMs - m_filteredMs) * SMOOTHING : gpuMs;
+
+    float next = m_scale;
+    if (m_filteredMs > targetMs) {
+        // over budget: drop straight to the estimate, always by at least a step
+        next = std::min(quantize(m_scale * std::sqrt(targetMs / m_filteredMs)), m_scale - STEP);
+    } else if (m_filteredMs < targetMs * HEADROOM * HEADROOM) {
+        // pixels scale with the square, so this is the same headroom in scale
+        next = std::max(quantize(m_scale * std::sqrt(targetMs * HEADROOM / m_filteredMs)), m_scale);
+    }
+    next = std::clamp(next, lo, hi);
+    if (std::abs(next - m_scale) >= STEP * 0.5f) {
+        // timings of the old scale are still in flight; start the average afresh after them
+        m_scale = next;
+        m_filteredMs = 0.0f;
+        m_settling = int(GpuTimer::FRAMES) + 1;
+    }
+    return m_scale;
+}
+
+void ResolutionController::reset(float scale) {
+    m_scale = scale;
+    m_filteredMs = 0.0f;
+    m_settling = 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+// Dynamic resolution: picks the scale the voxel pass renders at each frame so that the
+// GPU frame time stays under a budget. Cost is roughly proportional to the pixel count,
+// so the scale moves by the square root of budget over measured time. Timings arrive
+// GpuTimer::FRAMES frames late, so after each change the controller waits for them to
+// catch up before judging the new scale.
+//
+// Scales are quantized to STEP and only go up again with some headroom under the budget,
+// so a steady load settles on one scale instead of oscillating: every change resizes the
+// offscreen targets and drops the reprojection history.
+class ResolutionController {
+public:
+    static constexpr float STEP = 0.05f; // of the window size, per axis
+
+    float targetMs = 12.0f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+
+    float scale() const { return m_scale; }
+    // Feeds the GPU time of the newest measured frame (0 when nothing was measured) and
+    // returns the scale to render the next frame at.
+    float update(float gpuMs);
+    // Starts over at `scale`, e.g. when dynamic resolution is turned on.
+    void reset(float scale = 1.0f);
+
+private:
+    float m_scale = 1.0f;
+    float m_filteredMs = 0.0f;
+    int m_settling = 0; // frames until timings reflect the current scale
+};
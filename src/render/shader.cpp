@@ -2,10 +2,17 @@
 #include "shader.h"
 
 #include <glad/glad.h>
+#include "glfw/glfw.h"
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
 #include <vector>
 #ifdef SHDEBUG
 #define DEBUG_LOG(msg) std::cerr << msg << std::endl
@@ -27,6 +34,64 @@ std::string Shader::readFile(const std::string &filepath) const {
     return buf.str();
 }
 
+bool Shader::preprocess(const std::string &filepath, std::vector<std::string> &files, std::string &out) const {
+    std::string text = readFile(filepath);
+    if (text.empty()) {
+        return false;
+    }
+    const size_t index = files.size();
+    files.push_back(filepath);
+
+    std::istringstream lines(text);
+    std::string line;
+    for (size_t number = 1; std::getline(lines, line); ++number) {
+        const size_t first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || line.compare(first, 8, "#include") != 0) {
+            out += line;
+            out += '\n';
+            continue;
+        }
+        const size_t open = line.find('"', first);
+        const size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+        if (close == std::string::npos) {
+            std::cerr << filepath << ":" << number << ": malformed #include" << std::endl;
+            return false;
+        }
+        const std::string included =
+            (std::filesystem::path(filepath).parent_path() / line.substr(open + 1, close - open - 1)).lexically_normal().generic_string();
+        if (std::find(files.begin(), files.end(), included) != files.end()) {
+            continue; // already included, this also breaks cycles
+        }
+        out += "#line 1 " + std::to_string(files.size()) + "\n";
+        if (!preprocess(included, files, out)) {
+            std::cerr << "Included from " << filepath << ":" << number << std::endl;
+            return false;
+        }
+        out += "#line " + std::to_string(number + 1) + " " + std::to_string(index) + "\n";
+    }
+    return true;
+}
+
+std::string Shader::withDefines(const std::string &text) const {
+    if (m_defines.empty()) {
+        return text;
+    }
+    // #version has to stay first
+    const size_t version = text.find("#version");
+    const size_t end = version == std::string::npos ? std::string::npos : text.find('\n', version);
+    if (end == std::string::npos) {
+        return text;
+    }
+    const size_t line = size_t(std::count(text.begin(), text.begin() + ptrdiff_t(end), '\n')) + 2;
+    std::string out = text.substr(0, end + 1);
+    for (const auto &[name, value] : m_defines) {
+        out += "#define " + name + " " + value + "\n";
+    }
+    out += "#line " + std::to_string(line) + " 0\n";
+    out.append(text, end + 1, std::string::npos);
+    return out;
+}
+
 Shader::Shader() : m_program(glCreateProgram()) {
     if (m_program == 0) {
         std::cerr << "Failed to create shader program." << std::endl;
@@ -53,52 +118,236 @@ void Shader::unbind() const {
     DEBUG_LOG("Unbound shader program with ID: " << m_program);
 }
 
+namespace {
+
+// GL_KHR_parallel_shader_compile isn't part of the loaded GL version, fetch it by hand
+constexpr GLenum COMPLETION_STATUS_KHR = 0x91B1;
+typedef void (*PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+bool parallelCompileSupported() {
+    static const bool supported = [] {
+        if (!glfwExtensionSupported("GL_KHR_parallel_shader_compile")) {
+            return false;
+        }
+        auto maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+        if (maxThreads == nullptr) {
+            return false;
+        }
+        maxThreads(0xFFFFFFFFu); // let the driver pick
+        DEBUG_LOG("Using GL_KHR_parallel_shader_compile");
+        return true;
+    }();
+    return supported;
+}
+
+uint64_t fnv1a(uint64_t hash, std::string_view data) {
+    for (unsigned char c : data) {
+        hash = (hash ^ c) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Cached binaries start with this, then the binary format and length
+constexpr char BINARY_MAGIC[4] = { 'V', 'X', 'S', 'B' };
+
+} // namespace
+
 void Shader::compile(unsigned int type, const std::string &filepath) {
-    std::string source = readFile(filepath);
-    if (source.empty()) {
+    Source source{ type, filepath, {}, {} };
+    if (!preprocess(filepath, source.files, source.text)) {
         std::cerr << "Failed to read shader source from file: " << filepath << std::endl;
         throw std::runtime_error("Failed to read shader source from file: " + filepath);
         return;
     }
-    DEBUG_LOG("Compiling shader from file: " << filepath);
+    m_sources.push_back(std::move(source));
+}
 
-    unsigned int shader = glCreateShader(type);
-    const char *sourceCStr = source.c_str();
-    glShaderSource(shader, 1, &sourceCStr, nullptr);
-    glCompileShader(shader);
+void Shader::define(const std::string &name, const std::string &value) {
+    for (auto &define : m_defines) {
+        if (define.first == name) {
+            define.second = value;
+            return;
+        }
+    }
+    m_defines.emplace_back(name, value);
+}
 
-    int isCompiled = 0;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
-    DEBUG_LOG("Compiled shader with ID: " << shader << " and type: " << type);
-    if (isCompiled == GL_TRUE) {
+std::unique_ptr<Shader> Shader::reload() const {
+    auto shader = std::make_unique<Shader>();
+    shader->m_defines = m_defines;
+    try {
+        for (const Source &source : m_sources) {
+            shader->compile(source.type, source.filepath);
+        }
+    } catch (const std::runtime_error &) {
+        return nullptr;
+    }
+    shader->linkAsync();
+    return shader;
+}
+
+void Shader::compileSources() {
+    for (const Source &source : m_sources) {
+        DEBUG_LOG("Compiling shader from file: " << source.filepath);
+        unsigned int shader = glCreateShader(source.type);
+        const std::string text = withDefines(source.text);
+        const char *sourceCStr = text.c_str();
+        glShaderSource(shader, 1, &sourceCStr, nullptr);
+        glCompileShader(shader);
+        glAttachShader(m_program, shader);
         shaders.push_back(shader);
-        DEBUG_LOG("Shader compilation successful!");
-    } else {
-        DEBUG_LOG("Shader compilation failure!");
-        int maxLength = 0;
-        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &maxLength);
+        DEBUG_LOG("Attached shader with ID: " << shader);
+    }
+    glProgramParameteri(m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(m_program);
+}
 
-        std::vector<char> infoLog((size_t)maxLength);
-        glGetShaderInfoLog(shader, maxLength, &maxLength, infoLog.data());
+bool Shader::loadBinary() {
+    std::ifstream file(m_cachePath, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    char magic[4];
+    uint32_t format = 0, length = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&format), sizeof(format));
+    file.read(reinterpret_cast<char *>(&length), sizeof(length));
+    if (!file || std::memcmp(magic, BINARY_MAGIC, sizeof(magic)) != 0) {
+        return false;
+    }
+    // a truncated or corrupt header mustn't size the allocation: the binary is the rest
+    // of the file, exactly
+    const std::streamoff header = file.tellg();
+    file.seekg(0, std::ios::end);
+    const std::streamoff remaining = file.tellg() - header;
+    if (length == 0 || std::streamoff(length) != remaining || length > uint32_t(INT32_MAX)) {
+        return false;
+    }
+    file.seekg(header);
+    std::vector<char> binary(length);
+    if (!file.read(binary.data(), length)) {
+        return false;
+    }
+    glProgramBinary(m_program, format, binary.data(), GLsizei(length));
+    return true;
+}
 
-        std::cerr << "Shader compilation failure!" << std::endl
-                  << infoLog.data() << std::endl;
-        glDeleteShader(shader);
-        throw std::runtime_error("Shader compilation failure!");
+void Shader::saveBinary() const {
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    GLint length = 0;
+    glGetProgramiv(m_program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (formats == 0 || length <= 0) {
+        return;
+    }
+    std::vector<char> binary((size_t)length);
+    GLenum format = 0;
+    glGetProgramBinary(m_program, length, nullptr, &format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(CACHE_DIRECTORY, error);
+    // written aside and renamed so a crash never leaves a truncated binary behind
+    const std::string temporary = m_cachePath + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Failed to open file: " << temporary << std::endl;
+            return;
+        }
+        const uint32_t header[2] = { uint32_t(format), uint32_t(length) };
+        file.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+        file.write(reinterpret_cast<const char *>(header), sizeof(header));
+        file.write(binary.data(), length);
+        if (!file) {
+            std::cerr << "Failed to write shader cache: " << temporary << std::endl;
+            return;
+        }
+    }
+    std::filesystem::rename(temporary, m_cachePath, error);
+    if (error) {
+        std::cerr << "Failed to write shader cache: " << m_cachePath << std::endl;
+    }
+}
+
+void Shader::linkAsync() {
+    m_linkStart = std::chrono::steady_clock::now();
+    m_pending = true;
+
+    // a binary is only valid for the exact sources and the driver that produced it
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const Source &source : m_sources) {
+        hash = fnv1a(hash, std::to_string(source.type));
+        hash = fnv1a(hash, withDefines(source.text));
+    }
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        const char *value = reinterpret_cast<const char *>(glGetString(name));
+        hash = fnv1a(hash, value != nullptr ? value : "");
+    }
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+    m_cachePath = std::string(CACHE_DIRECTORY) + "/" + key + ".bin";
+
+    m_fromCache = loadBinary();
+    if (!m_fromCache) {
+        parallelCompileSupported();
+        compileSources();
+    }
+}
+
+bool Shader::ready() const {
+    if (!m_pending || !parallelCompileSupported()) {
+        return true;
     }
+    GLint done = GL_FALSE;
+    glGetProgramiv(m_program, COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
 }
 
 void Shader::link() {
-    for (auto shader : shaders) {
-        glAttachShader(m_program, shader);
-        DEBUG_LOG("Attached shader with ID: " << shader);
+    linkAsync();
+    if (!finishLink()) {
+        throw std::runtime_error("Shader link failure!");
     }
+}
 
-    glLinkProgram(m_program);
+bool Shader::finishLink() {
+    if (!m_pending) {
+        return true;
+    }
+    m_pending = false;
 
     int isLinked = 0;
     glGetProgramiv(m_program, GL_LINK_STATUS, &isLinked);
+    if (isLinked == GL_FALSE && m_fromCache) {
+        // stale or rejected binary, e.g. after a driver update that kept the version string
+        DEBUG_LOG("Cached program binary rejected, compiling " << m_cachePath);
+        m_fromCache = false;
+        compileSources();
+        glGetProgramiv(m_program, GL_LINK_STATUS, &isLinked);
+    }
+
     if (isLinked == GL_FALSE) {
+        // shaders[i] was compiled from m_sources[i]
+        for (size_t i = 0; i < shaders.size(); ++i) {
+            int isCompiled = 0;
+            glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &isCompiled);
+            if (isCompiled == GL_TRUE) {
+                continue;
+            }
+            int maxLength = 0;
+            glGetShaderiv(shaders[i], GL_INFO_LOG_LENGTH, &maxLength);
+
+            std::vector<char> infoLog((size_t)maxLength);
+            glGetShaderInfoLog(shaders[i], maxLength, &maxLength, infoLog.data());
+
+            std::cerr << "Shader compilation failure!" << std::endl
+                      << infoLog.data() << std::endl;
+            const std::vector<std::string> &files = m_sources[i].files;
+            for (size_t file = 0; file < files.size(); ++file) {
+                std::cerr << "  source " << file << ": " << files[file] << std::endl;
+            }
+        }
+
         int maxLength = 0;
         glGetProgramiv(m_program, GL_INFO_LOG_LENGTH, &maxLength);
 
@@ -109,68 +358,140 @@ void Shader::link() {
                   << infoLog.data() << std::endl;
     } else {
         DEBUG_LOG("Shader link successful!");
-        for (auto shader : shaders) {
-            glDetachShader(m_program, shader);
-            glDeleteShader(shader);
-            DEBUG_LOG("Detached and deleted shader with ID: " << shader);
+        reflect();
+        if (!m_fromCache) {
+            saveBinary();
         }
     }
 
+    for (auto shader : shaders) {
+        glDetachShader(m_program, shader);
+        glDeleteShader(shader);
+        DEBUG_LOG("Detached and deleted shader with ID: " << shader);
+    }
     shaders.clear();
+
+    m_linkMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_linkStart).count();
+    if (isLinked == GL_FALSE) {
+        return false;
+    }
+    std::cout << "Shader program ready in " << m_linkMs << " ms ("
+              << (m_fromCache ? "binary cache" : parallelCompileSupported() ? "parallel compile" : "compiled") << ")" << std::endl;
+    return true;
 }
 
 unsigned int Shader::getProgram() const {
     return m_program;
 }
 
-void Shader::setUniform(const std::string &name, const glm::vec2 &value) const {
-    int location = glGetUniformLocation(m_program, name.c_str());
-    if (location == -1) {
-        std::cerr << "Failed to find uniform location for '" << name << "'" << std::endl;
-        return;
-    }
-    // DEBUG_LOG("Setting uniform " << name << " to " << value.x << ", " << value.y);
-    glUniform2fv(location, 1, glm::value_ptr(value));
+namespace {
+
+template <typename Info>
+const Info *findByName(const std::vector<Info> &table, std::string_view name) {
+    auto it = std::lower_bound(table.begin(), table.end(), name, [](const Info &info, std::string_view n) { return info.name < n; });
+    return it != table.end() && it->name == name ? &*it : nullptr;
 }
 
-void Shader::setUniform(const std::string &name, const glm::vec3 &value) const {
-    int location = glGetUniformLocation(m_program, name.c_str());
-    if (location == -1) {
-        std::cerr << "Failed to find uniform location for '" << name << "'" << std::endl;
-        return;
+} // namespace
+
+void Shader::reflect() {
+    m_uniforms.clear();
+    m_blocks.clear();
+
+    GLint count = 0;
+    glGetProgramInterfaceiv(m_program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+    const GLenum uniformProps[] = { GL_NAME_LENGTH, GL_LOCATION, GL_ARRAY_SIZE, GL_TYPE, GL_BLOCK_INDEX };
+    for (GLint i = 0; i < count; ++i) {
+        GLint values[5];
+        glGetProgramResourceiv(m_program, GL_UNIFORM, i, 5, uniformProps, 5, nullptr, values);
+        if (values[4] != -1) {
+            continue; // members of a uniform block are set through its buffer
+        }
+        std::string name((size_t)values[0], '\0');
+        glGetProgramResourceName(m_program, GL_UNIFORM, i, values[0], nullptr, name.data());
+        name.resize(name.find('\0'));
+        // arrays report "name[0]", also accept the bare name
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+            name.resize(name.size() - 3);
+        }
+        m_uniforms.push_back({ std::move(name), values[1], values[2], (unsigned int)values[3] });
     }
-    // DEBUG_LOG("Setting uniform " << name << " to " << value.x << ", " << value.y << ", " << value.z);
-    glUniform3fv(location, 1, glm::value_ptr(value));
-}
 
-void Shader::setUniform(const std::string &name, const glm::mat4 &value) const {
-    int location = glGetUniformLocation(m_program, name.c_str());
-    if (location == -1) {
-        std::cerr << "Failed to find uniform location for '" << name << "'" << std::endl;
-        return;
+    glGetProgramInterfaceiv(m_program, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &count);
+    const GLenum blockProps[] = { GL_NAME_LENGTH, GL_BUFFER_DATA_SIZE };
+    for (GLint i = 0; i < count; ++i) {
+        GLint values[2];
+        glGetProgramResourceiv(m_program, GL_UNIFORM_BLOCK, i, 2, blockProps, 2, nullptr, values);
+        std::string name((size_t)values[0], '\0');
+        glGetProgramResourceName(m_program, GL_UNIFORM_BLOCK, i, values[0], nullptr, name.data());
+        name.resize(name.find('\0'));
+        m_blocks.push_back({ std::move(name), i, values[1], 0 });
     }
-    // DEBUG_LOG("Setting uniform " << name << " to ");
-    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
-}
 
-void Shader::setUniform(const std::string &name, float value) const {
-    int location = glGetUniformLocation(m_program, name.c_str());
-    if (location == -1) {
-        std::cerr << "Failed to find uniform location for '" << name << "'" << std::endl;
-        return;
+    const auto byName = [](const UniformInfo &a, const UniformInfo &b) { return a.name < b.name; };
+    std::sort(m_uniforms.begin(), m_uniforms.end(), byName);
+    std::sort(m_blocks.begin(), m_blocks.end(), byName);
+    for (const auto &uniform : m_uniforms) {
+        DEBUG_LOG("Active uniform '" << uniform.name << "' at location " << uniform.location);
+    }
+    for (const auto &block : m_blocks) {
+        DEBUG_LOG("Active uniform block '" << block.name << "' (" << block.size << " bytes)");
     }
-    // DEBUG_LOG("Setting uniform " << name << " to " << value);
-    glUniform1f(location, value);
 }
 
-void Shader::setUniform(const std::string &name, int value) const {
-    int location = glGetUniformLocation(m_program, name.c_str());
-    if (location == -1) {
-        std::cerr << "Failed to find uniform location for '" << name << "'" << std::endl;
-        return;
-    }
-    // DEBUG_LOG("Setting uniform " << name << " to " << value);
-    glUniform1i(location, value);
+int Shader::uniformLocation(std::string_view name) const {
+    const UniformInfo *info = findByName(m_uniforms, name);
+    return info != nullptr ? info->location : -1;
+}
+
+int Shader::uniformBlockIndex(std::string_view name) const {
+    const UniformInfo *info = findByName(m_blocks, name);
+    return info != nullptr ? info->location : -1;
+}
+
+int Shader::uniformBlockSize(std::string_view name) const {
+    const UniformInfo *info = findByName(m_blocks, name);
+    return info != nullptr ? info->size : 0;
+}
+
+void Shader::setUniform(int location, const glm::vec2 &value) const {
+    glProgramUniform2fv(m_program, location, 1, glm::value_ptr(value));
+}
+
+void Shader::setUniform(int location, const glm::vec3 &value) const {
+    glProgramUniform3fv(m_program, location, 1, glm::value_ptr(value));
+}
+
+void Shader::setUniform(int location, const glm::mat4 &value) const {
+    glProgramUniformMatrix4fv(m_program, location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::setUniform(int location, float value) const {
+    glProgramUniform1f(m_program, location, value);
+}
+
+void Shader::setUniform(int location, int value) const {
+    glProgramUniform1i(m_program, location, value);
+}
+
+void Shader::setUniform(std::string_view name, const glm::vec2 &value) const {
+    setUniform(uniformLocation(name), value);
+}
+
+void Shader::setUniform(std::string_view name, const glm::vec3 &value) const {
+    setUniform(uniformLocation(name), value);
+}
+
+void Shader::setUniform(std::string_view name, const glm::mat4 &value) const {
+    setUniform(uniformLocation(name), value);
+}
+
+void Shader::setUniform(std::string_view name, float value) const {
+    setUniform(uniformLocation(name), value);
+}
+
+void Shader::setUniform(std::string_view name, int value) const {
+    setUniform(uniformLocation(name), value);
 }
 
 void Shader::setCameraMatrix(const glm::mat4& MVP) const {
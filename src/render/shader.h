@@ -1,7 +1,11 @@
 #pragma once
 
+#include <chrono>
+#include <memory>
+#include <utility>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <glm/glm.hpp>
 
 
@@ -13,15 +17,52 @@ public:
     void bind() const;
     void unbind() const;
 
+    // Reads a stage's source, expanding `#include "file"` (relative to the including file,
+    // each file at most once). Nothing is compiled until the program is linked.
     void compile(unsigned int type, const std::string &filepath);
+    // Injected after the #version line of every stage, e.g. define("MAX_DEPTH", "16").
+    // Takes effect at the next link.
+    void define(const std::string &name, const std::string &value);
+    // Builds the program from a cached binary when one matches the sources and driver,
+    // otherwise compiles and links, caching the result. linkAsync() returns as soon as the
+    // work is queued; with GL_KHR_parallel_shader_compile the driver compiles on its own
+    // threads until finishLink(). link() does both.
     void link();
+    void linkAsync();
+    bool ready() const;
+    // Returns false, keeping the log on stderr, if a stage failed to compile or link.
+    bool finishLink();
+    // A new program built from the same files and defines, re-read from disk and already
+    // linking. The current program stays usable; swap it out once the new one finishes
+    // successfully. Returns nullptr if a file can't be read.
+    std::unique_ptr<Shader> reload() const;
     unsigned int getProgram() const;
 
-    void setUniform(const std::string &name, const glm::vec2 &value) const;
-    void setUniform(const std::string &name, const glm::vec3 &value) const;
-    void setUniform(const std::string &name, const glm::mat4 &value) const;
-    void setUniform(const std::string &name, float value) const;
-    void setUniform(const std::string &name, int value) const;
+    bool linkedFromCache() const { return m_fromCache; }
+    // Milliseconds from linkAsync() to the end of finishLink()
+    double linkMs() const { return m_linkMs; }
+
+    // Directory program binaries are cached in, relative to the working directory
+    static constexpr const char *CACHE_DIRECTORY = "shadercache";
+
+    // Active uniforms and uniform blocks are reflected once at link time. Look locations up
+    // once and keep them; -1 means the uniform isn't active and setting it is a no-op.
+    int uniformLocation(std::string_view name) const;
+    // Index of the active uniform block `name` and its std140 size, or -1 and 0.
+    int uniformBlockIndex(std::string_view name) const;
+    int uniformBlockSize(std::string_view name) const;
+
+    void setUniform(int location, const glm::vec2 &value) const;
+    void setUniform(int location, const glm::vec3 &value) const;
+    void setUniform(int location, const glm::mat4 &value) const;
+    void setUniform(int location, float value) const;
+    void setUniform(int location, int value) const;
+
+    void setUniform(std::string_view name, const glm::vec2 &value) const;
+    void setUniform(std::string_view name, const glm::vec3 &value) const;
+    void setUniform(std::string_view name, const glm::mat4 &value) const;
+    void setUniform(std::string_view name, float value) const;
+    void setUniform(std::string_view name, int value) const;
 
     void setCameraPosition(const glm::vec3 &position) const;
     void setCameraDirection(const glm::vec3 &direction) const;
@@ -30,9 +71,39 @@ public:
     void setTime(float time) const;
 
 private:
+    struct UniformInfo {
+        std::string name;
+        int location; // for blocks, the block index
+        int size;     // for blocks, the buffer size in bytes; otherwise the array length
+        unsigned int type;
+    };
+
+    struct Source {
+        unsigned int type;
+        std::string filepath;
+        std::string text;
+        std::vector<std::string> files; // GLSL source string numbers used in #line
+    };
+
     unsigned int m_program;
     std::vector<unsigned int> shaders;
+    std::vector<Source> m_sources;
+    std::vector<std::pair<std::string, std::string>> m_defines;
+    std::string m_cachePath;
+    bool m_pending = false;
+    bool m_fromCache = false;
+    std::chrono::steady_clock::time_point m_linkStart;
+    double m_linkMs = 0.0;
+    std::vector<UniformInfo> m_uniforms; // sorted by name
+    std::vector<UniformInfo> m_blocks;   // sorted by name
+
+    void reflect();
+    void compileSources();
+    bool loadBinary();
+    void saveBinary() const;
 
     std::string readFile(const std::string &filepath) const;
+    bool preprocess(const std::string &filepath, std::vector<std::string> &files, std::string &out) const;
+    std::string withDefines(const std::string &text) const;
 };
 
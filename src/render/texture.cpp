@@ -1,92 +1,231 @@
-// #include "texture.h"
-// #include <glad/glad.h>
-// #include <iostream>
-// #define STB_IMAGE_IMPLEMENTATION
-// #include "stb_image.h"
-//
-// /* 
-// Provided a map {name : path} for textures, will load textures into a single texture slot
-//
-// The map extends in the x direction
-// */
-// TextureMap::TextureMap(const std::unordered_map<std::string, std::string> &paths) {
-//     glGenTextures(1, &textureID);
-//     
-//     
-//     struct TexturePixels {
-//         std::string key; // name of the texture (unique)
-//         Texture texture {}; // texture data
-//         stbi_uc *pixels = nullptr; // pixel data
-//     };
-//
-//     // initialize pixel buffer as an array of TexturePixels with the size of the paths
-//     TexturePixels pixel_buffer[paths.size()];
-//
-//     int total_width = 0, total_height = 0;
-//     {
-//         uint i = 0;
-//         for (auto &key_path : paths) {
-//             auto key = key_path.first;
-//             auto path = key_path.second;
-//             Texture texture {};
-//             stbi_uc *pixels = stbi_load(path.c_str(), &texture.width, &texture.height, nullptr, STBI_rgb_alpha);
-//             if (!pixels) {
-//                 std::cerr << path << " - " << stbi_failure_reason();
-//                 exit(EXIT_FAILURE);
-//             }
-//             TexturePixels texturePixels { key, texture, pixels };
-//             total_height = std::max(texture.height, total_height);
-//             total_width += texture.width;
-//             pixel_buffer[i++] = texturePixels;
-//         }
-//     }
-//
-//     int total_size = total_width * total_height * STBI_rgb_alpha;
-//     stbi_uc map_buffer[total_size];
-//     memset(map_buffer, 0, (size_t)total_size);
-//
-//     // COMBINE IMAGES
-//     size_t offset = 0;
-//     for (int i = 0; i < total_height; i++) {
-//         size_t line_offset = offset;
-//         for (auto &texturePixels : pixel_buffer) {
-//             Texture texture = texturePixels.texture;
-//             int size = texture.width * STBI_rgb_alpha;
-//
-//             if (i < texture.height)
-//                 memcpy(&map_buffer[line_offset], texturePixels.pixels + i * size, (size_t)size);
-//
-//             line_offset += size;
-//         }
-//         offset += total_width * STBI_rgb_alpha;
-//     }
-//
-//     // MAP COORDINATES
-//     float x_offset = 0;
-//     for (auto &texturePixels : pixel_buffer) {
-//         Texture texture = texturePixels.texture;
-//         float width = (float)texture.width / (float)total_width;
-//         float height = (float)texture.height / (float)total_height;
-//         texture.mapCoord = { x_offset, 0, width, height };
-//         m_textureMap[texturePixels.key] = texture;
-//         x_offset += width;
-//     }
-//
-//     glBindTexture(GL_TEXTURE_2D, textureID);
-//     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-//     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-//     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, total_width, total_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, map_buffer);
-//
-//     for (const auto &texturePixels : pixel_buffer) {
-//         stbi_image_free(texturePixels.pixels);
-//     }
-// }
-//
-// TextureMap::~TextureMap() {
-//     glDeleteTextures(1, &textureID);
-// }
-//
-// Texture TextureMap::operator[](const std::string &name) const {
-//     return m_textureMap.at(name);
-// }
-//
+#include "texture.h"
+#include "../util/parallel.h"
+#include "../util/profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// positions made non-negative, 21 bits per axis
+const Vec3i32 KEY_OFFSET(1 << SVO::depth);
+
+uint64_t brickKey(Vec3i32 origin) {
+    const glm::uvec3 u(origin + KEY_OFFSET);
+    return uint64_t(u.x) << 42 | uint64_t(u.y) << 21 | uint64_t(u.z);
+}
+
+Vec3i32 keyOrigin(uint64_t key) {
+    constexpr uint64_t mask = (1u << 21) - 1;
+    return Vec3i32(glm::uvec3(unsigned(key >> 42 & mask), unsigned(key >> 21 & mask), unsigned(key & mask))) - KEY_OFFSET;
+}
+
+Vec3i32 brickOrigin(Vec3i32 pos) {
+    return pos & ~(BRICK_SIZE - 1);
+}
+
+} // namespace
+
+glm::ivec3 atlasTexel(uint32_t brick, glm::ivec3 cell) {
+    const glm::ivec3 slot(brick % ATLAS_BRICKS, brick / ATLAS_BRICKS % ATLAS_BRICKS, brick / (ATLAS_BRICKS * ATLAS_BRICKS));
+    return slot * BRICK_SIZE + cell;
+}
+
+BrickAtlas::~BrickAtlas() {
+    if (m_texture != 0) {
+        glDeleteTextures(1, &m_texture);
+    }
+}
+
+BrickAtlas &BrickAtlas::operator=(BrickAtlas &&other) noexcept {
+    m_minFill = other.m_minFill;
+    m_slots = std::move(other.m_slots);
+    m_free = std::move(other.m_free);
+    m_texels = std::move(other.m_texels);
+    m_dirty.clear();
+    for (const auto &[key, slot] : m_slots) {
+        m_dirty.push_back(slot);
+    }
+    other.m_slots.clear();
+    other.m_free.clear();
+    other.m_texels.clear();
+    other.m_dirty.clear();
+    return *this;
+}
+
+int BrickAtlas::fill(const SVO &svo, Vec3i32 origin, std::span<uint8_t> texels) {
+    std::fill(texels.begin(), texels.end(), uint8_t(0));
+    int count = 0;
+    svo.forEach(origin, origin + (BRICK_SIZE - 1), [&](Vec3i32 pos, const rgb32_t &) {
+        const Vec3i32 cell = pos - origin;
+        texels[size_t((cell.z * BRICK_SIZE + cell.y) * BRICK_SIZE + cell.x)] = 1;
+        ++count;
+    });
+    return count;
+}
+
+uint32_t BrickAtlas::allocate() {
+    if (!m_free.empty()) {
+        const uint32_t slot = m_free.back();
+        m_free.pop_back();
+        return slot;
+    }
+    const uint32_t slot = uint32_t(m_texels.size() / BRICK_VOXELS);
+    if (slot >= ATLAS_CAPACITY) {
+        return ATLAS_CAPACITY; // full: the brick stays in the octree
+    }
+    m_texels.resize(m_texels.size() + BRICK_VOXELS);
+    return slot;
+}
+
+size_t BrickAtlas::build(const SVO &svo, unsigned threads) {
+    PROFILE_SCOPE("Build bricks");
+    m_slots.clear();
+    m_free.clear();
+    m_texels.clear();
+    m_dirty.clear();
+
+    // leaves come out depth first, so those of one brick are consecutive
+    std::vector<Vec3i32> origins;
+    svo.forEachLeaf([&](uint32_t, Vec3i32 leaf) {
+        const Vec3i32 origin = brickOrigin(leaf);
+        if (origins.empty() || origins.back() != origin) {
+            origins.push_back(origin);
+        }
+    });
+    std::vector<int> fills(origins.size());
+    parallelFor(origins.size(), [&](size_t i, unsigned) {
+        std::array<uint8_t, BRICK_VOXELS> texels;
+        fills[i] = fill(svo, origins[i], texels);
+    }, threads);
+
+    // slots in tree order, so a build is deterministic
+    std::vector<std::pair<size_t, uint32_t>> dense;
+    for (size_t i = 0; i < origins.size(); ++i) {
+        if (fills[i] >= m_minFill) {
+            const uint32_t slot = allocate();
+            if (slot == ATLAS_CAPACITY) {
+                break;
+            }
+            m_slots.emplace(brickKey(origins[i]), slot);
+            m_dirty.push_back(slot);
+            dense.emplace_back(i, slot);
+        }
+    }
+    parallelFor(dense.size(), [&](size_t i, unsigned) {
+        const auto [index, slot] = dense[i];
+        fill(svo, origins[index], std::span(m_texels).subspan(size_t(slot) * BRICK_VOXELS, BRICK_VOXELS));
+    }, threads);
+    return m_slots.size();
+}
+
+size_t BrickAtlas::update(const SVO &svo, Vec3i32 lo, Vec3i32 hi) {
+    // only bricks with a voxel in the box now, or already in the atlas and touched by the
+    // box, can have changed: any other brick there has lost voxels and stays sparse
+    std::vector<uint64_t> keys;
+    svo.forEach(lo, hi, [&](Vec3i32 pos, const rgb32_t &) {
+        // Morton order keeps a brick's voxels together
+        const uint64_t key = brickKey(brickOrigin(pos));
+        if (keys.empty() || keys.back() != key) {
+            keys.push_back(key);
+        }
+    });
+    // whichever of the box and the atlas is smaller is walked for the latter
+    const Vec3i32 first = brickOrigin(lo);
+    const Vec3i32 last = brickOrigin(hi);
+    const glm::ivec3 cells = glm::max((last - first) / BRICK_SIZE + 1, glm::ivec3(0));
+    if (size_t(cells.x) * size_t(cells.y) * size_t(cells.z) <= m_slots.size()) {
+        for (int x = first.x; x <= last.x; x += BRICK_SIZE) {
+            for (int y = first.y; y <= last.y; y += BRICK_SIZE) {
+                for (int z = first.z; z <= last.z; z += BRICK_SIZE) {
+                    if (const uint64_t key = brickKey(Vec3i32(x, y, z)); m_slots.contains(key)) {
+                        keys.push_back(key);
+                    }
+                }
+            }
+        }
+    } else {
+        for (const auto &[key, slot] : m_slots) {
+            const Vec3i32 origin = keyOrigin(key);
+            if (glm::all(glm::lessThanEqual(first, origin)) && glm::all(glm::lessThanEqual(origin, last))) {
+                keys.push_back(key);
+            }
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    size_t rebuilt = 0;
+    std::array<uint8_t, BRICK_VOXELS> texels;
+    for (uint64_t key : keys) {
+        const auto it = m_slots.find(key);
+        if (fill(svo, keyOrigin(key), texels) < m_minFill) {
+            if (it != m_slots.end()) {
+                m_free.push_back(it->second);
+                m_slots.erase(it);
+            }
+            continue;
+        }
+        uint32_t slot = it != m_slots.end() ? it->second : allocate();
+        if (slot == ATLAS_CAPACITY) {
+            continue;
+        }
+        m_slots[key] = slot;
+        std::memcpy(m_texels.data() + size_t(slot) * BRICK_VOXELS, texels.data(), BRICK_VOXELS);
+        m_dirty.push_back(slot);
+        ++rebuilt;
+    }
+    return rebuilt;
+}
+
+void BrickAtlas::annotate(std::span<uint32_t> nodes) const {
+    if (nodes.empty() || m_slots.empty()) {
+        return;
+    }
+    struct Entry {
+        uint32_t node;
+        size_t level;
+        Vec3i32 origin;
+    };
+    std::vector<Entry> stack{ { 0, SVO::depth, Vec3i32(-(1 << SVO::depth)) } };
+    while (!stack.empty()) {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        if (entry.level == BRICK_LEVEL) {
+            if (const auto it = m_slots.find(brickKey(entry.origin)); it != m_slots.end()) {
+                nodes[entry.node] = BRICK_NODE | it->second;
+            }
+            continue;
+        }
+        const int childSize = 1 << entry.level;
+        for (uint32_t i = 0; i < 8; ++i) {
+            if (const uint32_t child = nodes[entry.node + 1 + i]; child != 0) {
+                stack.push_back({ child, entry.level - 1, entry.origin + Vec3i32((i >> 2) & 1, (i >> 1) & 1, i & 1) * childSize });
+            }
+        }
+    }
+}
+
+size_t BrickAtlas::upload() {
+    if (m_texture == 0) {
+        const int size = ATLAS_BRICKS * BRICK_SIZE;
+        glCreateTextures(GL_TEXTURE_3D, 1, &m_texture);
+        glTextureStorage3D(m_texture, 1, GL_R8UI, size, size, size);
+        // integer textures are only complete with nearest filtering
+        glTextureParameteri(m_texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(m_texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    std::sort(m_dirty.begin(), m_dirty.end());
+    m_dirty.erase(std::unique(m_dirty.begin(), m_dirty.end()), m_dirty.end());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (uint32_t slot : m_dirty) {
+        const glm::ivec3 texel = atlasTexel(slot, glm::ivec3(0));
+        glTextureSubImage3D(m_texture, 0, texel.x, texel.y, texel.z, BRICK_SIZE, BRICK_SIZE, BRICK_SIZE, GL_RED_INTEGER,
+                            GL_UNSIGNED_BYTE, m_texels.data() + size_t(slot) * BRICK_VOXELS);
+    }
+    const size_t bytes = m_dirty.size() * BRICK_VOXELS;
+    m_dirty.clear();
+    return bytes;
+}
@@ -1,25 +1,74 @@
-// #pragma once
-// #include "types.h"
-//
-// #include <string>
-// #include <unordered_map>
-//
-// struct Texture {
-//     int width, height;
-//     Rect mapCoord;
-// };
-//
-// class TextureMap {
-//     private:
-//         uint textureID = 0;
-//         std::unordered_map<std::string, Texture> m_textureMap;
-//         
-//     public:
-//         explicit TextureMap(const std::unordered_map<std::string, std::string> &paths);
-//         virtual ~TextureMap();
-//
-//         Texture operator[](const std::string &name) const;
-// };
-//
-//
-//
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+#include "voxel.h"
+
+// Brick atlas: dense 8x8x8 regions of the world kept as occupancy in one 3D texture, so
+// rays crossing them step voxel by voxel through the texture cache instead of walking the
+// octree's storage buffer node by node.
+
+// A brick is the subtree of a node at BRICK_LEVEL, BRICK_SIZE voxels per side
+constexpr size_t BRICK_LEVEL = 2;
+constexpr int BRICK_SIZE = 8;
+constexpr int BRICK_VOXELS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+// Bricks per side of the atlas; 32 makes a 256^3 R8UI texture (16 MiB) of 32768 bricks
+constexpr int ATLAS_BRICKS = 32;
+constexpr uint32_t ATLAS_CAPACITY = ATLAS_BRICKS * ATLAS_BRICKS * ATLAS_BRICKS;
+// Header of a brick node in SVO::flatten output: a branch at BRICK_LEVEL whose subtree is
+// also in the atlas. The low bits hold its brick index instead of the ordinal; the rest of
+// the node is laid out as any branch, so traversals that don't know bricks descend it.
+constexpr uint32_t BRICK_NODE = LEAF_NODE | BRANCH_NODE;
+
+// Texel of voxel `cell` of brick `brick` in the atlas
+glm::ivec3 atlasTexel(uint32_t brick, glm::ivec3 cell);
+
+// Packs the dense bricks of an SVO into an R8UI 3D texture, one byte per voxel (1 where
+// solid). Slots are handed out from a free list, so bricks that empty out after an edit
+// are reused, and only bricks changed since the last upload() are sent, as sub-images.
+class BrickAtlas {
+public:
+    // Bricks with fewer solid voxels than `minFill` stay in the octree: sparse ones are
+    // crossed in fewer steps by skipping empty nodes than by stepping every voxel.
+    explicit BrickAtlas(int minFill = BRICK_VOXELS / 2) : m_minFill(minFill) {}
+    ~BrickAtlas();
+
+    BrickAtlas(const BrickAtlas &) = delete;
+    BrickAtlas &operator=(const BrickAtlas &) = delete;
+    // Takes the other atlas' bricks but keeps this one's texture, queueing every brick for
+    // the next upload(), so an atlas built off-thread can be moved into the renderer's.
+    BrickAtlas &operator=(BrickAtlas &&other) noexcept;
+
+    // Rebuilds every brick of `svo`. Returns the number in the atlas.
+    size_t build(const SVO &svo, unsigned threads = 0);
+    // Rebuilds the bricks overlapping [lo, hi], e.g. after an edit. Returns the number
+    // rebuilt.
+    size_t update(const SVO &svo, Vec3i32 lo, Vec3i32 hi);
+    // Marks the brick nodes in `nodes`, SVO::flatten output of the same tree.
+    void annotate(std::span<uint32_t> nodes) const;
+
+    size_t bricks() const { return m_slots.size(); }
+    // BRICK_VOXELS bytes per slot in use or freed, x fastest: the texture's contents, for
+    // the CPU reference tracer
+    std::span<const uint8_t> texels() const { return m_texels; }
+
+    // Creates the texture on first use and uploads the bricks changed since the last call.
+    // Returns the bytes sent.
+    size_t upload();
+    GLuint texture() const { return m_texture; }
+
+private:
+    int m_minFill;
+    std::unordered_map<uint64_t, uint32_t> m_slots; // by brick origin
+    std::vector<uint32_t> m_free;
+    std::vector<uint8_t> m_texels;
+    std::vector<uint32_t> m_dirty; // slots to upload, possibly repeated
+    GLuint m_texture = 0;
+
+    // Fills `texels` with the occupancy of the brick at `origin` and returns its fill
+    static int fill(const SVO &svo, Vec3i32 origin, std::span<uint8_t> texels);
+    uint32_t allocate();
+};
@@ -1,6 +1,8 @@
-
 #include "voxel.h"
+#include <algorithm>
+#include <bit>
 #include <iostream>
+#include <utility>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -34,188 +36,935 @@ std::unique_ptr<SVONode> SVOBranch::clone() const {
     return std::make_unique<SVOBranch>(*this);
 }
 
-// Clone method for SVOLeaf
-std::unique_ptr<SVONode> SVOLeaf::clone() const {
-    return std::make_unique<SVOLeaf>(*this);
+namespace {
+
+// Sorts (octree index, query) pairs by index, keeping queries with equal indices in their
+// original order. Large batches use an LSD radix sort over the bits the indices actually
+// use: comparison sorting dominated batch lookups, costing far more than the walk itself.
+void sortQueries(std::vector<std::pair<uint64_t, uint32_t>>& order) {
+    constexpr size_t RADIX_MIN = 1024;
+    constexpr int DIGIT_BITS = 11;
+    if (order.size() < RADIX_MIN) {
+        sortQueries(order);
+        return;
+    }
+    uint64_t used = 0;
+    for (const auto& entry : order) {
+        used |= entry.first;
+    }
+    const int bits = 64 - std::countl_zero(used);
+    std::vector<std::pair<uint64_t, uint32_t>> scratch(order.size());
+    for (int shift = 0; shift < bits; shift += DIGIT_BITS) {
+        std::array<size_t, (1 << DIGIT_BITS) + 1> offsets{};
+        for (const auto& entry : order) {
+            ++offsets[((entry.first >> shift) & ((1 << DIGIT_BITS) - 1)) + 1];
+        }
+        for (size_t d = 1; d < offsets.size(); ++d) {
+            offsets[d] += offsets[d - 1];
+        }
+        for (const auto& entry : order) {
+            scratch[offsets[(entry.first >> shift) & ((1 << DIGIT_BITS) - 1)]++] = entry;
+        }
+        order.swap(scratch);
+    }
+}
+
+// Walks from a node at `Level` down to its leaf. Each level is its own instantiation,
+// so the whole walk is straight-line code with the node type of every level known.
+template <typename Leaf, size_t Level>
+Leaf* descendUnrolled(SVONode* node, uint64_t octreeNodeIndex) {
+    if constexpr (Level == 0) {
+        return static_cast<Leaf*>(node);
+    } else {
+        SVONode* child = static_cast<SVOBranch*>(node)->children[(octreeNodeIndex >> (Level * 3)) & 0b111].get();
+        return child == nullptr ? nullptr : descendUnrolled<Leaf, Level - 1>(child, octreeNodeIndex);
+    }
 }
 
+template <typename Leaf, size_t Level>
+Leaf* createUnrolled(SVONode* node, uint64_t octreeNodeIndex, SVOCounters& counters) {
+    if constexpr (Level == 0) {
+        return static_cast<Leaf*>(node);
+    } else {
+        auto& child = static_cast<SVOBranch*>(node)->children[(octreeNodeIndex >> (Level * 3)) & 0b111];
+        if (child == nullptr) {
+            if constexpr (Level == 1) {
+                child = std::make_unique<Leaf>();
+            } else {
+                child = std::make_unique<SVOBranch>();
+            }
+            ++counters.nodes[Level - 1];
+        }
+        return createUnrolled<Leaf, Level - 1>(child.get(), octreeNodeIndex, counters);
+    }
+}
 
-void SVO::insert(Vec3i32 pos, rgb32_t color) {
-    std::cout << "Inserting voxel color " << color.r << ", " << color.g << ", " << color.b << " at position " << pos.x << ", " << pos.y << ", " << pos.z << std::endl;
-    ensureSpace(pos);
+// Jump table so that walks starting at a runtime level still run the unrolled code.
+template <typename Leaf, size_t... Levels>
+constexpr auto makeDescendTable(std::index_sequence<Levels...>) {
+    return std::array<Leaf* (*)(SVONode*, uint64_t), sizeof...(Levels)>{ &descendUnrolled<Leaf, Levels>... };
+}
+
+// Interleaves the bits of an unsigned position so that every octal digit of the index
+// selects a child octant (x is the high bit of the digit, z the low bit).
+uint64_t mortonIndex(Vec3u32 uPos) {
+    constexpr auto spreadBits = [](uint64_t v) -> uint64_t {
+        v &= 0x1FFFFF;
+        v = (v | v << 32) & 0x1F00000000FFFF;
+        v = (v | v << 16) & 0x1F0000FF0000FF;
+        v = (v | v << 8) & 0x100F00F00F00F00F;
+        v = (v | v << 4) & 0x10C30C30C30C30C3;
+        v = (v | v << 2) & 0x1249249249249249;
+        return v;
+    };
+    static_assert(spreadBits(0b111) == 0b001001001);
+    return (spreadBits(uPos.x) << 2) | (spreadBits(uPos.y) << 1) | spreadBits(uPos.z);
+}
+
+// Octant of child (or leaf voxel) `i`, matching the digit order of mortonIndex
+Vec3u32 octant(size_t i) {
+    return Vec3u32((i >> 2) & 1, (i >> 1) & 1, i & 1);
+}
+
+// Origin of child `i` of a node whose children are at `childLevel`
+Vec3u32 childOrigin(Vec3u32 origin, size_t i, size_t childLevel) {
+    return origin + (octant(i) << Vec3u32(childLevel + 1));
+}
+
+template <typename Traits, typename Leaf>
+uint32_t leafVoxels(const Leaf& leaf) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < 8; ++i) {
+        count += !Traits::empty(Traits::get(leaf.data, i));
+    }
+    return count;
+}
+
+template <typename Traits, typename Leaf>
+bool leafEmpty(const Leaf& leaf) {
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (!Traits::empty(Traits::get(leaf.data, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool branchEmpty(const SVOBranch& branch) {
+    return std::all_of(branch.children.begin(), branch.children.end(), [](const auto& child) { return child == nullptr; });
+}
+
+// Grows [lo, hi] to cover every leaf below node, skipping subtrees already inside it.
+void growLeafBounds(const SVONode* node, size_t level, Vec3u32 origin, Vec3u32& lo, Vec3u32& hi) {
+    const Vec3u32 last = origin + Vec3u32((2u << level) - 1);
+    if (glm::all(glm::lessThanEqual(lo, origin)) && glm::all(glm::lessThanEqual(last, hi))) {
+        return;
+    }
+    if (level == 0) {
+        lo = glm::min(lo, origin);
+        hi = glm::max(hi, last);
+        return;
+    }
+    const auto* branch = static_cast<const SVOBranch*>(node);
+    for (size_t i = 0; i < 8; ++i) {
+        if (branch->children[i] != nullptr) {
+            growLeafBounds(branch->children[i].get(), level - 1, childOrigin(origin, i, level - 1), lo, hi);
+        }
+    }
+}
+
+// Adds (sign 1) or removes (sign -1) a whole subtree's nodes and voxels from counters.
+template <typename Leaf, typename Traits>
+void countSubtree(const SVONode* node, size_t level, SVOCounters& counters, int sign) {
+    counters.nodes[level] += sign;
+    if (level == 0) {
+        counters.voxels += sign * static_cast<ptrdiff_t>(leafVoxels<Traits>(*static_cast<const Leaf*>(node)));
+        return;
+    }
+    for (const auto& child : static_cast<const SVOBranch*>(node)->children) {
+        if (child != nullptr) {
+            countSubtree<Leaf, Traits>(child.get(), level - 1, counters, sign);
+        }
+    }
+}
+
+// Drops a subtree, taking it off the counters.
+template <typename Leaf, typename Traits>
+void dropSubtree(std::unique_ptr<SVONode>& node, size_t level, SVOCounters& counters) {
+    countSubtree<Leaf, Traits>(node.get(), level, counters, -1);
+    node.reset();
+}
+
+// Copies src into dst where src is set. A missing dst subtree takes src whole, moved out
+// of srcOwner when there is one.
+template <typename Leaf, typename Traits>
+void mergeNodes(std::unique_ptr<SVONode>& dst, SVONode* src, std::unique_ptr<SVONode>* srcOwner, size_t level, SVOCounters& counters) {
+    if (dst == nullptr) {
+        countSubtree<Leaf, Traits>(src, level, counters, 1);
+        dst = srcOwner != nullptr ? std::move(*srcOwner) : src->clone();
+        return;
+    }
+    if (level == 0) {
+        auto& d = static_cast<Leaf*>(dst.get())->data;
+        const auto& s = static_cast<const Leaf*>(src)->data;
+        for (uint32_t i = 0; i < 8; ++i) {
+            if (auto value = Traits::get(s, i); !Traits::empty(value)) {
+                counters.voxels += Traits::empty(Traits::get(d, i));
+                Traits::set(d, i, value);
+            }
+        }
+        return;
+    }
+    auto* d = static_cast<SVOBranch*>(dst.get());
+    auto* s = static_cast<SVOBranch*>(src);
+    for (size_t i = 0; i < 8; ++i) {
+        if (s->children[i] != nullptr) {
+            mergeNodes<Leaf, Traits>(d->children[i], s->children[i].get(), srcOwner != nullptr ? &s->children[i] : nullptr, level - 1, counters);
+        }
+    }
+}
+
+// Clears dst where src is set, only descending where both have children. Emptied nodes are removed.
+template <typename Leaf, typename Traits>
+void subtractNodes(std::unique_ptr<SVONode>& dst, const SVONode* src, size_t level, SVOCounters& counters) {
+    if (level == 0) {
+        auto* d = static_cast<Leaf*>(dst.get());
+        const auto& s = static_cast<const Leaf*>(src)->data;
+        for (uint32_t i = 0; i < 8; ++i) {
+            if (!Traits::empty(Traits::get(s, i))) {
+                counters.voxels -= !Traits::empty(Traits::get(d->data, i));
+                Traits::set(d->data, i, {});
+            }
+        }
+        if (leafEmpty<Traits>(*d)) {
+            dropSubtree<Leaf, Traits>(dst, level, counters);
+        }
+        return;
+    }
+    auto* d = static_cast<SVOBranch*>(dst.get());
+    auto* s = static_cast<const SVOBranch*>(src);
+    for (size_t i = 0; i < 8; ++i) {
+        if (d->children[i] != nullptr && s->children[i] != nullptr) {
+            subtractNodes<Leaf, Traits>(d->children[i], s->children[i].get(), level - 1, counters);
+        }
+    }
+    if (branchEmpty(*d)) {
+        dropSubtree<Leaf, Traits>(dst, level, counters);
+    }
+}
+
+// Keeps dst only where src is set; dst subtrees without a src counterpart are dropped whole.
+template <typename Leaf, typename Traits>
+void intersectNodes(std::unique_ptr<SVONode>& dst, const SVONode* src, size_t level, SVOCounters& counters) {
+    if (level == 0) {
+        auto* d = static_cast<Leaf*>(dst.get());
+        const auto& s = static_cast<const Leaf*>(src)->data;
+        for (uint32_t i = 0; i < 8; ++i) {
+            if (Traits::empty(Traits::get(s, i))) {
+                counters.voxels -= !Traits::empty(Traits::get(d->data, i));
+                Traits::set(d->data, i, {});
+            }
+        }
+        if (leafEmpty<Traits>(*d)) {
+            dropSubtree<Leaf, Traits>(dst, level, counters);
+        }
+        return;
+    }
+    auto* d = static_cast<SVOBranch*>(dst.get());
+    auto* s = static_cast<const SVOBranch*>(src);
+    for (size_t i = 0; i < 8; ++i) {
+        if (d->children[i] == nullptr) {
+            continue;
+        }
+        if (s->children[i] == nullptr) {
+            dropSubtree<Leaf, Traits>(d->children[i], level - 1, counters);
+        } else {
+            intersectNodes<Leaf, Traits>(d->children[i], s->children[i].get(), level - 1, counters);
+        }
+    }
+    if (branchEmpty(*d)) {
+        dropSubtree<Leaf, Traits>(dst, level, counters);
+    }
+}
+
+const std::array<Vec3i32, 6> faceOffsets = {
+    Vec3i32(-1, 0, 0), Vec3i32(1, 0, 0),
+    Vec3i32(0, -1, 0), Vec3i32(0, 1, 0),
+    Vec3i32(0, 0, -1), Vec3i32(0, 0, 1),
+};
+
+const std::array<Vec3i32, 27> windowOffsets = [] {
+    std::array<Vec3i32, 27> offsets;
+    for (int i = 0; i < 27; ++i) {
+        offsets[i] = Vec3i32(i / 9 - 1, (i / 3) % 3 - 1, i % 3 - 1);
+    }
+    return offsets;
+}();
+
+const std::array<Vec3i32, 26> neighborOffsets = [] {
+    std::array<Vec3i32, 26> offsets;
+    std::copy(windowOffsets.begin(), windowOffsets.begin() + 13, offsets.begin());
+    std::copy(windowOffsets.begin() + 14, windowOffsets.end(), offsets.begin() + 13);
+    return offsets;
+}();
+
+} // namespace
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::insert(Vec3i32 pos, Payload value) {
+    ALWAYS_ASSERT(boundsTest(pos) == 0);
+    auto octreeNodeIndex = indexOf(pos);
+    setVoxel(findOrCreate(octreeNodeIndex), octreeNodeIndex & 0b111, value);
+    notifyEdit(pos, pos);
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::insertBatch(std::span<const Vec3i32> positions, std::span<const Payload> values) {
+    ALWAYS_ASSERT(values.size() >= positions.size());
+    std::vector<std::pair<u64, u32>> order;
+    order.reserve(positions.size());
+    Vec3i32 lo = maxIncl();
+    Vec3i32 hi = minIncl();
+    for (size_t i = 0; i < positions.size(); ++i) {
+        ALWAYS_ASSERT(boundsTest(positions[i]) == 0);
+        order.emplace_back(indexOf(positions[i]), static_cast<u32>(i));
+        lo = glm::min(lo, positions[i]);
+        hi = glm::max(hi, positions[i]);
+    }
+    sortQueries(order);
+
+    PathCache cache;
+    for (auto [octreeNodeIndex, i] : order) {
+        setVoxel(seekOrCreate(cache, octreeNodeIndex), octreeNodeIndex & 0b111, values[i]);
+    }
+    if (!positions.empty()) {
+        notifyEdit(lo, hi);
+    }
+}
+
+template <typename Payload, size_t MaxDepth>
+Payload BasicSVO<Payload, MaxDepth>::get(Vec3i32 pos) const {
+    if (boundsTest(pos) != 0) {
+        return Payload{};
+    }
     auto octreeNodeIndex = indexOf(pos);
-    insert(octreeNodeIndex, color);
+    auto* leaf = find(octreeNodeIndex);
+    return leaf != nullptr ? Traits::get(leaf->data, octreeNodeIndex & 0b111) : Payload{};
 }
 
-Vec3i32 SVO::minIncl() const {
+template <typename Payload, size_t MaxDepth>
+Vec3i32 BasicSVO<Payload, MaxDepth>::minIncl() const {
     return Vec3i32(-(1 << depth));
 }
 
-Vec3i32 SVO::maxIncl() const {
+template <typename Payload, size_t MaxDepth>
+Vec3i32 BasicSVO<Payload, MaxDepth>::maxIncl() const {
     return Vec3i32((1 << depth) - 1);
 }
 
-Vec3i32 SVO::minExcl() const {
+template <typename Payload, size_t MaxDepth>
+Vec3i32 BasicSVO<Payload, MaxDepth>::minExcl() const {
     return Vec3i32(-(1 << depth) - 1);
 }
 
-Vec3i32 SVO::maxExcl() const {
+template <typename Payload, size_t MaxDepth>
+Vec3i32 BasicSVO<Payload, MaxDepth>::maxExcl() const {
     return Vec3i32(1 << depth);
 }
 
-rgb32_t& SVO::operator[](Vec3i32 pos) {
-    ensureSpace(pos);
+template <typename Payload, size_t MaxDepth>
+Payload& BasicSVO<Payload, MaxDepth>::operator[](Vec3i32 pos) requires referenceable {
+    ALWAYS_ASSERT(boundsTest(pos) == 0);
     auto octreeNodeIndex = indexOf(pos);
-    return findOrCreate(octreeNodeIndex);
+    voxelsStale = true;
+    return findOrCreate(octreeNodeIndex).data[octreeNodeIndex & 0b111];
 }
 
-rgb32_t& SVO::at(Vec3i32 pos) {
+template <typename Payload, size_t MaxDepth>
+Payload& BasicSVO<Payload, MaxDepth>::at(Vec3i32 pos) requires referenceable {
     u32 lim = boundsTest(pos);
     ALWAYS_ASSERT(lim == 0);
     auto octreeNodeIndex = indexOf(pos);
-    auto* result = find(octreeNodeIndex);
-    ALWAYS_ASSERT(result != nullptr);
-    return *result;
+    auto* leaf = find(octreeNodeIndex);
+    ALWAYS_ASSERT(leaf != nullptr);
+    voxelsStale = true;
+    return leaf->data[octreeNodeIndex & 0b111];
 }
 
-const rgb32_t& SVO::at(Vec3i32 pos) const {
+template <typename Payload, size_t MaxDepth>
+const Payload& BasicSVO<Payload, MaxDepth>::at(Vec3i32 pos) const requires referenceable {
     u32 lim = boundsTest(pos);
     ALWAYS_ASSERT(lim == 0);
     auto octreeNodeIndex = indexOf(pos);
-    auto* result = find(octreeNodeIndex);
-    ALWAYS_ASSERT(result != nullptr);
-    return *result;
+    auto* leaf = find(octreeNodeIndex);
+    ALWAYS_ASSERT(leaf != nullptr);
+    return leaf->data[octreeNodeIndex & 0b111];
 }
 
-rgb32_t& SVO::findOrCreate(u64 octreeNodeIndex) {
-    SVONode* node = root.get();
-    for (size_t s = depth * 3; s != size_t(-3); s -= 3) {
-        u32 octDigit = (octreeNodeIndex >> s) & 0b111;
-        if (s != 0) {
-            auto* branch = dynamic_cast<SVOBranch*>(node);
-            if (branch->children[octDigit] != nullptr) {
-                node = branch->children[octDigit].get();
-            } else {
-                auto* child = s == 3 ? static_cast<SVONode*>(new SVOLeaf)
-                                     : static_cast<SVONode*>(new SVOBranch);
-                node = child;
-                branch->children[octDigit] = std::unique_ptr<SVONode>(child);
-            }
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::lookupBatch(std::span<const Vec3i32> positions, std::span<Payload*> results) requires referenceable {
+    ALWAYS_ASSERT(results.size() >= positions.size());
+    voxelsStale = true;
+    size_t found = findBatch(positions, results.data());
+    ALWAYS_ASSERT(found == positions.size());
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::lookupBatch(std::span<const Vec3i32> positions, std::span<const Payload*> results) const requires referenceable {
+    ALWAYS_ASSERT(results.size() >= positions.size());
+    size_t found = findBatch(positions, const_cast<Payload**>(results.data()));
+    ALWAYS_ASSERT(found == positions.size());
+}
+
+template <typename Payload, size_t MaxDepth>
+size_t BasicSVO<Payload, MaxDepth>::tryLookupBatch(std::span<const Vec3i32> positions, std::span<Payload*> results) requires referenceable {
+    ALWAYS_ASSERT(results.size() >= positions.size());
+    voxelsStale = true;
+    return findBatch(positions, results.data());
+}
+
+template <typename Payload, size_t MaxDepth>
+size_t BasicSVO<Payload, MaxDepth>::tryLookupBatch(std::span<const Vec3i32> positions, std::span<const Payload*> results) const requires referenceable {
+    ALWAYS_ASSERT(results.size() >= positions.size());
+    return findBatch(positions, const_cast<Payload**>(results.data()));
+}
+
+template <typename Payload, size_t MaxDepth>
+std::array<const Payload*, 6> BasicSVO<Payload, MaxDepth>::neighbors6(Vec3i32 pos) const requires referenceable {
+    std::array<const Payload*, 6> result;
+    PathCache cache;
+    findAround(cache, pos, faceOffsets, result.data());
+    return result;
+}
+
+template <typename Payload, size_t MaxDepth>
+std::array<const Payload*, 26> BasicSVO<Payload, MaxDepth>::neighbors26(Vec3i32 pos) const requires referenceable {
+    std::array<const Payload*, 26> result;
+    PathCache cache;
+    findAround(cache, pos, neighborOffsets, result.data());
+    return result;
+}
+
+template <typename Payload, size_t MaxDepth>
+SVOLeaf<Payload>& BasicSVO<Payload, MaxDepth>::findOrCreate(u64 octreeNodeIndex) {
+    return *createUnrolled<Leaf, depth>(root.get(), octreeNodeIndex, counters);
+}
+
+template <typename Payload, size_t MaxDepth>
+SVOLeaf<Payload>* BasicSVO<Payload, MaxDepth>::find(u64 octreeNodeIndex) const {
+    return descendUnrolled<Leaf, depth>(root.get(), octreeNodeIndex);
+}
+
+template <typename Payload, size_t MaxDepth>
+size_t BasicSVO<Payload, MaxDepth>::findBatch(std::span<const Vec3i32> positions, Payload** results) const requires referenceable {
+    // sort the queries by octree index, remembering where each result goes
+    std::vector<std::pair<u64, u32>> order;
+    order.reserve(positions.size());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        if (boundsTest(positions[i]) != 0) {
+            results[i] = nullptr;
+            continue;
+        }
+        order.emplace_back(indexOf(positions[i]), static_cast<u32>(i));
+    }
+    sortQueries(order);
+
+    PathCache cache;
+    size_t found = 0;
+    for (auto [octreeNodeIndex, i] : order) {
+        Leaf* leaf = seek(cache, octreeNodeIndex);
+        results[i] = leaf != nullptr ? &leaf->data[octreeNodeIndex & 0b111] : nullptr;
+        found += leaf != nullptr;
+    }
+    return found;
+}
+
+template <typename Payload, size_t MaxDepth>
+SVOLeaf<Payload>* BasicSVO<Payload, MaxDepth>::seek(PathCache& cache, u64 octreeNodeIndex) const {
+    if (cache.validLevel > depth) {
+        cache.nodes[depth] = root.get();
+        cache.validLevel = depth;
+    } else if (u64 diff = octreeNodeIndex ^ cache.index; diff != 0) {
+        size_t diffLevel = static_cast<size_t>(63 - std::countl_zero(diff)) / 3;
+        cache.validLevel = std::max(cache.validLevel, diffLevel);
+    }
+    cache.index = octreeNodeIndex;
+
+    size_t l = cache.validLevel;
+    for (; l > 0; --l) {
+        auto* branch = static_cast<SVOBranch*>(cache.nodes[l]);
+        SVONode* child = branch->children[(octreeNodeIndex >> (l * 3)) & 0b111].get();
+        if (child == nullptr) {
+            break;
+        }
+        cache.nodes[l - 1] = child;
+    }
+    cache.validLevel = l;
+    return l == 0 ? static_cast<Leaf*>(cache.nodes[0]) : nullptr;
+}
+
+template <typename Payload, size_t MaxDepth>
+SVOLeaf<Payload>& BasicSVO<Payload, MaxDepth>::seekOrCreate(PathCache& cache, u64 octreeNodeIndex) {
+    if (cache.validLevel > depth) {
+        cache.nodes[depth] = root.get();
+        cache.validLevel = depth;
+    } else if (u64 diff = octreeNodeIndex ^ cache.index; diff != 0) {
+        size_t diffLevel = static_cast<size_t>(63 - std::countl_zero(diff)) / 3;
+        cache.validLevel = std::max(cache.validLevel, diffLevel);
+    }
+    cache.index = octreeNodeIndex;
+
+    for (size_t l = cache.validLevel; l > 0; --l) {
+        auto& child = static_cast<SVOBranch*>(cache.nodes[l])->children[(octreeNodeIndex >> (l * 3)) & 0b111];
+        if (child == nullptr) {
+            child = l == 1 ? std::unique_ptr<SVONode>(std::make_unique<Leaf>())
+                           : std::unique_ptr<SVONode>(std::make_unique<SVOBranch>());
+            ++counters.nodes[l - 1];
+        }
+        cache.nodes[l - 1] = child.get();
+    }
+    cache.validLevel = 0;
+    return *static_cast<Leaf*>(cache.nodes[0]);
+}
+
+template <typename Payload, size_t MaxDepth>
+SVOLeaf<Payload>* BasicSVO<Payload, MaxDepth>::descend(SVONode* node, size_t level, u64 octreeNodeIndex) const {
+    static constexpr auto table = makeDescendTable<Leaf>(std::make_index_sequence<depth + 1>{});
+    return table[level](node, octreeNodeIndex);
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::findAround(PathCache& cache, Vec3i32 center, std::span<const Vec3i32> offsets, const Payload** results) const requires referenceable {
+    bool centerInBounds = boundsTest(center) == 0;
+    if (centerInBounds) {
+        seek(cache, indexOf(center));
+    }
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        Vec3i32 pos = center + offsets[i];
+        if (boundsTest(pos) != 0) {
+            results[i] = nullptr;
+            continue;
+        }
+        u64 octreeNodeIndex = indexOf(pos);
+        Leaf* leaf = nullptr;
+        if (!centerInBounds) {
+            leaf = find(octreeNodeIndex);
         } else {
-            auto* leaf = dynamic_cast<SVOLeaf*>(node);
-            return leaf->data[octDigit];
+            // the neighbour shares every ancestor above the highest digit it differs in;
+            // if the centre path is cut off above that point, so is the neighbour's
+            u64 diff = octreeNodeIndex ^ cache.index;
+            size_t diffLevel = diff == 0 ? 0 : static_cast<size_t>(63 - std::countl_zero(diff)) / 3;
+            if (diffLevel >= cache.validLevel) {
+                leaf = descend(cache.nodes[diffLevel], diffLevel, octreeNodeIndex);
+            }
         }
+        results[i] = leaf != nullptr ? &leaf->data[octreeNodeIndex & 0b111] : nullptr;
     }
-    DEBUG_ASSERT_UNREACHABLE();
 }
 
-rgb32_t* SVO::find(u64 octreeNodeIndex) const {
-    SVONode* node = root.get();
-    for (size_t s = depth * 3; s != size_t(-3); s -= 3) {
-        u32 octDigit = (octreeNodeIndex >> s) & 0b111;
-        if (s != 0) {
-            auto* branch = dynamic_cast<SVOBranch*>(node);
-            if (branch->children[octDigit] == nullptr) {
-                return nullptr;
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::setVoxel(Leaf& leaf, u32 i, Payload value) {
+    counters.voxels += !Traits::empty(value);
+    counters.voxels -= !Traits::empty(Traits::get(leaf.data, i));
+    Traits::set(leaf.data, i, value);
+}
+
+template <typename Payload, size_t MaxDepth>
+uint64_t BasicSVO<Payload, MaxDepth>::indexOf(Vec3i32 pos) const {
+    return mortonIndex(glm::uvec3(pos - minIncl()));
+}
+
+template <typename Payload, size_t MaxDepth>
+uint32_t BasicSVO<Payload, MaxDepth>::boundsTest(Vec3i32 v) const {
+    constexpr auto absForBoundsTest = [](int32_t x) -> uint32_t {
+        return static_cast<uint32_t>(x < 0 ? -x - 1 : x);
+    };
+    static_assert (absForBoundsTest(-5) == 4);
+    u32 max = absForBoundsTest(v[0]) | absForBoundsTest(v[1]) | absForBoundsTest(v[2]);
+    return max >= (1u << depth) ? max : 0;
+}
+
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::addEditListener(std::function<void(Vec3i32 lo, Vec3i32 hi)> listener) {
+    editListeners.push_back(std::move(listener));
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::notifyEdit(Vec3i32 lo, Vec3i32 hi) const {
+    lo = glm::max(lo, minIncl());
+    hi = glm::min(hi, maxIncl());
+    if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z) {
+        return;
+    }
+    for (const auto& listener : editListeners) {
+        listener(lo, hi);
+    }
+}
+
+template <typename Payload, size_t MaxDepth>
+std::pair<Vec3i32, Vec3i32> BasicSVO<Payload, MaxDepth>::leafBounds() const {
+    Vec3u32 lo(UINT32_MAX), hi(0);
+    growLeafBounds(root.get(), depth, Vec3u32(0), lo, hi);
+    if (lo.x > hi.x) {
+        return { maxIncl(), minIncl() };
+    }
+    return { Vec3i32(lo) + minIncl(), Vec3i32(hi) + minIncl() };
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::prune(u64 octreeNodeIndex, size_t level) {
+    // slots from the root's child down to `level`, stopping early where the path ends
+    std::array<std::unique_ptr<SVONode>*, MaxDepth> path{};
+    size_t lowest = depth;
+    SVOBranch* branch = root.get();
+    for (size_t l = depth; l > level; --l) {
+        auto& child = branch->children[(octreeNodeIndex >> (l * 3)) & 0b111];
+        path[l - 1] = &child;
+        lowest = l - 1;
+        if (child == nullptr) {
+            break;
+        }
+        if (l - 1 > 0) {
+            branch = static_cast<SVOBranch*>(child.get());
+        }
+    }
+    for (size_t l = lowest; l < depth; ++l) {
+        auto& node = *path[l];
+        if (node == nullptr) {
+            continue;
+        }
+        const bool empty = l == 0 ? leafEmpty<Traits>(*static_cast<Leaf*>(node.get())) : branchEmpty(*static_cast<SVOBranch*>(node.get()));
+        if (!empty) {
+            break;
+        }
+        dropSubtree<Leaf, Traits>(node, l, counters);
+    }
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::merge(const BasicSVO& other, Vec3i32 offset) {
+    // only where `other` has leaves can anything change
+    const auto [lo, hi] = other.leafBounds();
+    applyFrom(other.root.get(), nullptr, depth, Vec3u32(0), csgArgs(CsgOp::Merge, offset));
+    notifyEdit(lo + offset, hi + offset);
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::merge(BasicSVO&& other, Vec3i32 offset) {
+    const auto [lo, hi] = other.leafBounds();
+    // the root has no owning slot, but every subtree below it can be moved
+    CsgArgs args = csgArgs(CsgOp::Merge, offset);
+    for (size_t i = 0; i < 8; ++i) {
+        if (auto& child = other.root->children[i]; child != nullptr) {
+            applyFrom(child.get(), &child, depth - 1, childOrigin(Vec3u32(0), i, depth - 1), args);
+        }
+    }
+    other.root = std::make_unique<SVOBranch>();
+    other.counters = SVOCounters{};
+    other.counters.nodes[depth] = 1;
+    other.voxelsStale = false;
+    notifyEdit(lo + offset, hi + offset);
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::subtract(const BasicSVO& other, Vec3i32 offset) {
+    const auto [lo, hi] = other.leafBounds();
+    applyFrom(other.root.get(), nullptr, depth, Vec3u32(0), csgArgs(CsgOp::Subtract, offset));
+    notifyEdit(lo + offset, hi + offset);
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::intersect(const BasicSVO& other, Vec3i32 offset) {
+    // intersecting only removes voxels, all of them within this tree's leaves
+    const auto [lo, hi] = leafBounds();
+    CsgArgs args = csgArgs(CsgOp::Intersect, offset);
+    for (size_t i = 0; i < 8; ++i) {
+        if (root->children[i] == nullptr) {
+            continue;
+        }
+        if (depth + 1 <= args.alignLevel) {
+            // roots line up: only a zero offset keeps anything in range
+            if (offset != Vec3i32(0) || other.root->children[i] == nullptr) {
+                dropSubtree<Leaf, Traits>(root->children[i], depth - 1, counters);
             } else {
-                node = branch->children[octDigit].get();
+                intersectNodes<Leaf, Traits>(root->children[i], other.root->children[i].get(), depth - 1, counters);
             }
         } else {
-            auto* leaf = dynamic_cast<SVOLeaf*>(node);
-            return &leaf->data[octDigit];
+            intersectNode(root->children[i], depth - 1, childOrigin(Vec3u32(0), i, depth - 1), other, args);
         }
     }
-    DEBUG_ASSERT_UNREACHABLE();
+    notifyEdit(lo, hi);
 }
 
-glm::u64 SVO::indexOf(Vec3i32 pos) const {
-    Vec3u32 uPos = glm::uvec3(pos - minIncl());
-    return (static_cast<u64>(uPos.x) << 40) | (static_cast<u64>(uPos.y) << 20) | static_cast<u64>(uPos.z);
+template <typename Payload, size_t MaxDepth>
+typename BasicSVO<Payload, MaxDepth>::CsgArgs BasicSVO<Payload, MaxDepth>::csgArgs(CsgOp op, Vec3i32 offset) {
+    int alignLevel = std::min({
+        std::countr_zero(static_cast<u32>(offset.x)),
+        std::countr_zero(static_cast<u32>(offset.y)),
+        std::countr_zero(static_cast<u32>(offset.z)),
+        static_cast<int>(depth) + 1,
+    });
+    return { op, offset, static_cast<size_t>(alignLevel) };
 }
 
-void SVO::ensureSpace(Vec3i32 pos) {
-    if (u32 lim = boundsTest(pos); lim != 0) {
-        grow(lim);
+template <typename Payload, size_t MaxDepth>
+SVONode* BasicSVO<Payload, MaxDepth>::nodeAt(u64 octreeNodeIndex, size_t level) const {
+    SVONode* node = root.get();
+    for (size_t l = depth; l > level && node != nullptr; --l) {
+        node = static_cast<SVOBranch*>(node)->children[(octreeNodeIndex >> (l * 3)) & 0b111].get();
     }
+    return node;
 }
 
-void SVO::insert(u64 octreeNodeIndex, rgb32_t color) {
-    findOrCreate(octreeNodeIndex) = color;
+template <typename Payload, size_t MaxDepth>
+std::unique_ptr<SVONode>& BasicSVO<Payload, MaxDepth>::slotAt(u64 octreeNodeIndex, size_t level) {
+    SVOBranch* branch = root.get();
+    for (size_t l = depth; l > level + 1; --l) {
+        auto& child = branch->children[(octreeNodeIndex >> (l * 3)) & 0b111];
+        if (child == nullptr) {
+            child = std::make_unique<SVOBranch>();
+            ++counters.nodes[l - 1];
+        }
+        branch = static_cast<SVOBranch*>(child.get());
+    }
+    return branch->children[(octreeNodeIndex >> ((level + 1) * 3)) & 0b111];
 }
 
-void SVO::grow(u32 lim) {
-    while ((1u << depth) <= lim) {
-        growOnce();
-        depth++;
+template <typename Payload, size_t MaxDepth>
+std::unique_ptr<SVONode>* BasicSVO<Payload, MaxDepth>::findSlot(u64 octreeNodeIndex, size_t level) {
+    SVOBranch* branch = root.get();
+    for (size_t l = depth; l > level + 1; --l) {
+        auto& child = branch->children[(octreeNodeIndex >> (l * 3)) & 0b111];
+        if (child == nullptr) {
+            return nullptr;
+        }
+        branch = static_cast<SVOBranch*>(child.get());
     }
+    auto& slot = branch->children[(octreeNodeIndex >> ((level + 1) * 3)) & 0b111];
+    return slot != nullptr ? &slot : nullptr;
 }
 
-void SVO::growOnce() {
-    auto newRoot = std::make_unique<SVOBranch>();
+// Walks `other` (src) top-down until its nodes line up with whole nodes of this tree,
+// then combines the two subtrees structurally. Misaligned leaves fall back to voxels.
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::applyFrom(SVONode* src, std::unique_ptr<SVONode>* srcOwner, size_t level, Vec3u32 srcOrigin, const CsgArgs& args) {
+    if (level + 1 <= args.alignLevel) {
+        Vec3i32 dstOrigin = Vec3i32(srcOrigin) + args.offset;
+        const int32_t extent = 1 << (depth + 1);
+        for (int a = 0; a < 3; ++a) {
+            if (dstOrigin[a] < 0 || dstOrigin[a] >= extent) {
+                return;
+            }
+        }
+        u64 octreeNodeIndex = mortonIndex(Vec3u32(dstOrigin));
+
+        if (level == depth) {
+            auto* srcBranch = static_cast<SVOBranch*>(src);
+            for (size_t i = 0; i < 8; ++i) {
+                if (srcBranch->children[i] == nullptr || (args.op == CsgOp::Subtract && root->children[i] == nullptr)) {
+                    continue;
+                }
+                if (args.op == CsgOp::Merge) {
+                    mergeNodes<Leaf, Traits>(root->children[i], srcBranch->children[i].get(), nullptr, level - 1, counters);
+                } else {
+                    subtractNodes<Leaf, Traits>(root->children[i], srcBranch->children[i].get(), level - 1, counters);
+                }
+            }
+        } else if (args.op == CsgOp::Merge) {
+            mergeNodes<Leaf, Traits>(slotAt(octreeNodeIndex, level), src, srcOwner, level, counters);
+        } else if (auto* slot = findSlot(octreeNodeIndex, level)) {
+            subtractNodes<Leaf, Traits>(*slot, src, level, counters);
+            // subtractNodes prunes what is below the slot; the branches above are ours
+            prune(octreeNodeIndex, level);
+        }
+        return;
+    }
+
+    if (level == 0) {
+        const auto& data = static_cast<const Leaf*>(src)->data;
+        for (uint32_t i = 0; i < 8; ++i) {
+            auto value = Traits::get(data, i);
+            Vec3i32 pos = Vec3i32(srcOrigin + octant(i)) + minIncl() + args.offset;
+            if (Traits::empty(value) || boundsTest(pos) != 0) {
+                continue;
+            }
+            auto octreeNodeIndex = indexOf(pos);
+            if (args.op == CsgOp::Merge) {
+                setVoxel(findOrCreate(octreeNodeIndex), octreeNodeIndex & 0b111, value);
+            } else if (auto* leaf = find(octreeNodeIndex)) {
+                setVoxel(*leaf, octreeNodeIndex & 0b111, {});
+                // as the aligned path does, so the tree doesn't depend on the offset's alignment
+                prune(octreeNodeIndex, 0);
+            }
+        }
+        return;
+    }
+
+    auto* branch = static_cast<SVOBranch*>(src);
     for (size_t i = 0; i < 8; ++i) {
-        if (root->children[i] != nullptr) {
-            newRoot->children[i] = std::move(root->children[i]);
+        if (auto& child = branch->children[i]; child != nullptr) {
+            applyFrom(child.get(), srcOwner != nullptr ? &child : nullptr, level - 1, childOrigin(srcOrigin, i, level - 1), args);
         }
     }
-    root = std::move(newRoot);
 }
 
-uint32_t SVO::boundsTest(Vec3i32 v) const {
-    constexpr auto absForBoundsTest = [](int32_t x) -> uint32_t {
-        return static_cast<uint32_t>(x < 0 ? -x - 1 : x);
-    };
-    static_assert (absForBoundsTest(-5) == 4);
-    u32 max = absForBoundsTest(v[0]) | absForBoundsTest(v[1]) | absForBoundsTest(v[2]);
-    return max >= (1u << depth) ? max : 0;
+// Walks this tree (dst) until its nodes line up with whole nodes of `other`, dropping
+// everything that has no counterpart there.
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::intersectNode(std::unique_ptr<SVONode>& dst, size_t level, Vec3u32 dstOrigin, const BasicSVO& other, const CsgArgs& args) {
+    if (level + 1 <= args.alignLevel) {
+        Vec3i32 srcOrigin = Vec3i32(dstOrigin) - args.offset;
+        const int32_t extent = 1 << (depth + 1);
+        for (int a = 0; a < 3; ++a) {
+            if (srcOrigin[a] < 0 || srcOrigin[a] >= extent) {
+                dropSubtree<Leaf, Traits>(dst, level, counters);
+                return;
+            }
+        }
+        if (const SVONode* src = other.nodeAt(mortonIndex(Vec3u32(srcOrigin)), level)) {
+            intersectNodes<Leaf, Traits>(dst, src, level, counters);
+        } else {
+            dropSubtree<Leaf, Traits>(dst, level, counters);
+        }
+        return;
+    }
+
+    if (level == 0) {
+        auto* leaf = static_cast<Leaf*>(dst.get());
+        for (uint32_t i = 0; i < 8; ++i) {
+            if (Traits::empty(Traits::get(leaf->data, i))) {
+                continue;
+            }
+            Vec3i32 pos = Vec3i32(dstOrigin + octant(i)) + minIncl() - args.offset;
+            if (Traits::empty(other.get(pos))) {
+                setVoxel(*leaf, i, {});
+            }
+        }
+        if (leafEmpty<Traits>(*leaf)) {
+            dropSubtree<Leaf, Traits>(dst, level, counters);
+        }
+        return;
+    }
+
+    auto* branch = static_cast<SVOBranch*>(dst.get());
+    for (size_t i = 0; i < 8; ++i) {
+        if (branch->children[i] != nullptr) {
+            intersectNode(branch->children[i], level - 1, childOrigin(dstOrigin, i, level - 1), other, args);
+        }
+    }
+    if (branchEmpty(*branch)) {
+        dropSubtree<Leaf, Traits>(dst, level, counters);
+    }
 }
 
+template <typename Payload, size_t MaxDepth>
+SVOStats BasicSVO<Payload, MaxDepth>::stats(bool recompute) const {
+    if (recompute || voxelsStale) {
+        SVOCounters walked;
+        countSubtree<Leaf, Traits>(root.get(), depth, walked, 1);
+        if (recompute) {
+            counters = walked;
+        } else {
+            counters.voxels = walked.voxels;
+        }
+        voxelsStale = false;
+    }
 
-void SVO::flatten(std::vector<uint32_t>& buffer) const {
+    SVOStats stats;
+    stats.depth = depth;
+    stats.minIncl = minIncl();
+    stats.maxIncl = maxIncl();
+    stats.nodesPerLevel.assign(counters.nodes.begin(), counters.nodes.begin() + depth + 1);
+    stats.leaves = counters.nodes[0];
+    for (size_t l = 1; l <= depth; ++l) {
+        stats.branches += counters.nodes[l];
+    }
+    stats.voxels = counters.voxels;
+    stats.branchBytes = stats.branches * sizeof(SVOBranch);
+    stats.leafBytes = stats.leaves * sizeof(Leaf);
+    stats.payloadBytes = stats.leaves * sizeof(typename Traits::Storage);
+    return stats;
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::flatten(std::vector<uint32_t>& buffer) const {
     uint32_t index = 0;
-    flattenNode(root.get(), buffer, index);
+    flattenNode(root.get(), depth, buffer, index);
 }
 
-void SVO::flattenNode(const SVONode* node, std::vector<uint32_t>& buffer, uint32_t& index) const {
-    if (auto branch = dynamic_cast<const SVOBranch*>(node)) {
+template <typename Payload, size_t MaxDepth>
+void BasicSVO<Payload, MaxDepth>::flattenNode(const SVONode* node, size_t level, std::vector<uint32_t>& buffer, uint32_t& index) const {
+    if (level > 0) {
+        auto* branch = static_cast<const SVOBranch*>(node);
         uint32_t nodeIndex = index++;
         buffer.push_back(BRANCH_NODE | nodeIndex);
 
-        uint32_t childrenIndices[8] = { 0 };
-
+        // child offsets come first so a traversal can find them from the header
+        const size_t children = buffer.size();
+        buffer.resize(children + 8, 0);
         for (size_t i = 0; i < 8; ++i) {
             if (branch->children[i]) {
-                childrenIndices[i] = index;
-                // std::cout << "Flattening child " << i << " at index " << index << std::endl;
-                flattenNode(branch->children[i].get(), buffer, index);
+                buffer[children + i] = static_cast<uint32_t>(buffer.size());
+                flattenNode(branch->children[i].get(), level - 1, buffer, index);
             }
         }
-
-        for (size_t i = 0; i < 8; ++i) {
-            // std::cout << "Pushing back child index " << childrenIndices[i] << std::endl;
-            buffer.push_back(childrenIndices[i]);
-        }
-    } else if (auto leaf = dynamic_cast<const SVOLeaf*>(node)) {
+    } else {
+        auto* leaf = static_cast<const Leaf*>(node);
         uint32_t nodeIndex = index++;
         buffer.push_back(LEAF_NODE | nodeIndex);
-        // std::cout << "Flattening leaf at index " << nodeIndex << std::endl;
-        for (const auto& voxel : leaf->data) {
-            buffer.push_back(voxel.r);
-            buffer.push_back(voxel.g);
-            buffer.push_back(voxel.b);
-            buffer.push_back(voxel.a);
-            // std::cout << "Pushing back voxel color " << voxel.r << ", " << voxel.g << ", " << voxel.b << ", " << voxel.a << std::endl;
-        }
-    }
-    // preint the contents of the buffer
-    // for (size_t i = 0; i < buffer.size(); ++i) {
-    //     uint32_t nodeType = buffer[i] & NODE_TYPE_MASK;
-    //     if (nodeType == BRANCH_NODE) {
-    //         std::cout << "Buffer[" << i << "] = BRANCH_NODE" << std::endl;
-    //     } else if (nodeType == LEAF_NODE) {
-    //         std::cout << "Buffer[" << i << "] = LEAF_NODE" << std::endl;
-    //     } else {
-    //         std::cout << "Buffer[" << i << "] = " << buffer[i] << std::endl;
-    //     }
-    // }
+        Traits::flatten(leaf->data, buffer);
+    }
 }
 
+template <typename Payload, size_t MaxDepth>
+BasicSVOWindow<Payload, MaxDepth>::BasicSVOWindow(const BasicSVO<Payload, MaxDepth>& svo, Vec3i32 center) : svo(svo) {
+    moveTo(center);
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVOWindow<Payload, MaxDepth>::moveTo(Vec3i32 center) {
+    m_center = center;
+    svo.findAround(cache, center, windowOffsets, cells.data());
+}
+
+template <typename Payload, size_t MaxDepth>
+void BasicSVOWindow<Payload, MaxDepth>::step(int axis, int dir) {
+    ALWAYS_ASSERT(axis >= 0 && axis < 3 && (dir == 1 || dir == -1));
+    const int strides[3] = { 9, 3, 1 };
+    const int stride = strides[axis];
+
+    // shift the two overlapping slabs towards the trailing side
+    std::array<const Payload*, 27> shifted{};
+    std::array<Vec3i32, 9> leading;
+    size_t leadingCount = 0;
+    for (int i = 0; i < 27; ++i) {
+        int coord = windowOffsets[i][axis] + dir;
+        if (coord >= -1 && coord <= 1) {
+            shifted[i] = cells[i + dir * stride];
+        } else {
+            leading[leadingCount++] = windowOffsets[i];
+        }
+    }
+
+    m_center[axis] += dir;
+    std::array<const Payload*, 9> fetched;
+    svo.findAround(cache, m_center, leading, fetched.data());
+
+    leadingCount = 0;
+    for (int i = 0; i < 27; ++i) {
+        if (windowOffsets[i][axis] == dir) {
+            shifted[i] = fetched[leadingCount++];
+        }
+    }
+    cells = shifted;
+}
+
+template class BasicSVO<rgb32_t, 16>;
+template class BasicSVO<material_t, 16>;
+template class BasicSVO<density_t, 16>;
+template class BasicSVO<occupancy_t, 16>;
+
+template class BasicSVOWindow<rgb32_t, 16>;
+template class BasicSVOWindow<material_t, 16>;
+template class BasicSVOWindow<density_t, 16>;
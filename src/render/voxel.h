@@ -1,11 +1,20 @@
 #pragma once
 
 #include <array>
+#include <bit>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <span>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <glm/glm.hpp>
 
 using rgb32_t = glm::uvec4; // Assuming a 32-bit RGBA color
+using material_t = uint16_t; // index into a material table
+using density_t = float;     // density / distance sample
+using occupancy_t = bool;    // 1-bit solid or empty
 using Vec3i32 = glm::ivec3;
 using Vec3u32 = glm::uvec3;
 
@@ -14,6 +23,48 @@ constexpr uint32_t BRANCH_NODE = 0x40000000;
 constexpr uint32_t NODE_TYPE_MASK = 0xC0000000;
 constexpr uint32_t INDEX_MASK = 0x3FFFFFFF;
 
+// Storage of the eight voxels of a leaf. Payloads are kept as a plain array, except
+// 1-bit occupancy which packs a whole leaf into one byte. Packed voxels can't be
+// referenced, so the SVO accessors returning references or pointers are unavailable for them.
+template <typename Payload>
+struct LeafTraits {
+    using Storage = std::array<Payload, 8>;
+    static constexpr bool packed = false;
+
+    static Payload get(const Storage& data, uint32_t i) { return data[i]; }
+    static void set(Storage& data, uint32_t i, Payload value) { data[i] = value; }
+    static bool empty(const Payload& value) { return value == Payload{}; }
+
+    static void flatten(const Storage& data, std::vector<uint32_t>& buffer) {
+        for (const auto& voxel : data) {
+            if constexpr (std::is_same_v<Payload, rgb32_t>) {
+                buffer.push_back(voxel.r);
+                buffer.push_back(voxel.g);
+                buffer.push_back(voxel.b);
+                buffer.push_back(voxel.a);
+            } else if constexpr (std::is_floating_point_v<Payload>) {
+                buffer.push_back(std::bit_cast<uint32_t>(static_cast<float>(voxel)));
+            } else {
+                buffer.push_back(static_cast<uint32_t>(voxel));
+            }
+        }
+    }
+};
+
+template <>
+struct LeafTraits<occupancy_t> {
+    using Storage = uint8_t;
+    static constexpr bool packed = true;
+
+    static bool get(Storage data, uint32_t i) { return (data >> i) & 1; }
+    static void set(Storage& data, uint32_t i, bool value) {
+        data = value ? data | (1u << i) : data & ~(1u << i);
+    }
+    static bool empty(bool value) { return !value; }
+
+    static void flatten(Storage data, std::vector<uint32_t>& buffer) { buffer.push_back(data); }
+};
+
 struct SVONode {
     virtual ~SVONode() = default;
     virtual std::unique_ptr<SVONode> clone() const = 0;
@@ -30,51 +81,318 @@ struct SVOBranch : public SVONode {
     std::unique_ptr<SVONode> clone() const override;
 };
 
+template <typename Payload>
 struct SVOLeaf : public SVONode {
-    std::array<rgb32_t, 8> data{};
+    typename LeafTraits<Payload>::Storage data{};
 
     SVOLeaf() = default;
     SVOLeaf(const SVOLeaf& other) = default;
     SVOLeaf& operator=(const SVOLeaf& other) = default;
     ~SVOLeaf() final = default;
 
-    std::unique_ptr<SVONode> clone() const override;
+    std::unique_ptr<SVONode> clone() const override { return std::make_unique<SVOLeaf>(*this); }
+};
+
+// Running node and voxel totals, kept up to date by every BasicSVO edit.
+struct SVOCounters {
+    std::array<size_t, 21> nodes{}; // per level, 0 being leaves; sized for the deepest tree
+    size_t voxels = 0;               // non-empty voxels
 };
 
-class SVO {
+// Snapshot returned by BasicSVO::stats(). Byte counts are the node objects themselves,
+// without allocator overhead.
+struct SVOStats {
+    size_t depth = 0;
+    Vec3i32 minIncl = Vec3i32(0);
+    Vec3i32 maxIncl = Vec3i32(0);
+    std::vector<size_t> nodesPerLevel; // [0] is leaves, [depth] the root
+    size_t branches = 0;
+    size_t leaves = 0;
+    size_t voxels = 0;
+    size_t branchBytes = 0;
+    size_t leafBytes = 0;
+    size_t payloadBytes = 0; // the voxel storage inside leafBytes
+
+    double fillRatio() const { return leaves ? double(voxels) / double(leaves * 8) : 0.0; }
+    size_t totalBytes() const { return branchBytes + leafBytes; }
+};
+
+template <typename Payload, size_t MaxDepth>
+class BasicSVOWindow;
+
+// Sparse voxel octree over `Payload` spanning [-2^MaxDepth, 2^MaxDepth) on every axis.
+// The depth is fixed at compile time so root-to-leaf walks are unrolled per level.
+// Instantiations are provided in voxel.cpp for each payload type above at depth 16.
+template <typename Payload, size_t MaxDepth>
+class BasicSVO {
+    friend class BasicSVOWindow<Payload, MaxDepth>;
+    static_assert(MaxDepth >= 1 && MaxDepth <= 20, "octree index must fit in 64 bits");
+
 private:
     using i32 = int32_t;
     using u32 = uint32_t;
     using u64 = uint64_t;
+    using Traits = LeafTraits<Payload>;
+    using Leaf = SVOLeaf<Payload>;
+
+    static constexpr bool referenceable = !Traits::packed;
 
     std::unique_ptr<SVOBranch> root = std::make_unique<SVOBranch>();
-    size_t depth = 16;
+    // Writes through the non-const reference accessors can't be seen, so they mark the
+    // voxel count stale and the next stats() recounts it; updateBatch counts its own.
+    mutable SVOCounters counters = [] {
+        SVOCounters c;
+        c.nodes[MaxDepth] = 1;
+        return c;
+    }();
+    mutable bool voxelsStale = false;
+    std::vector<std::function<void(Vec3i32, Vec3i32)>> editListeners;
 
 public:
-    SVO() = default;
+    using payload_type = Payload;
+    static constexpr size_t depth = MaxDepth;
+
+    BasicSVO() = default;
 
-    void insert(Vec3i32 pos, rgb32_t color);
+    void insert(Vec3i32 pos, Payload value);
+    // Inserts values[i] at positions[i]. Positions are visited in Morton order so that
+    // consecutive inserts share their path; when a position repeats the later value wins.
+    void insertBatch(std::span<const Vec3i32> positions, std::span<const Payload> values);
+    // Value at pos, or a default constructed payload if the voxel was never written.
+    Payload get(Vec3i32 pos) const;
 
     Vec3i32 minIncl() const;
     Vec3i32 maxIncl() const;
     Vec3i32 minExcl() const;
     Vec3i32 maxExcl() const;
 
-    rgb32_t& operator[](Vec3i32 pos);
-    rgb32_t& at(Vec3i32 pos);
-    const rgb32_t& at(Vec3i32 pos) const;
+    Payload& operator[](Vec3i32 pos) requires referenceable;
+    Payload& at(Vec3i32 pos) requires referenceable;
+    const Payload& at(Vec3i32 pos) const requires referenceable;
+
+    // Batched point lookup. Queries are visited in Morton order so that consecutive
+    // lookups only re-walk the part of the path below their deepest shared ancestor.
+    // results[i] receives the voxel at positions[i]; the asserting variants abort on
+    // a miss, the try variants write nullptr and return the number of hits.
+    void lookupBatch(std::span<const Vec3i32> positions, std::span<Payload*> results) requires referenceable;
+    void lookupBatch(std::span<const Vec3i32> positions, std::span<const Payload*> results) const requires referenceable;
+    size_t tryLookupBatch(std::span<const Vec3i32> positions, std::span<Payload*> results) requires referenceable;
+    size_t tryLookupBatch(std::span<const Vec3i32> positions, std::span<const Payload*> results) const requires referenceable;
+    // Batched read-modify-write: calls fn(i, voxel) for every positions[i] that is in the
+    // tree, in the same order as lookupBatch, and returns the number of hits. Unlike the
+    // reference accessors it keeps the voxel count, so stats() stays O(depth) afterwards;
+    // like them it doesn't notify edit listeners.
+    template <typename Fn>
+    size_t updateBatch(std::span<const Vec3i32> positions, Fn&& fn) requires referenceable;
+
+    // Neighbourhood queries. The centre path is walked once and every neighbour descends
+    // from its deepest common ancestor with the centre. Missing voxels are nullptr.
+    // neighbors6 is ordered -x, +x, -y, +y, -z, +z; neighbors26 iterates dx, dy, dz
+    // over -1..1 (dz fastest) skipping the centre.
+    std::array<const Payload*, 6> neighbors6(Vec3i32 pos) const requires referenceable;
+    std::array<const Payload*, 26> neighbors26(Vec3i32 pos) const requires referenceable;
+
+    // Structural CSG with `other` translated by `offset`. Voxels holding a default
+    // constructed payload count as empty. Wherever the offset lines a node of `other` up
+    // with a node of this tree, whole subtrees are reused (merge) or dropped (intersect)
+    // and only subtrees present in both trees are descended; the rvalue merge moves
+    // subtrees instead of cloning them. Parts of `other` outside these bounds are ignored.
+    void merge(const BasicSVO& other, Vec3i32 offset = Vec3i32(0));
+    // Leaves `other` empty.
+    void merge(BasicSVO&& other, Vec3i32 offset = Vec3i32(0));
+    void subtract(const BasicSVO& other, Vec3i32 offset = Vec3i32(0));
+    void intersect(const BasicSVO& other, Vec3i32 offset = Vec3i32(0));
 
-    // New method to flatten the SVO for SSBO
+    // Calls fn(pos, value) for every non-empty voxel in [lo, hi] in Morton order,
+    // skipping subtrees that don't intersect the range.
+    template <typename Fn>
+    void forEach(Vec3i32 lo, Vec3i32 hi, Fn&& fn) const;
+
+    // Calls fn(ordinal, origin) for every leaf in the order flatten() writes them, where
+    // ordinal is the one in the leaf's header and origin its lowest voxel. For side tables
+    // the GPU looks up by ordinal.
+    template <typename Fn>
+    void forEachLeaf(Fn&& fn) const;
+
+    // Calls listener(lo, hi) with the inclusive bounds of every edit made through insert,
+    // insertBatch and the CSG operations, so data derived from the tree (lighting, AO) can
+    // update just that region. Writes through the reference accessors aren't reported.
+    // Listeners stay with the tree object: moving a tree in replaces them.
+    void addEditListener(std::function<void(Vec3i32 lo, Vec3i32 hi)> listener);
+
+    // Node counts, fill and memory use from the running counters, in O(depth). With
+    // `recompute` the whole tree is walked instead, e.g. to check the counters.
+    SVOStats stats(bool recompute = false) const;
+
+    // Serialises the tree for the GPU in pre-order. A branch is BRANCH_NODE | ordinal
+    // followed by the buffer offsets of its 8 children (0 where absent); a leaf is
+    // LEAF_NODE | ordinal followed by its 8 voxels as Traits::flatten writes them. Ordinals
+    // count nodes in the order they are written. The root is at offset 0.
     void flatten(std::vector<uint32_t>& buffer) const;
 
 private:
-    rgb32_t& findOrCreate(u64 octreeNodeIndex);
-    rgb32_t* find(u64 octreeNodeIndex) const;
+    // Cached root-to-leaf path. nodes[l] consumes the octal digit of level l (nodes[0] is
+    // the leaf); entries at or above validLevel are ancestors of `index`.
+    struct PathCache {
+        std::array<SVONode*, MaxDepth + 1> nodes{};
+        u64 index = 0;
+        size_t validLevel = SIZE_MAX;
+    };
+
+    enum class CsgOp { Merge, Subtract, Intersect };
+
+    // offset is a multiple of the size of every node at or below level alignLevel - 1
+    struct CsgArgs {
+        CsgOp op;
+        Vec3i32 offset;
+        size_t alignLevel;
+    };
+
+    Leaf& findOrCreate(u64 octreeNodeIndex);
+    Leaf* find(u64 octreeNodeIndex) const;
+    size_t findBatch(std::span<const Vec3i32> positions, Payload** results) const requires referenceable;
+    Leaf* seek(PathCache& cache, u64 octreeNodeIndex) const;
+    Leaf& seekOrCreate(PathCache& cache, u64 octreeNodeIndex);
+    Leaf* descend(SVONode* node, size_t level, u64 octreeNodeIndex) const;
+    void findAround(PathCache& cache, Vec3i32 center, std::span<const Vec3i32> offsets, const Payload** results) const requires referenceable;
+    SVONode* nodeAt(u64 octreeNodeIndex, size_t level) const;
+    std::unique_ptr<SVONode>& slotAt(u64 octreeNodeIndex, size_t level);
+    std::unique_ptr<SVONode>* findSlot(u64 octreeNodeIndex, size_t level);
+    void applyFrom(SVONode* src, std::unique_ptr<SVONode>* srcOwner, size_t level, Vec3u32 srcOrigin, const CsgArgs& args);
+    void intersectNode(std::unique_ptr<SVONode>& dst, size_t level, Vec3u32 dstOrigin, const BasicSVO& other, const CsgArgs& args);
+    // Inclusive bounds of the leaves, lo > hi when the tree is empty
+    std::pair<Vec3i32, Vec3i32> leafBounds() const;
+    // Drops the node at `level` on octreeNodeIndex's path if it is empty, then every
+    // ancestor that leaves empty
+    void prune(u64 octreeNodeIndex, size_t level);
+    static CsgArgs csgArgs(CsgOp op, Vec3i32 offset);
+    void setVoxel(Leaf& leaf, u32 i, Payload value);
     u64 indexOf(Vec3i32 pos) const;
-    void ensureSpace(Vec3i32 pos);
-    void insert(u64 octreeNodeIndex, rgb32_t color);
-    void grow(u32 lim);
-    void growOnce();
     uint32_t boundsTest(Vec3i32 v) const;
-    void flattenNode(const SVONode* node, std::vector<uint32_t>& buffer, uint32_t& index) const;
+    void flattenNode(const SVONode* node, size_t level, std::vector<uint32_t>& buffer, uint32_t& index) const;
+    void notifyEdit(Vec3i32 lo, Vec3i32 hi) const;
+};
+
+template <typename Payload, size_t MaxDepth>
+template <typename Fn>
+void BasicSVO<Payload, MaxDepth>::forEach(Vec3i32 lo, Vec3i32 hi, Fn&& fn) const {
+    lo = glm::max(lo, minIncl());
+    hi = glm::min(hi, maxIncl());
+    if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z) {
+        return;
+    }
+    const Vec3u32 uLo = Vec3u32(lo - minIncl());
+    const Vec3u32 uHi = Vec3u32(hi - minIncl());
+    const auto overlaps = [&](Vec3u32 origin, u32 size) {
+        for (int a = 0; a < 3; ++a) {
+            if (origin[a] > uHi[a] || origin[a] + (size - 1) < uLo[a]) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    struct Entry {
+        const SVONode* node;
+        size_t level;
+        Vec3u32 origin;
+    };
+    std::vector<Entry> stack;
+    stack.push_back({ root.get(), depth, Vec3u32(0) });
+    while (!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+        if (entry.level == 0) {
+            const auto& data = static_cast<const Leaf*>(entry.node)->data;
+            for (u32 i = 0; i < 8; ++i) {
+                Vec3u32 p = entry.origin + Vec3u32((i >> 2) & 1, (i >> 1) & 1, i & 1);
+                Payload value = Traits::get(data, i);
+                if (!Traits::empty(value) && overlaps(p, 1)) {
+                    fn(Vec3i32(p) + minIncl(), value);
+                }
+            }
+            continue;
+        }
+        // children are pushed in reverse so they come off the stack in Morton order
+        const u32 childSize = 1u << entry.level;
+        const auto* branch = static_cast<const SVOBranch*>(entry.node);
+        for (int i = 7; i >= 0; --i) {
+            Vec3u32 origin = entry.origin + Vec3u32((i >> 2) & 1, (i >> 1) & 1, i & 1) * childSize;
+            if (branch->children[i] != nullptr && overlaps(origin, childSize)) {
+                stack.push_back({ branch->children[i].get(), entry.level - 1, origin });
+            }
+        }
+    }
+}
+
+template <typename Payload, size_t MaxDepth>
+template <typename Fn>
+size_t BasicSVO<Payload, MaxDepth>::updateBatch(std::span<const Vec3i32> positions, Fn&& fn) requires referenceable {
+    std::vector<Payload*> voxels(positions.size());
+    const size_t found = findBatch(positions, voxels.data());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        if (Payload* voxel = voxels[i]) {
+            const bool wasEmpty = Traits::empty(*voxel);
+            fn(i, *voxel);
+            counters.voxels += size_t(wasEmpty) - size_t(Traits::empty(*voxel));
+        }
+    }
+    return found;
+}
+
+template <typename Payload, size_t MaxDepth>
+template <typename Fn>
+void BasicSVO<Payload, MaxDepth>::forEachLeaf(Fn&& fn) const {
+    struct Entry {
+        const SVONode* node;
+        size_t level;
+        Vec3u32 origin;
+    };
+    // pre-order with children in slot order, counting branches too, as flattenNode does
+    std::vector<Entry> stack;
+    stack.push_back({ root.get(), depth, Vec3u32(0) });
+    uint32_t ordinal = 0;
+    while (!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+        const uint32_t nodeOrdinal = ordinal++;
+        if (entry.level == 0) {
+            fn(nodeOrdinal, Vec3i32(entry.origin) + minIncl());
+            continue;
+        }
+        const u32 childSize = 1u << entry.level;
+        const auto* branch = static_cast<const SVOBranch*>(entry.node);
+        for (int i = 7; i >= 0; --i) {
+            if (branch->children[i] != nullptr) {
+                stack.push_back({ branch->children[i].get(), entry.level - 1, entry.origin + Vec3u32((i >> 2) & 1, (i >> 1) & 1, i & 1) * childSize });
+            }
+        }
+    }
+}
+
+// 3x3x3 window of voxels around a centre. Sliding by one voxel keeps the 18 overlapping
+// cells and only looks up the 9 on the leading face, starting from the cached centre path.
+// Structural edits to the SVO (removing nodes) invalidate the window; call moveTo again.
+template <typename Payload, size_t MaxDepth>
+class BasicSVOWindow {
+    static_assert(!LeafTraits<Payload>::packed, "windows hold pointers to voxels");
+
+public:
+    BasicSVOWindow(const BasicSVO<Payload, MaxDepth>& svo, Vec3i32 center);
+
+    void moveTo(Vec3i32 center);
+    void step(int axis, int dir);
+
+    Vec3i32 center() const { return m_center; }
+    // dx, dy, dz in -1..1
+    const Payload* operator()(int dx, int dy, int dz) const { return cells[(dx + 1) * 9 + (dy + 1) * 3 + (dz + 1)]; }
+
+private:
+    const BasicSVO<Payload, MaxDepth>& svo;
+    typename BasicSVO<Payload, MaxDepth>::PathCache cache;
+    Vec3i32 m_center;
+    std::array<const Payload*, 27> cells{};
 };
+
+using SVO = BasicSVO<rgb32_t, 16>;
+using SVOWindow = BasicSVOWindow<rgb32_t, 16>;
@@ -0,0 +1,46 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+TimingSummary summarizeTimings(std::span<const float> ms) {
+    TimingSummary summary;
+    if (ms.empty()) {
+        return summary;
+    }
+    std::vector<float> sorted(ms.begin(), ms.end());
+    std::sort(sorted.begin(), sorted.end());
+    summary.mean = float(std::accumulate(sorted.begin(), sorted.end(), 0.0) / double(sorted.size()));
+    summary.p99 = sorted[std::min(sorted.size() - 1, size_t(0.99 * double(sorted.size())))];
+    summary.worst = sorted.back();
+    return summary;
+}
+
+bool writeBenchmark(const std::string &filepath, std::span<const FrameTiming> frames) {
+    std::ofstream out(filepath);
+    if (!out) {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        return false;
+    }
+    std::vector<float> cpu, gpu;
+    for (const FrameTiming &frame : frames) {
+        cpu.push_back(frame.cpuMs);
+        gpu.push_back(frame.gpuMs);
+    }
+    const auto summary = [&](const char *name, const TimingSummary &s) {
+        out << "\"" << name << "\":{\"mean\":" << s.mean << ",\"p99\":" << s.p99 << ",\"worst\":" << s.worst << "}";
+    };
+    out << "{\"frames\":" << frames.size() << ",";
+    summary("cpu", summarizeTimings(cpu));
+    out << ",";
+    summary("gpu", summarizeTimings(gpu));
+    out << ",\"perFrame\":[";
+    for (size_t i = 0; i < frames.size(); ++i) {
+        out << (i > 0 ? ",\n" : "\n") << "[" << frames[i].cpuMs << "," << frames[i].gpuMs << "]";
+    }
+    out << "]}\n";
+    return bool(out);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <span>
+#include <string>
+
+// Results of a replayed camera path: per-frame timings and a summary of each, written as
+// JSON so runs of different builds can be compared by a script.
+struct FrameTiming {
+    float cpuMs; // from the start of the frame until it was submitted
+    float gpuMs; // GpuTimer::lastFrameMs for the frame
+};
+
+struct TimingSummary {
+    float mean = 0.0f;
+    float p99 = 0.0f;
+    float worst = 0.0f;
+};
+
+TimingSummary summarizeTimings(std::span<const float> ms);
+
+// Writes {"frames", "cpu": summary, "gpu": summary, "perFrame": [[cpu, gpu], ...]}.
+bool writeBenchmark(const std::string &filepath, std::span<const FrameTiming> frames);
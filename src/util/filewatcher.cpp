@@ -0,0 +1,79 @@
+#include "filewatcher.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher(const std::string &directory) : m_directory(directory) {
+#ifdef __linux__
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        std::cerr << "Failed to initialize inotify, not watching " << directory << std::endl;
+        return;
+    }
+    // editors either rewrite in place or write a temporary and rename it over the file
+    if (inotify_add_watch(m_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        std::cerr << "Failed to watch directory: " << directory << std::endl;
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    m_thread = std::thread([this] { run(); });
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+    m_stop.store(true, std::memory_order_relaxed);
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+#ifdef __linux__
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+#endif
+}
+
+bool FileWatcher::poll(std::vector<std::string> &changed) {
+    std::lock_guard lock(m_mutex);
+    if (m_changed.empty()) {
+        return false;
+    }
+    changed = std::move(m_changed);
+    m_changed.clear();
+    return true;
+}
+
+void FileWatcher::run() {
+#ifdef __linux__
+    alignas(inotify_event) char buffer[4096];
+    while (!m_stop.load(std::memory_order_relaxed)) {
+        // wake up regularly to notice m_stop
+        pollfd descriptor{ m_fd, POLLIN, 0 };
+        if (::poll(&descriptor, 1, 100) <= 0) {
+            continue;
+        }
+        const ssize_t length = read(m_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            continue;
+        }
+        std::lock_guard lock(m_mutex);
+        for (ssize_t offset = 0; offset < length;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += ssize_t(sizeof(inotify_event) + event->len);
+            if (event->len == 0 || (event->mask & IN_ISDIR) != 0) {
+                continue;
+            }
+            std::string path = m_directory + "/" + event->name;
+            if (std::find(m_changed.begin(), m_changed.end(), path) == m_changed.end()) {
+                m_changed.push_back(std::move(path));
+            }
+        }
+    }
+#endif
+}
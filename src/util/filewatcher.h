@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Watches one directory for files being written, created or renamed into it, on a
+// background thread (inotify). The render thread collects the changed paths once per
+// frame with poll(). On platforms without inotify nothing is ever reported.
+class FileWatcher {
+public:
+    explicit FileWatcher(const std::string &directory);
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    // Moves the paths changed since the last call into `changed`, each at most once.
+    // Returns false if nothing changed.
+    bool poll(std::vector<std::string> &changed);
+
+private:
+    std::string m_directory;
+    int m_fd = -1;
+    std::atomic<bool> m_stop{ false };
+    std::mutex m_mutex;
+    std::vector<std::string> m_changed; // guarded by m_mutex
+    std::thread m_thread;
+
+    void run();
+};
@@ -0,0 +1,47 @@
+#include "pacing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+int FixedTimestep::advance(double seconds) {
+    m_accumulator += std::max(seconds, 0.0);
+    int ticks = 0;
+    while (m_accumulator >= m_tick && ticks < m_maxTicks) {
+        m_accumulator -= m_tick;
+        ++ticks;
+    }
+    if (m_accumulator >= m_tick) {
+        m_accumulator = std::fmod(m_accumulator, m_tick);
+    }
+    m_ticks += ticks;
+    return ticks;
+}
+
+void FrameLimiter::wait() {
+    const Clock::time_point start = Clock::now();
+    if (m_targetFps <= 0.0) {
+        m_deadline = start;
+        m_lastWaitMs = 0.0;
+        return;
+    }
+    const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_targetFps));
+    // frames run back to back off the previous deadline, which keeps the average rate
+    // exact; after falling more than a frame behind, pacing restarts from now
+    m_deadline += period;
+    if (m_deadline < start - period) {
+        m_deadline = start;
+    }
+    if (m_deadline - start > m_spinMargin) {
+        const Clock::time_point wake = m_deadline - m_spinMargin;
+        std::this_thread::sleep_until(wake);
+        // keep the margin a little over the worst recent oversleep, decaying slowly
+        const Clock::duration late = Clock::now() - wake;
+        const Clock::duration floor = std::chrono::microseconds(200);
+        m_spinMargin = std::max({ late + late / 2, m_spinMargin - m_spinMargin / 16, floor });
+    }
+    while (Clock::now() < m_deadline) {
+        std::this_thread::yield();
+    }
+    m_lastWaitMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+
+// Fixed-rate simulation clock. Frame times are accumulated and handed out as whole ticks
+// of `tick` seconds, so the simulation advances the same way whatever the frame rate; the
+// remainder is exposed as alpha() for interpolating between the last two ticks.
+class FixedTimestep {
+public:
+    explicit FixedTimestep(double tick = 1.0 / 120.0, int maxTicks = 8) : m_tick(tick), m_maxTicks(maxTicks) {}
+
+    double tick() const { return m_tick; }
+    // Adds a frame's worth of time and returns the number of ticks to run. Capped at
+    // maxTicks, dropping the excess, so a long stall doesn't make the next frames slower
+    // still catching up.
+    int advance(double seconds);
+    // How far past the last tick the current frame is, in [0, 1)
+    double alpha() const { return m_accumulator / m_tick; }
+    // Ticks run since construction
+    long long ticks() const { return m_ticks; }
+
+private:
+    double m_tick;
+    int m_maxTicks;
+    double m_accumulator = 0.0;
+    long long m_ticks = 0;
+};
+
+// Holds frames to a target rate. The wait sleeps until shortly before the deadline and
+// spins the rest, the margin tracking how late sleeps have been waking up, so pacing is
+// accurate to well under a millisecond without burning a core for the whole wait.
+class FrameLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // 0 or less runs uncapped
+    void setTargetFps(double fps) { m_targetFps = fps; }
+    double targetFps() const { return m_targetFps; }
+
+    // Call once per frame, after submitting it; waits out the rest of the frame's budget.
+    void wait();
+    // Time the last wait() held the frame for
+    double lastWaitMs() const { return m_lastWaitMs; }
+
+private:
+    double m_targetFps = 0.0;
+    Clock::time_point m_deadline{};
+    Clock::duration m_spinMargin = std::chrono::milliseconds(1);
+    double m_lastWaitMs = 0.0;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Number of workers parallelFor will use for `threads` (0 picks the hardware concurrency).
+inline unsigned workerCount(unsigned threads = 0) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return threads;
+}
+
+// Runs fn(index, worker) for every index in [0, count) on up to `threads` workers.
+// Indices are handed out one at a time, so uneven items balance themselves; `worker`
+// is in [0, workerCount(threads)) and can be used to pick per-thread scratch state.
+template <typename Fn>
+void parallelFor(size_t count, Fn&& fn, unsigned threads = 0) {
+    unsigned workers = static_cast<unsigned>(std::min<size_t>(workerCount(threads), count));
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            fn(i, 0u);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next{ 0 };
+    auto run = [&](unsigned worker) {
+        for (size_t i = next++; i < count; i = next++) {
+            fn(i, worker);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(workers - 1);
+    for (unsigned w = 1; w < workers; ++w) {
+        pool.emplace_back(run, w);
+    }
+    run(0);
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
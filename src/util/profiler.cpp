@@ -0,0 +1,289 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+namespace profiler {
+
+std::atomic<bool> g_enabled{ false };
+
+namespace {
+
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+constexpr size_t FRAME_HISTORY = 512;
+
+// Single-writer ring of events. The writer never waits; a reader that gets lapped while
+// copying drops the overwritten entries.
+class Track {
+public:
+    static constexpr size_t CAPACITY = 1 << 14;
+
+    Track(std::string name, uint32_t id) : name(std::move(name)), id(id) {}
+
+    void push(const Event &event) {
+        if (events.empty()) {
+            events.resize(CAPACITY); // allocated on first use, most worker threads never record
+        }
+        uint64_t h = head.load(std::memory_order_relaxed);
+        events[h & (CAPACITY - 1)] = event;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    void snapshot(std::vector<Event> &out) const {
+        const uint64_t h = head.load(std::memory_order_acquire);
+        const uint64_t first = h > CAPACITY ? h - CAPACITY : 0;
+        const size_t base = out.size();
+        for (uint64_t i = first; i < h; ++i) {
+            out.push_back(events[i & (CAPACITY - 1)]);
+        }
+        // the writer may be midway through the slot of index `after`, which is the slot of
+        // `after - CAPACITY`, so that one is dropped too
+        const uint64_t after = head.load(std::memory_order_acquire);
+        if (after >= CAPACITY && after - CAPACITY >= first) {
+            const size_t lapped = size_t(std::min(after - CAPACITY - first + 1, h - first));
+            out.erase(out.begin() + ptrdiff_t(base), out.begin() + ptrdiff_t(base + lapped));
+        }
+    }
+
+    std::string name; // guarded by the registry mutex
+    const uint32_t id;
+    bool inUse = true;
+
+private:
+    std::vector<Event> events;
+    std::atomic<uint64_t> head{ 0 };
+};
+
+// Tracks are never freed, so snapshots can run while threads come and go. A thread's
+// track is returned when it exits and handed to the next new thread.
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Track>> tracks;
+
+    Track *acquire() {
+        std::lock_guard lock(mutex);
+        for (auto &track : tracks) {
+            if (!track->inUse && track->name.rfind("Thread ", 0) == 0) {
+                track->inUse = true;
+                return track.get();
+            }
+        }
+        const uint32_t id = uint32_t(tracks.size() + 1);
+        tracks.push_back(std::make_unique<Track>("Thread " + std::to_string(id), id));
+        return tracks.back().get();
+    }
+
+    Track *named(const char *name) {
+        std::lock_guard lock(mutex);
+        for (auto &track : tracks) {
+            if (track->name == name) {
+                return track.get();
+            }
+        }
+        tracks.push_back(std::make_unique<Track>(name, uint32_t(tracks.size() + 1)));
+        return tracks.back().get();
+    }
+
+    void release(Track *track) {
+        std::lock_guard lock(mutex);
+        track->inUse = false;
+    }
+};
+
+Registry &registry() {
+    static Registry instance;
+    return instance;
+}
+
+struct ThreadState {
+    Track *track = nullptr;
+    uint32_t depth = 0;
+
+    Track &get() {
+        if (track == nullptr) {
+            track = registry().acquire();
+        }
+        return *track;
+    }
+
+    ~ThreadState() {
+        if (track != nullptr) {
+            registry().release(track);
+        }
+    }
+};
+
+thread_local ThreadState t_state;
+
+struct Frames {
+    std::mutex mutex;
+    std::vector<float> ms = std::vector<float>(FRAME_HISTORY, 0.0f);
+    size_t count = 0;
+    int64_t previousMark = -1;
+    int64_t lastStart = 0; // bounds of the last complete frame
+    int64_t lastEnd = 0;
+    Track *mainTrack = nullptr;
+};
+
+Frames &frames() {
+    static Frames instance;
+    return instance;
+}
+
+void writeEscaped(std::ostream &out, const std::string &s) {
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\';
+        }
+        out << c;
+    }
+}
+
+} // namespace
+
+void setEnabled(bool enabled) {
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void setThreadName(const char *name) {
+    Track &track = t_state.get();
+    std::lock_guard lock(registry().mutex);
+    track.name = name;
+}
+
+void record(const char *track, const Event &event) {
+    if (enabled()) {
+        registry().named(track)->push(event);
+    }
+}
+
+void frameMark() {
+    const int64_t t = now();
+    Frames &f = frames();
+    std::lock_guard lock(f.mutex);
+    if (f.previousMark >= 0) {
+        f.ms[f.count % FRAME_HISTORY] = float(double(t - f.previousMark) * 1e-6);
+        ++f.count;
+        f.lastStart = f.previousMark;
+        f.lastEnd = t;
+    }
+    f.previousMark = t;
+    f.mainTrack = &t_state.get();
+}
+
+FrameSummary frameSummary() {
+    FrameSummary summary;
+    Frames &f = frames();
+    {
+        std::lock_guard lock(f.mutex);
+        const size_t n = std::min(f.count, FRAME_HISTORY);
+        for (size_t i = f.count - n; i < f.count; ++i) {
+            summary.history.push_back(f.ms[i % FRAME_HISTORY]);
+        }
+    }
+    if (summary.history.empty()) {
+        return summary;
+    }
+    std::vector<float> sorted = summary.history;
+    std::sort(sorted.begin(), sorted.end());
+    const auto percentile = [&](double p) { return sorted[std::min(sorted.size() - 1, size_t(p * double(sorted.size())))]; };
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+    return summary;
+}
+
+void lastFrame(std::vector<Event> &events) {
+    events.clear();
+    Frames &f = frames();
+    Track *track;
+    int64_t start, end;
+    {
+        std::lock_guard lock(f.mutex);
+        track = f.mainTrack;
+        start = f.lastStart;
+        end = f.lastEnd;
+    }
+    if (track == nullptr) {
+        return;
+    }
+    track->snapshot(events);
+    events.erase(std::remove_if(events.begin(), events.end(), [&](const Event &e) { return e.start < start || e.end > end; }), events.end());
+    std::sort(events.begin(), events.end(), [](const Event &a, const Event &b) { return a.start < b.start; });
+}
+
+bool writeChromeTrace(const std::string &filepath) {
+    std::ofstream out(filepath);
+    if (!out) {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        return false;
+    }
+
+    std::vector<std::pair<std::string, uint32_t>> names;
+    std::vector<Track *> tracks;
+    {
+        std::lock_guard lock(registry().mutex);
+        for (auto &track : registry().tracks) {
+            names.emplace_back(track->name, track->id);
+            tracks.push_back(track.get());
+        }
+    }
+
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    const auto separator = [&] {
+        if (!first) {
+            out << ",\n";
+        }
+        first = false;
+    };
+    for (const auto &[name, id] : names) {
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << id << ",\"args\":{\"name\":\"";
+        writeEscaped(out, name);
+        out << "\"}}";
+    }
+
+    std::vector<Event> events;
+    size_t count = 0;
+    for (size_t t = 0; t < tracks.size(); ++t) {
+        events.clear();
+        tracks[t]->snapshot(events);
+        for (const Event &e : events) {
+            separator();
+            out << "{\"name\":\"";
+            writeEscaped(out, e.name);
+            out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << names[t].second << ",\"ts\":" << double(e.start) * 1e-3
+                << ",\"dur\":" << double(e.end - e.start) * 1e-3 << "}";
+        }
+        count += events.size();
+    }
+    out << "\n]}\n";
+
+    std::cout << "Wrote " << count << " profiler events to " << filepath << std::endl;
+    return bool(out);
+}
+
+namespace detail {
+
+uint32_t begin() {
+    return t_state.depth++;
+}
+
+void end(const char *name, int64_t start, uint32_t depth) {
+    t_state.depth = depth;
+    t_state.get().push({ name, start, now(), depth });
+}
+
+} // namespace detail
+
+} // namespace profiler
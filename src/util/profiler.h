@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scoped CPU timers collected into per-thread ring buffers. Each thread only ever writes
+// its own buffer, so recording takes no locks; readers copy a snapshot. While disabled a
+// scope costs one relaxed load and a branch, and building with VOXELS_NO_PROFILER removes
+// the scopes entirely.
+namespace profiler {
+
+// Timestamps are nanoseconds since the profiler's epoch (first use).
+struct Event {
+    const char *name; // must outlive the profiler, in practice a string literal
+    int64_t start;
+    int64_t end;
+    uint32_t depth; // nesting level within its track
+};
+
+extern std::atomic<bool> g_enabled;
+
+inline bool enabled() { return g_enabled.load(std::memory_order_relaxed); }
+void setEnabled(bool enabled);
+
+int64_t now();
+
+// Names the calling thread's track in the UI and in traces.
+void setThreadName(const char *name);
+
+// Records an already timed event on a named track that isn't a thread, e.g. "GPU".
+// Only one thread may record to a given track.
+void record(const char *track, const Event &event);
+
+// Marks the end of a frame on the calling (main) thread. Frame times are kept whether or
+// not scopes are enabled.
+void frameMark();
+
+struct FrameSummary {
+    std::vector<float> history; // frame times in ms, oldest first
+    float p50 = 0.0f;
+    float p95 = 0.0f;
+    float p99 = 0.0f;
+};
+
+FrameSummary frameSummary();
+
+// Events of the main thread's last complete frame, ordered by start time.
+void lastFrame(std::vector<Event> &events);
+
+// Writes every retained event as Chrome trace JSON (chrome://tracing, Perfetto).
+bool writeChromeTrace(const std::string &filepath);
+
+namespace detail {
+uint32_t begin();
+void end(const char *name, int64_t start, uint32_t depth);
+} // namespace detail
+
+class Scope {
+public:
+    explicit Scope(const char *name) : m_name(enabled() ? name : nullptr) {
+        if (m_name != nullptr) {
+            m_depth = detail::begin();
+            m_start = now();
+        }
+    }
+    ~Scope() {
+        if (m_name != nullptr) {
+            detail::end(m_name, m_start, m_depth);
+        }
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    const char *m_name;
+    int64_t m_start = 0;
+    uint32_t m_depth = 0;
+};
+
+} // namespace profiler
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef VOXELS_NO_PROFILER
+#define PROFILE_SCOPE(name) ((void)0)
+#else
+#define PROFILE_SCOPE(name) ::profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#endif
@@ -0,0 +1,104 @@
+#include "loader.h"
+#include "../render/occlusion.h"
+#include "../util/profiler.h"
+
+#include <chrono>
+#include <iostream>
+
+WorldLoader::WorldLoader(const TerrainOptions &options) {
+    m_thread = std::thread([this, options] {
+        profiler::setThreadName("World loader");
+        auto start = std::chrono::steady_clock::now();
+        // generating and baking check m_cancel themselves, flattening only runs if it's clear
+        const auto cancelled = [this] { return m_cancel.load(std::memory_order_relaxed); };
+        {
+            PROFILE_SCOPE("Generate terrain");
+            generateTerrain(m_svo, options, &m_generated, &m_cancel);
+        }
+        if (cancelled()) {
+            return;
+        }
+        m_stage.store(Stage::Occlusion, std::memory_order_release);
+        bakeOcclusion(m_svo, options.threads, &m_cancel);
+        if (cancelled()) {
+            return;
+        }
+        m_stage.store(Stage::Flattening, std::memory_order_release);
+        {
+            PROFILE_SCOPE("Flatten");
+            m_svo.flatten(m_buffer);
+            m_bricks.build(m_svo, options.threads);
+            m_bricks.annotate(m_buffer);
+        }
+        if (cancelled()) {
+            return;
+        }
+        m_stage.store(Stage::Lighting, std::memory_order_release);
+        {
+            PROFILE_SCOPE("Bake lighting");
+            m_lighting.bake(m_svo, m_buffer, &m_lit, &m_cancel);
+            if (cancelled()) {
+                return;
+            }
+            m_lighting.flatten(m_svo, m_lightBuffer);
+        }
+        // publishes the results to the render thread
+        m_stage.store(Stage::Ready, std::memory_order_release);
+        std::cout << "World ready after " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+                  << " s, flattened to " << m_buffer.size() << " words, " << m_bricks.bricks() << " dense bricks" << std::endl;
+    });
+}
+
+WorldLoader::~WorldLoader() {
+    m_cancel.store(true, std::memory_order_relaxed);
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+const char *WorldLoader::status() const {
+    switch (stage()) {
+    case Stage::Generating:
+        return "Generating terrain";
+    case Stage::Occlusion:
+        return "Baking ambient occlusion";
+    case Stage::Flattening:
+        return "Flattening octree";
+    case Stage::Lighting:
+        return "Baking lighting";
+    case Stage::Ready:
+        return m_taken ? "Loaded" : "Uploading";
+    }
+    return "";
+}
+
+float WorldLoader::progress() const {
+    // AO and flattening are a small fraction of the build; lighting takes about as long as
+    // generating
+    switch (stage()) {
+    case Stage::Generating:
+        return 0.45f * m_generated.load(std::memory_order_relaxed);
+    case Stage::Occlusion:
+    case Stage::Flattening:
+        return 0.45f;
+    case Stage::Lighting:
+        return 0.5f + 0.5f * m_lit.load(std::memory_order_relaxed);
+    case Stage::Ready:
+        return 1.0f;
+    }
+    return 0.0f;
+}
+
+bool WorldLoader::take(SVO &svo, std::vector<uint32_t> &buffer, VoxelLighting &lighting, std::vector<uint32_t> &lightBuffer, BrickAtlas &bricks) {
+    if (m_taken || stage() != Stage::Ready) {
+        return false;
+    }
+    m_thread.join();
+    svo = std::move(m_svo);
+    buffer = std::move(m_buffer);
+    lighting = std::move(m_lighting);
+    lightBuffer = std::move(m_lightBuffer);
+    bricks = std::move(m_bricks);
+    m_taken = true;
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "terrain.h"
+#include "../render/lighting.h"
+#include "../render/texture.h"
+
+// Builds, flattens and lights a world (baked AO and brick atlas included) on a worker thread
+// so the window keeps drawing meanwhile.
+// The render thread polls once per frame and takes the result when it is ready. Destroying
+// the loader before then cancels the build and waits for the worker to stop.
+class WorldLoader {
+public:
+    enum class Stage { Generating, Occlusion, Flattening, Lighting, Ready };
+
+    explicit WorldLoader(const TerrainOptions &options);
+    ~WorldLoader();
+
+    WorldLoader(const WorldLoader &) = delete;
+    WorldLoader &operator=(const WorldLoader &) = delete;
+
+    Stage stage() const { return m_stage.load(std::memory_order_acquire); }
+    const char *status() const;
+    // 0 to 1 over the whole load
+    float progress() const;
+
+    // Moves the finished tree, its flattened buffer (brick nodes marked), its lighting and that
+    // flattened, and its bricks out once the stage is Ready. Returns false (leaving the
+    // arguments alone) before that or after a previous take.
+    bool take(SVO &svo, std::vector<uint32_t> &buffer, VoxelLighting &lighting, std::vector<uint32_t> &lightBuffer, BrickAtlas &bricks);
+
+private:
+    std::atomic<Stage> m_stage{ Stage::Generating };
+    std::atomic<float> m_generated{ 0.0f };
+    std::atomic<float> m_lit{ 0.0f };
+    std::atomic<bool> m_cancel{ false };
+    bool m_taken = false;
+    SVO m_svo;
+    std::vector<uint32_t> m_buffer;
+    VoxelLighting m_lighting;
+    std::vector<uint32_t> m_lightBuffer;
+    BrickAtlas m_bricks;
+    std::thread m_thread;
+};
@@ -0,0 +1,88 @@
+#include "obj.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+ObjReader::ObjReader(const std::string &filepath) : file(filepath) {
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        throw std::runtime_error("Failed to open OBJ file: " + filepath);
+    }
+}
+
+bool ObjReader::read(std::vector<ObjTriangle> &triangles, size_t maxTriangles) {
+    triangles.clear();
+    std::string line;
+    while (triangles.size() < maxTriangles && std::getline(file, line)) {
+        lineNumber++;
+        const char *s = line.c_str();
+        while (*s == ' ' || *s == '\t') {
+            s++;
+        }
+        if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+            parseVertex(s + 2);
+        } else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+            parseFace(s + 2, triangles);
+        }
+        // normals, texture coordinates, groups and materials don't affect voxelization
+    }
+    return !triangles.empty();
+}
+
+void ObjReader::parseVertex(const char *s) {
+    char *end = nullptr;
+    float values[6];
+    int count = 0;
+    for (; count < 6; ++count) {
+        values[count] = std::strtof(s, &end);
+        if (end == s) {
+            break;
+        }
+        s = end;
+    }
+    if (count < 3) {
+        std::cerr << "OBJ line " << lineNumber << ": vertex with " << count << " coordinates" << std::endl;
+        values[0] = values[1] = values[2] = 0.0f;
+    }
+    positions.emplace_back(values[0], values[1], values[2]);
+    colors.push_back(count >= 6 ? glm::vec3(values[3], values[4], values[5]) : glm::vec3(1.0f));
+}
+
+void ObjReader::parseFace(const char *s, std::vector<ObjTriangle> &triangles) {
+    // "f v", "f v/vt", "f v//vn" or "f v/vt/vn"; only the position index matters
+    size_t corners[3];
+    size_t count = 0;
+    char *end = nullptr;
+    while (true) {
+        long index = std::strtol(s, &end, 10);
+        if (end == s) {
+            break;
+        }
+        s = end;
+        while (*s != '\0' && *s != ' ' && *s != '\t') {
+            s++;
+        }
+
+        long resolved = index < 0 ? static_cast<long>(positions.size()) + index : index - 1;
+        if (resolved < 0 || resolved >= static_cast<long>(positions.size())) {
+            std::cerr << "OBJ line " << lineNumber << ": vertex index " << index << " out of range" << std::endl;
+            return;
+        }
+
+        // fan triangulation around the first corner
+        if (count < 2) {
+            corners[count] = static_cast<size_t>(resolved);
+        } else {
+            corners[2] = static_cast<size_t>(resolved);
+            ObjTriangle triangle;
+            for (int i = 0; i < 3; ++i) {
+                triangle.positions[i] = positions[corners[i]];
+                triangle.colors[i] = colors[corners[i]];
+            }
+            triangles.push_back(triangle);
+            corners[1] = corners[2];
+        }
+        count++;
+    }
+}
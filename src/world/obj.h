@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct ObjTriangle {
+    std::array<glm::vec3, 3> positions;
+    std::array<glm::vec3, 3> colors; // 0..1, white when the file has no vertex colours
+};
+
+// Streaming Wavefront OBJ reader. Vertices are kept because faces may reference any of
+// them, but faces are triangulated and handed out batch by batch as the file is read.
+// Supports "v x y z [r g b]" vertex colours and negative (relative) face indices.
+class ObjReader {
+public:
+    explicit ObjReader(const std::string &filepath);
+
+    // Clears `triangles` and reads up to maxTriangles triangles into it, plus the rest of
+    // the polygon that reaches the limit, which is never split across batches. Returns
+    // false once the file is exhausted.
+    bool read(std::vector<ObjTriangle> &triangles, size_t maxTriangles);
+
+    size_t vertexCount() const { return positions.size(); }
+
+private:
+    std::ifstream file;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> colors;
+    size_t lineNumber = 0;
+
+    void parseVertex(const char *s);
+    void parseFace(const char *s, std::vector<ObjTriangle> &triangles);
+};
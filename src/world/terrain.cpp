@@ -0,0 +1,314 @@
+#include "terrain.h"
+#include "../util/parallel.h"
+#include "../util/profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// Noise is evaluated LANES points at a time. With GCC/Clang the vector extensions lower
+// to whatever the target has (SSE2, AVX2 or NEON registers); other compilers get the
+// same code one point at a time.
+#if defined(__GNUC__) || defined(__clang__)
+#ifdef __AVX2__
+constexpr int LANES = 8;
+#else
+constexpr int LANES = 4;
+#endif
+using f32xN = float __attribute__((vector_size(4 * LANES)));
+using i32xN = int32_t __attribute__((vector_size(4 * LANES)));
+using u32xN = uint32_t __attribute__((vector_size(4 * LANES)));
+
+inline f32xN toFloat(i32xN v) { return __builtin_convertvector(v, f32xN); }
+inline i32xN floorInt(f32xN v) {
+    i32xN i = __builtin_convertvector(v, i32xN);
+    return i + (v < toFloat(i)); // true lanes are -1 where truncation rounded up
+}
+#else
+constexpr int LANES = 1;
+using f32xN = float;
+using i32xN = int32_t;
+using u32xN = uint32_t;
+
+inline f32xN toFloat(i32xN v) { return float(v); }
+inline i32xN floorInt(f32xN v) { return int32_t(std::floor(v)); }
+#endif
+
+inline f32xN load(const float *p) {
+    f32xN v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void store(float *p, f32xN v) {
+    std::memcpy(p, &v, sizeof(v));
+}
+
+template <typename U>
+U hash(U x, U y, U z, uint32_t seed) {
+    U h = (x * 0x8da6b343u) ^ (y * 0xd8163841u) ^ (z * 0xcb1ab31fu) ^ seed;
+    h = (h ^ (h >> 15)) * 0x2c1b3c6du;
+    h = (h ^ (h >> 12)) * 0x297a2d39u;
+    return h ^ (h >> 15);
+}
+
+// Random value in [-1, 1] at an integer lattice point.
+inline f32xN lattice(i32xN x, i32xN y, i32xN z, uint32_t seed) {
+    u32xN h = hash((u32xN)x, (u32xN)y, (u32xN)z, seed);
+    return toFloat((i32xN)(h >> 8)) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+inline f32xN fade(f32xN t) {
+    return t * t * (3.0f - 2.0f * t);
+}
+
+inline f32xN lerp(f32xN a, f32xN b, f32xN t) {
+    return a + (b - a) * t;
+}
+
+f32xN valueNoise(f32xN x, f32xN y, f32xN z, uint32_t seed) {
+    const i32xN ix = floorInt(x), iy = floorInt(y), iz = floorInt(z);
+    const f32xN tx = fade(x - toFloat(ix)), ty = fade(y - toFloat(iy)), tz = fade(z - toFloat(iz));
+    const i32xN jx = ix + 1, jy = iy + 1, jz = iz + 1;
+
+    f32xN x00 = lerp(lattice(ix, iy, iz, seed), lattice(jx, iy, iz, seed), tx);
+    f32xN x10 = lerp(lattice(ix, jy, iz, seed), lattice(jx, jy, iz, seed), tx);
+    f32xN x01 = lerp(lattice(ix, iy, jz, seed), lattice(jx, iy, jz, seed), tx);
+    f32xN x11 = lerp(lattice(ix, jy, jz, seed), lattice(jx, jy, jz, seed), tx);
+    return lerp(lerp(x00, x10, ty), lerp(x01, x11, ty), tz);
+}
+
+// Fractal sum of `octaves` layers, normalised back into [-1, 1].
+f32xN fbm(f32xN x, f32xN y, f32xN z, uint32_t seed, int octaves) {
+    f32xN sum = {};
+    float amplitude = 1.0f, total = 0.0f;
+    for (int o = 0; o < octaves; ++o) {
+        sum += valueNoise(x, y, z, seed + uint32_t(o) * 0x9e3779b9u) * amplitude;
+        total += amplitude;
+        x *= 2.0f;
+        y *= 2.0f;
+        z *= 2.0f;
+        amplitude *= 0.5f;
+    }
+    return sum * (1.0f / total);
+}
+
+// Scratch state reused by one worker across chunks. Coordinate arrays are padded to a
+// multiple of LANES.
+struct ChunkScratch {
+    std::vector<float> xs, ys, zs;
+    std::vector<float> heights; // (n + 2)^2 columns, including a one voxel border
+    std::vector<float> caves;   // coarse cave field, one sample every CAVE_STEP voxels
+    std::vector<uint8_t> solid; // (n + 2)^3 voxels, including a one voxel border
+    std::vector<Vec3i32> positions;
+    std::vector<rgb32_t> colors;
+};
+
+constexpr int CAVE_STEP = 4;
+
+// Evaluates fbm at every point in scratch.xs/ys/zs into `out`.
+void sampleField(ChunkScratch &scratch, size_t count, std::vector<float> &out, uint32_t seed, int octaves) {
+    const size_t padded = (count + LANES - 1) / LANES * LANES;
+    scratch.xs.resize(padded);
+    scratch.ys.resize(padded);
+    scratch.zs.resize(padded);
+    out.resize(padded);
+    for (size_t i = 0; i < padded; i += LANES) {
+        store(&out[i], fbm(load(&scratch.xs[i]), load(&scratch.ys[i]), load(&scratch.zs[i]), seed, octaves));
+    }
+}
+
+rgb32_t jitter(glm::ivec3 base, Vec3i32 pos, uint32_t chunkSeed) {
+    int offset = int(hash(uint32_t(pos.x), uint32_t(pos.y), uint32_t(pos.z), chunkSeed) % 21u) - 10;
+    glm::ivec3 c = glm::clamp(base + offset, 0, 255);
+    return rgb32_t(uint32_t(c.x), uint32_t(c.y), uint32_t(c.z), 255);
+}
+
+// Generates the chunk at `chunkMin` (size n, clipped to the world) into scratch.positions
+// and scratch.colors.
+void generateChunk(const TerrainOptions &options, Vec3i32 worldMin, Vec3i32 worldMax, Vec3i32 chunkMin,
+                   uint32_t chunkSeed, ChunkScratch &scratch) {
+    const int n = options.chunkSize;
+    const int side = n + 2;
+    scratch.positions.clear();
+    scratch.colors.clear();
+
+    // height field over the chunk's columns plus a one voxel border
+    const size_t columns = size_t(side) * side;
+    scratch.xs.resize(columns);
+    scratch.ys.resize(columns);
+    scratch.zs.resize(columns);
+    for (int x = 0; x < side; ++x) {
+        for (int z = 0; z < side; ++z) {
+            size_t i = size_t(x) * side + z;
+            scratch.xs[i] = float(chunkMin.x + x - 1) * options.frequency;
+            scratch.ys[i] = 0.0f;
+            scratch.zs[i] = float(chunkMin.z + z - 1) * options.frequency;
+        }
+    }
+    sampleField(scratch, columns, scratch.heights, options.seed, options.octaves);
+
+    const float mid = float(worldMin.y) + float(options.size.y) * 0.5f;
+    const float amplitude = float(options.size.y) * options.heightAmplitude;
+    float highest = -1e30f;
+    for (size_t i = 0; i < columns; ++i) {
+        // value noise fbm rarely leaves [-0.5, 0.5], stretch it to use the amplitude
+        scratch.heights[i] = std::clamp(mid + scratch.heights[i] * 2.0f * amplitude, float(worldMin.y + 1), float(worldMax.y));
+        highest = std::max(highest, scratch.heights[i]);
+    }
+    if (float(chunkMin.y - 1) >= highest) {
+        return; // all air, including the border
+    }
+
+    // coarse cave field covering [-CAVE_STEP, n + CAVE_STEP] around the chunk, upsampled
+    // trilinearly below; caves are smooth enough that this is indistinguishable
+    const int caveSide = n / CAVE_STEP + 3;
+    const size_t caveCount = size_t(caveSide) * caveSide * caveSide;
+    scratch.xs.resize(caveCount);
+    scratch.ys.resize(caveCount);
+    scratch.zs.resize(caveCount);
+    for (int x = 0; x < caveSide; ++x) {
+        for (int y = 0; y < caveSide; ++y) {
+            for (int z = 0; z < caveSide; ++z) {
+                size_t i = (size_t(x) * caveSide + y) * caveSide + z;
+                scratch.xs[i] = float(chunkMin.x + (x - 1) * CAVE_STEP) * options.caveFrequency;
+                scratch.ys[i] = float(chunkMin.y + (y - 1) * CAVE_STEP) * options.caveFrequency;
+                scratch.zs[i] = float(chunkMin.z + (z - 1) * CAVE_STEP) * options.caveFrequency;
+            }
+        }
+    }
+    sampleField(scratch, caveCount, scratch.caves, options.seed ^ 0x5bd1e995u, 3);
+
+    auto cave = [&](int lx, int ly, int lz) {
+        float fx = float(lx + CAVE_STEP) / CAVE_STEP, fy = float(ly + CAVE_STEP) / CAVE_STEP, fz = float(lz + CAVE_STEP) / CAVE_STEP;
+        int ix = int(fx), iy = int(fy), iz = int(fz);
+        float tx = fx - ix, ty = fy - iy, tz = fz - iz;
+        auto at = [&](int x, int y, int z) { return scratch.caves[(size_t(x) * caveSide + y) * caveSide + z]; };
+        float x00 = at(ix, iy, iz) + (at(ix + 1, iy, iz) - at(ix, iy, iz)) * tx;
+        float x10 = at(ix, iy + 1, iz) + (at(ix + 1, iy + 1, iz) - at(ix, iy + 1, iz)) * tx;
+        float x01 = at(ix, iy, iz + 1) + (at(ix + 1, iy, iz + 1) - at(ix, iy, iz + 1)) * tx;
+        float x11 = at(ix, iy + 1, iz + 1) + (at(ix + 1, iy + 1, iz + 1) - at(ix, iy + 1, iz + 1)) * tx;
+        float y0 = x00 + (x10 - x00) * ty, y1 = x01 + (x11 - x01) * ty;
+        return y0 + (y1 - y0) * tz;
+    };
+
+    // solid mask over the chunk plus border. Below the world counts as solid so the
+    // bottom is not skinned; beyond the sides and top counts as air.
+    scratch.solid.assign(size_t(side) * side * side, 0);
+    auto solidIndex = [&](int x, int y, int z) { return (size_t(x) * side + y) * side + z; };
+    for (int x = 0; x < side; ++x) {
+        for (int z = 0; z < side; ++z) {
+            const Vec3i32 column(chunkMin.x + x - 1, 0, chunkMin.z + z - 1);
+            if (column.x < worldMin.x || column.x > worldMax.x || column.z < worldMin.z || column.z > worldMax.z) {
+                continue;
+            }
+            const float height = scratch.heights[size_t(x) * side + z];
+            for (int y = 0; y < side; ++y) {
+                const int wy = chunkMin.y + y - 1;
+                bool solid = wy < worldMin.y ||
+                             (float(wy) < height && (wy < worldMin.y + 2 || cave(x - 1, y - 1, z - 1) < options.caveThreshold));
+                scratch.solid[solidIndex(x, y, z)] = solid;
+            }
+        }
+    }
+
+    const int snowLine = worldMin.y + int(float(options.size.y) * 0.72f);
+    const int sandLine = worldMin.y + int(float(options.size.y) * 0.32f);
+    for (int x = 1; x <= n; ++x) {
+        for (int y = 1; y <= n; ++y) {
+            for (int z = 1; z <= n; ++z) {
+                const Vec3i32 pos = chunkMin + Vec3i32(x - 1, y - 1, z - 1);
+                if (!scratch.solid[solidIndex(x, y, z)] || glm::any(glm::greaterThan(pos, worldMax))) {
+                    continue;
+                }
+                const bool top = !scratch.solid[solidIndex(x, y + 1, z)];
+                if (options.hollow && !top && scratch.solid[solidIndex(x, y - 1, z)] &&
+                    scratch.solid[solidIndex(x - 1, y, z)] && scratch.solid[solidIndex(x + 1, y, z)] &&
+                    scratch.solid[solidIndex(x, y, z - 1)] && scratch.solid[solidIndex(x, y, z + 1)]) {
+                    continue;
+                }
+
+                const float depth = scratch.heights[size_t(x) * side + z] - float(pos.y);
+                glm::ivec3 base;
+                if (depth > 4.0f) {
+                    base = glm::ivec3(124, 124, 130); // stone, including cave walls
+                } else if (!top) {
+                    base = glm::ivec3(121, 85, 58); // dirt
+                } else if (pos.y >= snowLine) {
+                    base = glm::ivec3(236, 240, 245);
+                } else if (pos.y < sandLine) {
+                    base = glm::ivec3(212, 196, 140);
+                } else {
+                    base = glm::ivec3(86, 152, 58); // grass
+                }
+                scratch.positions.push_back(pos);
+                scratch.colors.push_back(jitter(base, pos, chunkSeed));
+            }
+        }
+    }
+}
+
+} // namespace
+
+TerrainStats generateTerrain(SVO &svo, const TerrainOptions &options, std::atomic<float> *progress,
+                             const std::atomic<bool> *cancel) {
+    auto start = std::chrono::steady_clock::now();
+    const int n = options.chunkSize;
+    if (n < 2 * CAVE_STEP || (n & (n - 1)) != 0 || glm::any(glm::lessThan(options.size, glm::ivec3(1)))) {
+        std::cerr << "Invalid terrain options: chunk size " << n << " must be a power of two >= " << 2 * CAVE_STEP
+                  << " and the world non-empty" << std::endl;
+        throw std::runtime_error("Invalid terrain options");
+    }
+
+    const Vec3i32 worldMin = -options.size / 2;
+    const Vec3i32 worldMax = worldMin + options.size - 1;
+    const glm::ivec3 chunks = (options.size + n - 1) / n;
+    const size_t chunkCount = size_t(chunks.x) * chunks.y * chunks.z;
+
+    const unsigned workers = workerCount(options.threads);
+    std::vector<SVO> partial(workers);
+    std::vector<ChunkScratch> scratch(workers);
+    std::vector<size_t> voxelCounts(workers, 0);
+    std::atomic<size_t> chunksDone{ 0 };
+
+    const auto cancelled = [cancel] { return cancel != nullptr && cancel->load(std::memory_order_relaxed); };
+    parallelFor(chunkCount, [&](size_t c, unsigned worker) {
+        if (cancelled()) {
+            return;
+        }
+        PROFILE_SCOPE("Terrain chunk");
+        const glm::ivec3 chunk(int(c / (size_t(chunks.y) * chunks.z)), int(c / chunks.z % chunks.y), int(c % chunks.z));
+        // seeded from the chunk coordinate alone, so a chunk comes out the same whichever
+        // worker picks it up
+        const uint32_t chunkSeed = hash(uint32_t(chunk.x), uint32_t(chunk.y), uint32_t(chunk.z), options.seed);
+        ChunkScratch &s = scratch[worker];
+        generateChunk(options, worldMin, worldMax, worldMin + chunk * n, chunkSeed, s);
+        partial[worker].insertBatch(s.positions, s.colors);
+        voxelCounts[worker] += s.positions.size();
+        if (progress != nullptr) {
+            progress->store(float(++chunksDone) / float(chunkCount), std::memory_order_relaxed);
+        }
+    }, workers);
+
+    TerrainStats stats;
+    if (cancelled()) {
+        return stats;
+    }
+    stats.chunks = chunkCount;
+    for (unsigned w = 0; w < workers; ++w) {
+        svo.merge(std::move(partial[w]));
+        stats.voxels += voxelCounts[w];
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Generated terrain " << options.size.x << "x" << options.size.y << "x" << options.size.z << ": "
+              << stats.chunks << " chunks, " << stats.voxels << " voxels in " << stats.seconds << " s on " << workers
+              << " threads" << std::endl;
+    return stats;
+}
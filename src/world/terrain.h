@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "../render/voxel.h"
+
+struct TerrainOptions {
+    uint32_t seed = 1337;
+    glm::ivec3 size = glm::ivec3(256, 64, 256); // centred on the origin
+    int chunkSize = 32;          // power of two, so chunks line up with octree nodes
+    float frequency = 1.0f / 128.0f; // of the height field, per voxel
+    int octaves = 5;
+    float heightAmplitude = 0.35f;   // fraction of size.y
+    float caveFrequency = 1.0f / 24.0f;
+    float caveThreshold = 0.35f;     // fbm above this is carved out
+    bool hollow = true;              // only keep solid voxels with an exposed face
+    unsigned threads = 0;            // 0 picks the hardware concurrency
+
+    // The standard load-test scene: 1024x256x1024 with a fixed seed.
+    static TerrainOptions benchmark() {
+        TerrainOptions options;
+        options.size = glm::ivec3(1024, 256, 1024);
+        return options;
+    }
+};
+
+struct TerrainStats {
+    size_t chunks = 0;
+    size_t voxels = 0;
+    double seconds = 0.0;
+};
+
+// Generates fractal value-noise terrain with caves into `svo`. Chunks are generated in
+// parallel into per-thread trees that are merged in afterwards; the output only depends
+// on the options, never on thread count or scheduling. `progress`, when given, goes from
+// 0 to 1 as chunks complete. Once `cancel` is set the remaining chunks are skipped and
+// `svo` is left as it was.
+TerrainStats generateTerrain(SVO &svo, const TerrainOptions &options = {}, std::atomic<float> *progress = nullptr,
+                             const std::atomic<bool> *cancel = nullptr);
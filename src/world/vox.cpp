@@ -0,0 +1,456 @@
+#include "vox.h"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t chunkId(const char (&id)[5]) {
+    return uint32_t(uint8_t(id[0])) | uint32_t(uint8_t(id[1])) << 8 | uint32_t(uint8_t(id[2])) << 16 | uint32_t(uint8_t(id[3])) << 24;
+}
+
+constexpr int TILE = 256;        // largest model MagicaVoxel accepts
+constexpr size_t BLOCK = 1 << 16; // voxels streamed per insertBatch call
+
+// MagicaVoxel's default palette, used when a file has no RGBA chunk (ABGR)
+const uint32_t defaultPalette[256] = {
+    0x00000000, 0xffffffff, 0xffccffff, 0xff99ffff, 0xff66ffff, 0xff33ffff, 0xff00ffff, 0xffffccff, 0xffccccff, 0xff99ccff, 0xff66ccff, 0xff33ccff, 0xff00ccff, 0xffff99ff, 0xffcc99ff, 0xff9999ff,
+    0xff6699ff, 0xff3399ff, 0xff0099ff, 0xffff66ff, 0xffcc66ff, 0xff9966ff, 0xff6666ff, 0xff3366ff, 0xff0066ff, 0xffff33ff, 0xffcc33ff, 0xff9933ff, 0xff6633ff, 0xff3333ff, 0xff0033ff, 0xffff00ff,
+    0xffcc00ff, 0xff9900ff, 0xff6600ff, 0xff3300ff, 0xff0000ff, 0xffffffcc, 0xffccffcc, 0xff99ffcc, 0xff66ffcc, 0xff33ffcc, 0xff00ffcc, 0xffffcccc, 0xffcccccc, 0xff99cccc, 0xff66cccc, 0xff33cccc,
+    0xff00cccc, 0xffff99cc, 0xffcc99cc, 0xff9999cc, 0xff6699cc, 0xff3399cc, 0xff0099cc, 0xffff66cc, 0xffcc66cc, 0xff9966cc, 0xff6666cc, 0xff3366cc, 0xff0066cc, 0xffff33cc, 0xffcc33cc, 0xff9933cc,
+    0xff6633cc, 0xff3333cc, 0xff0033cc, 0xffff00cc, 0xffcc00cc, 0xff9900cc, 0xff6600cc, 0xff3300cc, 0xff0000cc, 0xffffff99, 0xffccff99, 0xff99ff99, 0xff66ff99, 0xff33ff99, 0xff00ff99, 0xffffcc99,
+    0xffcccc99, 0xff99cc99, 0xff66cc99, 0xff33cc99, 0xff00cc99, 0xffff9999, 0xffcc9999, 0xff999999, 0xff669999, 0xff339999, 0xff009999, 0xffff6699, 0xffcc6699, 0xff996699, 0xff666699, 0xff336699,
+    0xff006699, 0xffff3399, 0xffcc3399, 0xff993399, 0xff663399, 0xff333399, 0xff003399, 0xffff0099, 0xffcc0099, 0xff990099, 0xff660099, 0xff330099, 0xff000099, 0xffffff66, 0xffccff66, 0xff99ff66,
+    0xff66ff66, 0xff33ff66, 0xff00ff66, 0xffffcc66, 0xffcccc66, 0xff99cc66, 0xff66cc66, 0xff33cc66, 0xff00cc66, 0xffff9966, 0xffcc9966, 0xff999966, 0xff669966, 0xff339966, 0xff009966, 0xffff6666,
+    0xffcc6666, 0xff996666, 0xff666666, 0xff336666, 0xff006666, 0xffff3366, 0xffcc3366, 0xff993366, 0xff663366, 0xff333366, 0xff003366, 0xffff0066, 0xffcc0066, 0xff990066, 0xff660066, 0xff330066,
+    0xff000066, 0xffffff33, 0xffccff33, 0xff99ff33, 0xff66ff33, 0xff33ff33, 0xff00ff33, 0xffffcc33, 0xffcccc33, 0xff99cc33, 0xff66cc33, 0xff33cc33, 0xff00cc33, 0xffff9933, 0xffcc9933, 0xff999933,
+    0xff669933, 0xff339933, 0xff009933, 0xffff6633, 0xffcc6633, 0xff996633, 0xff666633, 0xff336633, 0xff006633, 0xffff3333, 0xffcc3333, 0xff993333, 0xff663333, 0xff333333, 0xff003333, 0xffff0033,
+    0xffcc0033, 0xff990033, 0xff660033, 0xff330033, 0xff000033, 0xffffff00, 0xffccff00, 0xff99ff00, 0xff66ff00, 0xff33ff00, 0xff00ff00, 0xffffcc00, 0xffcccc00, 0xff99cc00, 0xff66cc00, 0xff33cc00,
+    0xff00cc00, 0xffff9900, 0xffcc9900, 0xff999900, 0xff669900, 0xff339900, 0xff009900, 0xffff6600, 0xffcc6600, 0xff996600, 0xff666600, 0xff336600, 0xff006600, 0xffff3300, 0xffcc3300, 0xff993300,
+    0xff663300, 0xff333300, 0xff003300, 0xffff0000, 0xffcc0000, 0xff990000, 0xff660000, 0xff330000, 0xff0000ee, 0xff0000dd, 0xff0000bb, 0xff0000aa, 0xff000088, 0xff000077, 0xff000055, 0xff000044,
+    0xff000022, 0xff000011, 0xff00ee00, 0xff00dd00, 0xff00bb00, 0xff00aa00, 0xff008800, 0xff007700, 0xff005500, 0xff004400, 0xff002200, 0xff001100, 0xffee0000, 0xffdd0000, 0xffbb0000, 0xffaa0000,
+    0xff880000, 0xff770000, 0xff550000, 0xff440000, 0xff220000, 0xff110000, 0xffeeeeee, 0xffdddddd, 0xffbbbbbb, 0xffaaaaaa, 0xff888888, 0xff777777, 0xff555555, 0xff444444, 0xff222222, 0xff111111,
+};
+
+// Rotation and translation of a scene graph node, in MagicaVoxel's z-up space
+struct VoxTransform {
+    glm::ivec3 rows[3] = { glm::ivec3(1, 0, 0), glm::ivec3(0, 1, 0), glm::ivec3(0, 0, 1) };
+    glm::ivec3 translation = glm::ivec3(0);
+
+    glm::ivec3 rotate(glm::ivec3 v) const {
+        return glm::ivec3(glm::dot(rows[0], v), glm::dot(rows[1], v), glm::dot(rows[2], v));
+    }
+
+    VoxTransform then(const VoxTransform& child) const {
+        VoxTransform result;
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                result.rows[r][c] = rows[r].x * child.rows[0][c] + rows[r].y * child.rows[1][c] + rows[r].z * child.rows[2][c];
+            }
+        }
+        result.translation = translation + rotate(child.translation);
+        return result;
+    }
+
+    // packed rotation: bits 0-1 and 2-3 give the column of the non-zero entry in rows 0
+    // and 1, bits 4-6 the sign of rows 0-2
+    static VoxTransform fromRotation(uint8_t bits) {
+        VoxTransform t;
+        int c0 = bits & 3, c1 = (bits >> 2) & 3, c2 = 3 - c0 - c1;
+        int columns[3] = { c0, c1, c2 };
+        for (int r = 0; r < 3; ++r) {
+            t.rows[r] = glm::ivec3(0);
+            if (columns[r] < 0 || columns[r] > 2) {
+                return VoxTransform{};
+            }
+            t.rows[r][columns[r]] = (bits >> (4 + r)) & 1 ? -1 : 1;
+        }
+        return t;
+    }
+};
+
+struct VoxNode {
+    enum class Type { Transform, Group, Shape } type;
+    VoxTransform transform;
+    std::vector<int32_t> children; // transform: one child, group: many
+    std::vector<int32_t> models;   // shape
+};
+
+struct VoxModel {
+    glm::ivec3 size = glm::ivec3(0);
+    std::streamoff voxelsOffset = -1; // start of the XYZI content
+    uint32_t voxelCount = 0;
+};
+
+class ChunkReader {
+public:
+    explicit ChunkReader(std::ifstream& file) : file(file) {}
+
+    int32_t i32() {
+        int32_t v = 0;
+        file.read(reinterpret_cast<char*>(&v), sizeof(v));
+        return v;
+    }
+
+    std::string string() {
+        int32_t length = i32();
+        std::string s(std::max(length, 0), '\0');
+        file.read(s.data(), static_cast<std::streamsize>(s.size()));
+        return s;
+    }
+
+    std::unordered_map<std::string, std::string> dict() {
+        std::unordered_map<std::string, std::string> result;
+        for (int32_t n = i32(); n > 0 && file; --n) {
+            std::string key = string();
+            result[key] = string();
+        }
+        return result;
+    }
+
+private:
+    std::ifstream& file;
+};
+
+void collectInstances(const std::unordered_map<int32_t, VoxNode>& nodes, int32_t id, const VoxTransform& parent,
+                      std::vector<std::pair<int32_t, VoxTransform>>& instances, int depth = 0) {
+    auto it = nodes.find(id);
+    if (it == nodes.end() || depth > 64) {
+        return;
+    }
+    const VoxNode& node = it->second;
+    VoxTransform transform = node.type == VoxNode::Type::Transform ? parent.then(node.transform) : parent;
+    for (int32_t child : node.children) {
+        collectInstances(nodes, child, transform, instances, depth + 1);
+    }
+    for (int32_t model : node.models) {
+        instances.emplace_back(model, transform);
+    }
+}
+
+} // namespace
+
+VoxImportStats readVox(const std::string &filepath, SVO &svo, Vec3i32 offset) {
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        throw std::runtime_error("Failed to open .vox file: " + filepath);
+    }
+    ChunkReader in(file);
+    if (in.i32() != static_cast<int32_t>(chunkId("VOX "))) {
+        throw std::runtime_error("Not a MagicaVoxel file: " + filepath);
+    }
+    in.i32(); // version
+
+    // pass 1: chunk headers, palette and scene graph; voxel data is only located
+    std::array<uint32_t, 256> palette;
+    std::copy(std::begin(defaultPalette), std::end(defaultPalette), palette.begin());
+    std::vector<VoxModel> models;
+    std::unordered_map<int32_t, VoxNode> nodes;
+
+    while (file) {
+        uint32_t id = static_cast<uint32_t>(in.i32());
+        int32_t contentBytes = in.i32();
+        int32_t childrenBytes = in.i32();
+        if (!file) {
+            break;
+        }
+        if (contentBytes < 0 || childrenBytes < 0) {
+            throw std::runtime_error("Corrupt chunk size in .vox file: " + filepath);
+        }
+        if (id == chunkId("MAIN")) {
+            continue; // descend into its children
+        }
+        std::streamoff contentStart = file.tellg();
+
+        if (id == chunkId("SIZE")) {
+            VoxModel model;
+            model.size.x = in.i32();
+            model.size.y = in.i32();
+            model.size.z = in.i32();
+            models.push_back(model);
+        } else if (id == chunkId("XYZI") && !models.empty()) {
+            models.back().voxelCount = static_cast<uint32_t>(in.i32());
+            models.back().voxelsOffset = file.tellg();
+        } else if (id == chunkId("RGBA")) {
+            // colour i of the chunk belongs to palette index i + 1
+            file.read(reinterpret_cast<char*>(palette.data() + 1), 255 * sizeof(uint32_t));
+        } else if (id == chunkId("nTRN")) {
+            int32_t nodeId = in.i32();
+            VoxNode node{ VoxNode::Type::Transform, {}, {}, {} };
+            in.dict();
+            node.children.push_back(in.i32());
+            in.i32(); // reserved
+            in.i32(); // layer
+            if (in.i32() > 0) {
+                auto frame = in.dict();
+                if (auto r = frame.find("_r"); r != frame.end()) {
+                    node.transform = VoxTransform::fromRotation(static_cast<uint8_t>(std::atoi(r->second.c_str())));
+                }
+                if (auto t = frame.find("_t"); t != frame.end()) {
+                    glm::ivec3& tr = node.transform.translation;
+                    std::sscanf(t->second.c_str(), "%d %d %d", &tr.x, &tr.y, &tr.z);
+                }
+            }
+            nodes[nodeId] = node;
+        } else if (id == chunkId("nGRP")) {
+            int32_t nodeId = in.i32();
+            VoxNode node{ VoxNode::Type::Group, {}, {}, {} };
+            in.dict();
+            for (int32_t n = in.i32(); n > 0 && file; --n) {
+                node.children.push_back(in.i32());
+            }
+            nodes[nodeId] = node;
+        } else if (id == chunkId("nSHP")) {
+            int32_t nodeId = in.i32();
+            VoxNode node{ VoxNode::Type::Shape, {}, {}, {} };
+            in.dict();
+            for (int32_t n = in.i32(); n > 0 && file; --n) {
+                node.models.push_back(in.i32());
+                in.dict();
+            }
+            nodes[nodeId] = node;
+        }
+
+        // the next chunk starts after this one's content and children; a chunk whose fields
+        // ran past that would have the walk go back over bytes it has read
+        const std::streamoff next = contentStart + std::streamoff(contentBytes) + std::streamoff(childrenBytes);
+        file.clear();
+        if (file.tellg() > next) {
+            throw std::runtime_error("Corrupt chunk size in .vox file: " + filepath);
+        }
+        file.seekg(next);
+    }
+    file.clear();
+
+    std::vector<std::pair<int32_t, VoxTransform>> instances;
+    if (nodes.empty()) {
+        for (int32_t m = 0; m < static_cast<int32_t>(models.size()); ++m) {
+            instances.emplace_back(m, VoxTransform{});
+        }
+    } else {
+        collectInstances(nodes, 0, VoxTransform{}, instances);
+    }
+
+    // pass 2: stream every instance's voxels in blocks
+    VoxImportStats stats;
+    stats.models = models.size();
+    std::vector<std::array<uint8_t, 4>> raw(BLOCK);
+    std::vector<Vec3i32> positions(BLOCK);
+    std::vector<rgb32_t> colors(BLOCK);
+    const Vec3i32 lo = svo.minIncl(), hi = svo.maxIncl();
+
+    for (const auto& [modelId, transform] : instances) {
+        if (modelId < 0 || modelId >= static_cast<int32_t>(models.size()) || models[modelId].voxelsOffset < 0) {
+            continue;
+        }
+        const VoxModel& model = models[modelId];
+        stats.instances++;
+        file.seekg(model.voxelsOffset);
+        for (uint32_t done = 0; done < model.voxelCount && file;) {
+            uint32_t count = std::min<uint32_t>(BLOCK, model.voxelCount - done);
+            file.read(reinterpret_cast<char*>(raw.data()), count * 4);
+            size_t kept = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                glm::ivec3 local = glm::ivec3(raw[i][0], raw[i][1], raw[i][2]) - model.size / 2;
+                glm::ivec3 world = transform.translation + transform.rotate(local);
+                Vec3i32 pos = Vec3i32(world.x, world.z, -world.y) + offset;
+                if (glm::any(glm::lessThan(pos, lo)) || glm::any(glm::greaterThan(pos, hi))) {
+                    continue;
+                }
+                uint32_t abgr = palette[raw[i][3]];
+                positions[kept] = pos;
+                colors[kept] = rgb32_t(abgr & 0xFF, (abgr >> 8) & 0xFF, (abgr >> 16) & 0xFF, 255);
+                kept++;
+            }
+            svo.insertBatch(std::span(positions.data(), kept), std::span<const rgb32_t>(colors.data(), kept));
+            stats.voxels += kept;
+            done += count;
+        }
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded " << filepath << ": " << stats.models << " models, " << stats.instances << " instances, "
+              << stats.voxels << " voxels in " << stats.seconds << " s" << std::endl;
+    return stats;
+}
+
+namespace {
+
+class ChunkWriter {
+public:
+    explicit ChunkWriter(std::ofstream& file) : file(file) {}
+
+    void i32(int32_t v) { file.write(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void id(uint32_t v) { i32(static_cast<int32_t>(v)); }
+
+    void string(const std::string& s) {
+        i32(static_cast<int32_t>(s.size()));
+        file.write(s.data(), static_cast<std::streamsize>(s.size()));
+    }
+
+    static int32_t stringBytes(const std::string& s) { return 4 + static_cast<int32_t>(s.size()); }
+
+    void header(uint32_t chunk, int32_t contentBytes, int32_t childrenBytes = 0) {
+        id(chunk);
+        i32(contentBytes);
+        i32(childrenBytes);
+    }
+
+private:
+    std::ofstream& file;
+};
+
+// Maps colours to palette indices 1..255, falling back to the nearest entry when full
+class PaletteBuilder {
+public:
+    uint8_t indexOf(rgb32_t color) {
+        uint32_t key = (color.r & 0xFF) | (color.g & 0xFF) << 8 | (color.b & 0xFF) << 16;
+        if (auto it = lookup.find(key); it != lookup.end()) {
+            return it->second;
+        }
+        uint8_t index;
+        if (entries.size() < 255) {
+            entries.push_back(key);
+            index = static_cast<uint8_t>(entries.size());
+        } else {
+            int best = INT32_MAX;
+            index = 1;
+            for (size_t i = 0; i < entries.size(); ++i) {
+                int dr = int(entries[i] & 0xFF) - int(key & 0xFF);
+                int dg = int((entries[i] >> 8) & 0xFF) - int((key >> 8) & 0xFF);
+                int db = int((entries[i] >> 16) & 0xFF) - int((key >> 16) & 0xFF);
+                if (int d = dr * dr + dg * dg + db * db; d < best) {
+                    best = d;
+                    index = static_cast<uint8_t>(i + 1);
+                }
+            }
+        }
+        lookup[key] = index;
+        return index;
+    }
+
+    std::array<uint32_t, 256> rgba() const {
+        std::array<uint32_t, 256> result{};
+        for (size_t i = 0; i < entries.size(); ++i) {
+            result[i] = entries[i] | 0xFF000000;
+        }
+        return result;
+    }
+
+private:
+    std::vector<uint32_t> entries;
+    std::unordered_map<uint32_t, uint8_t> lookup;
+};
+
+} // namespace
+
+void writeVox(const std::string &filepath, const SVO &svo, Vec3i32 lo, Vec3i32 hi) {
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        throw std::runtime_error("Failed to open .vox file for writing: " + filepath);
+    }
+    ChunkWriter out(file);
+    out.id(chunkId("VOX "));
+    out.i32(150);
+    out.header(chunkId("MAIN"), 0, 0); // children size is patched at the end
+    const std::streamoff mainStart = file.tellp();
+
+    PaletteBuilder palette;
+    std::vector<std::array<uint8_t, 4>> voxels;
+    std::vector<std::pair<glm::ivec3, glm::ivec3>> placed; // translation and size per model
+
+    lo = glm::max(lo, svo.minIncl());
+    hi = glm::min(hi, svo.maxIncl());
+    for (int tx = lo.x; tx <= hi.x; tx += TILE) {
+        for (int ty = lo.y; ty <= hi.y; ty += TILE) {
+            for (int tz = lo.z; tz <= hi.z; tz += TILE) {
+                const Vec3i32 origin(tx, ty, tz);
+                const Vec3i32 tileHi = glm::min(origin + Vec3i32(TILE - 1), hi);
+                const glm::ivec3 extent = tileHi - origin + 1;
+
+                // engine (x, y, z) is MagicaVoxel (x, -z, y); flip z into the tile
+                voxels.clear();
+                svo.forEach(origin, tileHi, [&](Vec3i32 pos, const rgb32_t& color) {
+                    glm::ivec3 l = pos - origin;
+                    voxels.push_back({ uint8_t(l.x), uint8_t(extent.z - 1 - l.z), uint8_t(l.y), palette.indexOf(color) });
+                });
+                if (voxels.empty()) {
+                    continue;
+                }
+
+                const glm::ivec3 size(extent.x, extent.z, extent.y);
+                out.header(chunkId("SIZE"), 12);
+                out.i32(size.x);
+                out.i32(size.y);
+                out.i32(size.z);
+                out.header(chunkId("XYZI"), 4 + 4 * static_cast<int32_t>(voxels.size()));
+                out.i32(static_cast<int32_t>(voxels.size()));
+                file.write(reinterpret_cast<const char*>(voxels.data()), static_cast<std::streamsize>(voxels.size() * 4));
+
+                // inverse of readVox: world = t + local - size / 2, engine = (w.x, w.z, -w.y)
+                glm::ivec3 translation(origin.x + size.x / 2, -origin.z - size.y + 1 + size.y / 2, origin.y + size.z / 2);
+                placed.emplace_back(translation, size);
+            }
+        }
+    }
+
+    // scene graph: root transform 0 -> group 1 -> (transform 2 + 2k -> shape 3 + 2k)
+    const std::string noAttributes;
+    out.header(chunkId("nTRN"), 4 + 4 + 4 + 4 + 4 + 4 + 4);
+    out.i32(0);
+    out.i32(0);
+    out.i32(1);
+    out.i32(-1);
+    out.i32(-1);
+    out.i32(1);
+    out.i32(0);
+
+    out.header(chunkId("nGRP"), 4 + 4 + 4 + 4 * static_cast<int32_t>(placed.size()));
+    out.i32(1);
+    out.i32(0);
+    out.i32(static_cast<int32_t>(placed.size()));
+    for (size_t k = 0; k < placed.size(); ++k) {
+        out.i32(static_cast<int32_t>(2 + 2 * k));
+    }
+
+    for (size_t k = 0; k < placed.size(); ++k) {
+        const glm::ivec3 t = placed[k].first;
+        const std::string value = std::to_string(t.x) + " " + std::to_string(t.y) + " " + std::to_string(t.z);
+        out.header(chunkId("nTRN"), 4 + 4 + 4 + 4 + 4 + 4 + 4 + ChunkWriter::stringBytes("_t") + ChunkWriter::stringBytes(value));
+        out.i32(static_cast<int32_t>(2 + 2 * k));
+        out.i32(0);
+        out.i32(static_cast<int32_t>(3 + 2 * k));
+        out.i32(-1);
+        out.i32(0);
+        out.i32(1);
+        out.i32(1);
+        out.string("_t");
+        out.string(value);
+
+        out.header(chunkId("nSHP"), 4 + 4 + 4 + 4 + 4);
+        out.i32(static_cast<int32_t>(3 + 2 * k));
+        out.i32(0);
+        out.i32(1);
+        out.i32(static_cast<int32_t>(k));
+        out.i32(0);
+    }
+
+    auto colors = palette.rgba();
+    out.header(chunkId("RGBA"), 256 * 4);
+    file.write(reinterpret_cast<const char*>(colors.data()), 256 * 4);
+
+    const std::streamoff end = file.tellp();
+    file.seekp(mainStart - 4);
+    out.i32(static_cast<int32_t>(end - mainStart));
+    std::cout << "Wrote " << filepath << ": " << placed.size() << " models" << std::endl;
+}
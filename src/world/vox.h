@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include "../render/voxel.h"
+
+struct VoxImportStats {
+    size_t models = 0;
+    size_t instances = 0;
+    size_t voxels = 0;
+    double seconds = 0.0;
+};
+
+// MagicaVoxel .vox import. The chunk headers are scanned first (skipping voxel data) to
+// collect the palette and the nTRN/nGRP/nSHP scene graph, then every placed model's XYZI
+// chunk is streamed in fixed-size blocks straight into SVO::insertBatch. Files without a
+// scene graph place each model at the origin. MagicaVoxel is z-up, so (x, y, z) in the
+// file becomes (x, z, -y) here, before `offset` is added.
+VoxImportStats readVox(const std::string &filepath, SVO &svo, Vec3i32 offset = Vec3i32(0));
+
+// Writes the voxels of `svo` in [lo, hi] as a .vox file, one model per non-empty 256^3
+// tile, placed by a translation node so that readVox restores the original positions.
+// Colours are mapped to a 255 entry palette, nearest match once it is full.
+void writeVox(const std::string &filepath, const SVO &svo, Vec3i32 lo, Vec3i32 hi);
@@ -0,0 +1,190 @@
+#include "voxelizer.h"
+#include "obj.h"
+#include "../util/parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Triangle {
+    std::array<glm::vec3, 3> v; // voxel space
+    std::array<glm::vec3, 3> colors;
+};
+
+// Separating axis test of a triangle against the cube centred at `center` with
+// half extent `h` (Akenine-Moeller). Touching counts as overlapping.
+bool triangleBoxOverlap(const Triangle &triangle, glm::vec3 center, float h) {
+    const glm::vec3 v0 = triangle.v[0] - center;
+    const glm::vec3 v1 = triangle.v[1] - center;
+    const glm::vec3 v2 = triangle.v[2] - center;
+    const glm::vec3 edges[3] = { v1 - v0, v2 - v1, v0 - v2 };
+
+    // the nine edge x box-axis cross products
+    for (const glm::vec3 &e : edges) {
+        const glm::vec3 axes[3] = { glm::vec3(0, -e.z, e.y), glm::vec3(e.z, 0, -e.x), glm::vec3(-e.y, e.x, 0) };
+        for (const glm::vec3 &axis : axes) {
+            float p0 = glm::dot(v0, axis), p1 = glm::dot(v1, axis), p2 = glm::dot(v2, axis);
+            float r = h * (std::abs(axis.x) + std::abs(axis.y) + std::abs(axis.z));
+            if (std::min({ p0, p1, p2 }) > r || std::max({ p0, p1, p2 }) < -r) {
+                return false;
+            }
+        }
+    }
+
+    // the box face axes are covered by the caller only visiting voxels inside the
+    // triangle's bounds, which leaves the triangle plane
+    glm::vec3 normal = glm::cross(edges[0], edges[1]);
+    float d = glm::dot(normal, v0);
+    float r = h * (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+    return std::abs(d) <= r;
+}
+
+rgb32_t shade(const Triangle &triangle, glm::vec3 p) {
+    // barycentric weights of p projected onto the triangle, clamped into it
+    glm::vec3 e0 = triangle.v[1] - triangle.v[0], e1 = triangle.v[2] - triangle.v[0], d = p - triangle.v[0];
+    float d00 = glm::dot(e0, e0), d01 = glm::dot(e0, e1), d11 = glm::dot(e1, e1);
+    float d20 = glm::dot(d, e0), d21 = glm::dot(d, e1);
+    float denom = d00 * d11 - d01 * d01;
+    float v = 0.0f, w = 0.0f;
+    if (denom > 0.0f) {
+        v = std::clamp((d11 * d20 - d01 * d21) / denom, 0.0f, 1.0f);
+        w = std::clamp((d00 * d21 - d01 * d20) / denom, 0.0f, 1.0f - v);
+    }
+    glm::vec3 c = triangle.colors[0] * (1.0f - v - w) + triangle.colors[1] * v + triangle.colors[2] * w;
+    c = glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f;
+    return rgb32_t(uint32_t(c.x), uint32_t(c.y), uint32_t(c.z), 255);
+}
+
+uint64_t binKey(glm::ivec3 bin) {
+    return (uint64_t(uint32_t(bin.x) & 0x1FFFFF) << 42) | (uint64_t(uint32_t(bin.y) & 0x1FFFFF) << 21) | uint64_t(uint32_t(bin.z) & 0x1FFFFF);
+}
+
+// Partial tree a bin is voxelized into, spreading neighbouring bins over the trees
+size_t binOwner(uint64_t key, unsigned trees) {
+    return size_t((key * 0x9E3779B97F4A7C15ull) >> 32) % trees;
+}
+
+int floorDiv(int a, int b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+} // namespace
+
+VoxelizeStats voxelizeObj(const std::string &filepath, SVO &svo, const VoxelizeOptions &options) {
+    auto start = std::chrono::steady_clock::now();
+    ObjReader reader(filepath);
+
+    const unsigned workers = workerCount(options.threads);
+    const int binSize = options.binSize;
+    const glm::vec3 fallback = glm::vec3(options.color) / 255.0f;
+
+    // bins are octree aligned and each always lands in the same partial tree, so the trees
+    // never overlap and a voxel keeps the colour of the last triangle in file order that
+    // touches it, however the work was scheduled
+    std::vector<SVO> partial(workers);
+    std::vector<std::vector<size_t>> owned(workers); // this batch's bins per partial tree
+    std::vector<std::vector<Vec3i32>> positions(workers);
+    std::vector<std::vector<rgb32_t>> colors(workers);
+
+    VoxelizeStats stats;
+    const size_t voxelsBefore = svo.stats().voxels;
+    std::vector<ObjTriangle> batch;
+    std::vector<Triangle> triangles;
+    std::unordered_map<uint64_t, size_t> binIndex;
+    std::vector<glm::ivec3> binOrigins;
+    std::vector<std::vector<uint32_t>> bins;
+
+    const glm::ivec3 lo = svo.minIncl(), hi = svo.maxIncl();
+    while (reader.read(batch, options.batchTriangles)) {
+        stats.triangles += batch.size();
+        triangles.clear();
+        binIndex.clear();
+        binOrigins.clear();
+        for (auto &bin : bins) {
+            bin.clear();
+        }
+
+        for (const ObjTriangle &source : batch) {
+            Triangle triangle;
+            for (int i = 0; i < 3; ++i) {
+                triangle.v[i] = (source.positions[i] - options.origin) / options.voxelSize;
+                triangle.colors[i] = options.vertexColors ? source.colors[i] : fallback;
+            }
+            glm::ivec3 vmin = glm::ivec3(glm::floor(glm::min(glm::min(triangle.v[0], triangle.v[1]), triangle.v[2])));
+            glm::ivec3 vmax = glm::ivec3(glm::floor(glm::max(glm::max(triangle.v[0], triangle.v[1]), triangle.v[2])));
+            vmin = glm::clamp(vmin, lo, hi);
+            vmax = glm::clamp(vmax, lo, hi);
+
+            uint32_t index = static_cast<uint32_t>(triangles.size());
+            triangles.push_back(triangle);
+            for (int bx = floorDiv(vmin.x, binSize); bx <= floorDiv(vmax.x, binSize); ++bx) {
+                for (int by = floorDiv(vmin.y, binSize); by <= floorDiv(vmax.y, binSize); ++by) {
+                    for (int bz = floorDiv(vmin.z, binSize); bz <= floorDiv(vmax.z, binSize); ++bz) {
+                        auto [it, inserted] = binIndex.try_emplace(binKey(glm::ivec3(bx, by, bz)), binOrigins.size());
+                        if (inserted) {
+                            binOrigins.push_back(glm::ivec3(bx, by, bz) * binSize);
+                            if (bins.size() < binOrigins.size()) {
+                                bins.emplace_back();
+                            }
+                        }
+                        bins[it->second].push_back(index);
+                    }
+                }
+            }
+        }
+
+        for (auto &treeBins : owned) {
+            treeBins.clear();
+        }
+        for (size_t b = 0; b < binOrigins.size(); ++b) {
+            owned[binOwner(binKey(binOrigins[b] / binSize), workers)].push_back(b);
+        }
+
+        parallelFor(workers, [&](size_t tree, unsigned worker) {
+            for (size_t b : owned[tree]) {
+                auto &outPositions = positions[worker];
+                auto &outColors = colors[worker];
+                outPositions.clear();
+                outColors.clear();
+
+                const glm::ivec3 binMin = glm::max(binOrigins[b], lo);
+                const glm::ivec3 binMax = glm::min(binOrigins[b] + glm::ivec3(binSize - 1), hi);
+                for (uint32_t t : bins[b]) {
+                    const Triangle &triangle = triangles[t];
+                    glm::ivec3 vmin = glm::max(glm::ivec3(glm::floor(glm::min(glm::min(triangle.v[0], triangle.v[1]), triangle.v[2]))), binMin);
+                    glm::ivec3 vmax = glm::min(glm::ivec3(glm::floor(glm::max(glm::max(triangle.v[0], triangle.v[1]), triangle.v[2]))), binMax);
+                    for (int x = vmin.x; x <= vmax.x; ++x) {
+                        for (int y = vmin.y; y <= vmax.y; ++y) {
+                            for (int z = vmin.z; z <= vmax.z; ++z) {
+                                glm::vec3 center = glm::vec3(x, y, z) + 0.5f;
+                                if (triangleBoxOverlap(triangle, center, 0.5f)) {
+                                    outPositions.emplace_back(x, y, z);
+                                    outColors.push_back(shade(triangle, center));
+                                }
+                            }
+                        }
+                    }
+                }
+                partial[tree].insertBatch(outPositions, outColors);
+            }
+        }, workers);
+    }
+
+    for (unsigned w = 0; w < workers; ++w) {
+        svo.merge(std::move(partial[w]));
+    }
+    // a voxel touched by several triangles or bins is found once per touch, so the tree is
+    // what counts them
+    stats.voxels = svo.stats().voxels - voxelsBefore;
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Voxelized " << filepath << ": " << stats.triangles << " triangles, " << stats.voxels << " voxels in "
+              << stats.seconds << " s (" << stats.trianglesPerSecond() << " triangles/s, " << stats.voxelsPerSecond()
+              << " voxels/s)" << std::endl;
+    return stats;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <glm/glm.hpp>
+#include "../render/voxel.h"
+
+struct VoxelizeOptions {
+    float voxelSize = 1.0f;             // mesh units per voxel
+    glm::vec3 origin = glm::vec3(0.0f); // mesh position that lands on voxel (0, 0, 0)
+    bool vertexColors = true;           // interpolate "v x y z r g b" colours if present
+    rgb32_t color = rgb32_t(200, 200, 200, 255); // used when vertexColors is off
+    size_t batchTriangles = 1 << 16;    // triangles held in memory at once
+    int binSize = 64;                   // edge of the octree-aligned bins, a power of two
+    unsigned threads = 0;               // 0 picks the hardware concurrency
+};
+
+struct VoxelizeStats {
+    size_t triangles = 0;
+    size_t voxels = 0; // new voxels in the tree, each counted once
+    double seconds = 0.0;
+
+    double trianglesPerSecond() const { return seconds > 0.0 ? triangles / seconds : 0.0; }
+    double voxelsPerSecond() const { return seconds > 0.0 ? voxels / seconds : 0.0; }
+};
+
+// Conservatively voxelizes an OBJ mesh into `svo`: every voxel whose cube touches a
+// triangle is set. Triangles are streamed in batches, binned into octree-aligned cells and
+// the cells voxelized in parallel into per-thread trees, which are merged in at the end.
+VoxelizeStats voxelizeObj(const std::string &filepath, SVO &svo, const VoxelizeOptions &options = {});
@@ -0,0 +1,495 @@
+#include "worldfile.h"
+#include "../util/parallel.h"
+#include "../util/profiler.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+constexpr char MAGIC[4] = { 'V', 'X', 'W', 'C' };
+constexpr uint32_t VERSION = 1;
+constexpr size_t BLOCK = 1 << 16; // voxels per insertBatch call
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t depth;      // SVO depth the file was written from
+    uint32_t chunkLevel; // octree level of a chunk's root
+    uint32_t chunkCount;
+    uint32_t reserved;
+    uint64_t tableOffset;
+};
+
+struct ChunkEntry {
+    int32_t x, y, z; // chunk origin
+    uint32_t voxels;
+    uint64_t offset;
+    uint32_t bytes;          // whole payload
+    uint32_t structureBytes; // of which child masks
+};
+
+static_assert(sizeof(FileHeader) == 32 && sizeof(ChunkEntry) == 32, "on-disk layout");
+
+constexpr uint32_t BRANCH_WORDS = 9; // header and eight child indices
+constexpr uint32_t LEAF_WORDS = 33;  // header and eight rgba voxels
+
+// Interleaves the bits of a position the same way as the SVO's octree index, x being the
+// high bit of each octal digit.
+uint64_t morton(Vec3u32 v, int bits) {
+    uint64_t code = 0;
+    for (int b = 0; b < bits; ++b) {
+        code |= uint64_t(((v.x >> b) & 1) << 2 | ((v.y >> b) & 1) << 1 | ((v.z >> b) & 1)) << (3 * b);
+    }
+    return code;
+}
+
+Vec3i32 octant(uint32_t i) {
+    return Vec3i32((i >> 2) & 1, (i >> 1) & 1, i & 1);
+}
+
+void putVarint(std::vector<uint8_t> &out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(uint8_t(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+uint32_t zigzag(uint32_t delta) {
+    return (delta << 1) ^ uint32_t(int32_t(delta) >> 31);
+}
+
+uint32_t unzigzag(uint32_t v) {
+    return (v >> 1) ^ (0u - (v & 1));
+}
+
+[[noreturn]] void corrupt() {
+    std::cerr << "World chunk data is truncated or corrupt" << std::endl;
+    throw std::runtime_error("Corrupt world chunk");
+}
+
+struct ByteReader {
+    const uint8_t *p;
+    const uint8_t *end;
+
+    uint8_t byte() {
+        if (p == end) {
+            corrupt();
+        }
+        return *p++;
+    }
+
+    uint32_t varint() {
+        uint32_t v = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            uint8_t b = byte();
+            v |= uint32_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                return v;
+            }
+        }
+        corrupt();
+    }
+};
+
+// Streaming decoder over one chunk's payload: masks come off the structure stream in
+// pre-order, colours off the run stream in Morton order.
+class ChunkDecoder {
+public:
+    ChunkDecoder(const uint8_t *data, const ChunkEntry &entry)
+        : structure{ data, data + entry.structureBytes }, runs{ data + entry.structureBytes, data + entry.bytes } {}
+
+    uint8_t mask() { return structure.byte(); }
+
+    rgb32_t color() {
+        if (remaining == 0) {
+            remaining = runs.varint();
+            if (remaining == 0) {
+                corrupt();
+            }
+            for (int c = 0; c < 4; ++c) {
+                current[c] += unzigzag(runs.varint());
+            }
+        }
+        --remaining;
+        return current;
+    }
+
+    size_t leaves = 0;
+
+private:
+    ByteReader structure;
+    ByteReader runs;
+    rgb32_t current = rgb32_t(0);
+    uint32_t remaining = 0;
+};
+
+// Encodes the voxels of one chunk, given as chunk-local Morton codes in ascending order.
+struct ChunkEncoder {
+    std::vector<uint64_t> codes;
+    std::vector<rgb32_t> colors;
+    std::vector<uint8_t> payload;
+    size_t structureBytes = 0;
+    size_t branches = 0;
+    size_t leaves = 0;
+
+    void encode(size_t chunkLevel) {
+        payload.clear();
+        encodeNode(chunkLevel, 0, codes.size());
+        structureBytes = payload.size();
+
+        rgb32_t previous(0);
+        for (size_t i = 0; i < colors.size();) {
+            size_t j = i + 1;
+            while (j < colors.size() && colors[j] == colors[i]) {
+                ++j;
+            }
+            putVarint(payload, uint32_t(j - i));
+            for (int c = 0; c < 4; ++c) {
+                putVarint(payload, zigzag(colors[i][c] - previous[c]));
+            }
+            previous = colors[i];
+            i = j;
+        }
+    }
+
+private:
+    void encodeNode(size_t level, size_t begin, size_t end) {
+        const auto digit = [&](size_t i) { return uint32_t(codes[i] >> (3 * level)) & 7; };
+        uint8_t mask = 0;
+        for (size_t i = begin; i < end; ++i) {
+            mask |= uint8_t(1u << digit(i));
+        }
+        payload.push_back(mask);
+        if (level == 0) {
+            ++leaves;
+            return;
+        }
+        ++branches;
+        for (size_t i = begin; i < end;) {
+            size_t j = i + 1;
+            while (j < end && digit(j) == digit(i)) {
+                ++j;
+            }
+            encodeNode(level - 1, i, j);
+            i = j;
+        }
+    }
+};
+
+template <typename Fn>
+void decodeVoxels(ChunkDecoder &decoder, size_t level, Vec3i32 origin, Fn &&fn) {
+    const uint8_t mask = decoder.mask();
+    if (level == 0) {
+        ++decoder.leaves;
+    }
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (mask & (1u << i)) {
+            if (level == 0) {
+                fn(origin + octant(i), decoder.color());
+            } else {
+                decodeVoxels(decoder, level - 1, origin + octant(i) * (1 << level), fn);
+            }
+        }
+    }
+}
+
+void flattenChunkNode(ChunkDecoder &decoder, size_t level, std::vector<uint32_t> &buffer, uint32_t &index) {
+    const uint8_t mask = decoder.mask();
+    const uint32_t nodeIndex = index++;
+    if (level == 0) {
+        buffer.push_back(LEAF_NODE | nodeIndex);
+        for (uint32_t i = 0; i < 8; ++i) {
+            rgb32_t c = mask & (1u << i) ? decoder.color() : rgb32_t(0);
+            buffer.insert(buffer.end(), { c.r, c.g, c.b, c.a });
+        }
+        return;
+    }
+    buffer.push_back(BRANCH_NODE | nodeIndex);
+    const size_t children = buffer.size();
+    buffer.resize(children + 8, 0);
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (mask & (1u << i)) {
+            buffer[children + i] = uint32_t(buffer.size());
+            flattenChunkNode(decoder, level - 1, buffer, index);
+        }
+    }
+}
+
+uint64_t chunkKey(const ChunkEntry &entry, Vec3i32 svoMin, size_t chunkLevel) {
+    Vec3u32 chunk = Vec3u32(Vec3i32(entry.x, entry.y, entry.z) - svoMin) >> Vec3u32(chunkLevel + 1);
+    return morton(chunk, int(SVO::depth - chunkLevel));
+}
+
+// Branches above chunk level, root included, for keys in ascending order.
+size_t countTopBranches(const std::vector<uint64_t> &keys, size_t chunkLevel) {
+    size_t branches = 1;
+    for (size_t level = chunkLevel + 1; level < SVO::depth; ++level) {
+        const int shift = int(3 * (level - chunkLevel));
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (i == 0 || (keys[i] >> shift) != (keys[i - 1] >> shift)) {
+                ++branches;
+            }
+        }
+    }
+    return branches;
+}
+
+struct WorldReader {
+    std::ifstream file;
+    FileHeader header{};
+    std::vector<ChunkEntry> table;
+    std::vector<uint64_t> keys;
+
+    explicit WorldReader(const std::string &filepath) : file(filepath, std::ios::binary) {
+        if (!file) {
+            std::cerr << "Failed to open file: " << filepath << std::endl;
+            throw std::runtime_error("Failed to open world file: " + filepath);
+        }
+        file.read(reinterpret_cast<char *>(&header), sizeof(header));
+        if (!file || std::memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION) {
+            throw std::runtime_error("Not a world file: " + filepath);
+        }
+        if (header.depth != SVO::depth || header.chunkLevel == 0 || header.chunkLevel >= SVO::depth) {
+            std::cerr << "World file " << filepath << " was written for depth " << header.depth << " with chunk level "
+                      << header.chunkLevel << std::endl;
+            throw std::runtime_error("Incompatible world file: " + filepath);
+        }
+
+        // the table must fit between the payloads and the end of the file before it is allocated
+        file.seekg(0, std::ios::end);
+        const uint64_t fileBytes = uint64_t(file.tellg());
+        if (header.tableOffset < sizeof(header) || header.tableOffset > fileBytes ||
+            uint64_t(header.chunkCount) * sizeof(ChunkEntry) > fileBytes - header.tableOffset) {
+            corrupt();
+        }
+        table.resize(header.chunkCount);
+        file.seekg(std::streamoff(header.tableOffset));
+        file.read(reinterpret_cast<char *>(table.data()), std::streamsize(table.size() * sizeof(ChunkEntry)));
+        if (!file) {
+            corrupt();
+        }
+
+        // payloads lie in [first, tableOffset) and chunks are aligned, inside the SVO and
+        // in strictly ascending key order, which the loaders and flattenTop rely on
+        const Vec3i32 svoMin(-(1 << SVO::depth));
+        const Vec3i32 svoMax((1 << SVO::depth) - 1);
+        const uint32_t chunkMask = (2u << header.chunkLevel) - 1;
+        const uint64_t first = table.empty() ? 0 : table.front().offset;
+        for (const ChunkEntry &entry : table) {
+            if (entry.offset < sizeof(header) || entry.offset < first || entry.offset > header.tableOffset ||
+                entry.bytes > header.tableOffset - entry.offset || entry.structureBytes > entry.bytes) {
+                corrupt();
+            }
+            const Vec3i32 origin(entry.x, entry.y, entry.z);
+            const Vec3u32 local = Vec3u32(origin - svoMin);
+            if (glm::any(glm::lessThan(origin, svoMin)) || glm::any(glm::greaterThan(origin, svoMax)) ||
+                ((local.x | local.y | local.z) & chunkMask) != 0) {
+                corrupt();
+            }
+            keys.push_back(chunkKey(entry, svoMin, header.chunkLevel));
+            if (keys.size() > 1 && keys[keys.size() - 2] >= keys.back()) {
+                corrupt();
+            }
+        }
+    }
+
+    void read(uint64_t offset, size_t size, std::vector<uint8_t> &bytes) {
+        bytes.resize(size);
+        file.seekg(std::streamoff(offset));
+        file.read(reinterpret_cast<char *>(bytes.data()), std::streamsize(size));
+        if (!file) {
+            corrupt();
+        }
+    }
+};
+
+} // namespace
+
+WorldFileStats saveWorld(const std::string &filepath, const SVO &svo, int chunkLevel) {
+    auto start = std::chrono::steady_clock::now();
+    if (chunkLevel < 1 || chunkLevel > 9) {
+        throw std::runtime_error("World chunk level must be in [1, 9]");
+    }
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        throw std::runtime_error("Failed to open world file for writing: " + filepath);
+    }
+
+    FileHeader header{};
+    std::memcpy(header.magic, MAGIC, 4);
+    header.version = VERSION;
+    header.depth = SVO::depth;
+    header.chunkLevel = uint32_t(chunkLevel);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    WorldFileStats stats;
+    std::vector<ChunkEntry> table;
+    std::vector<uint64_t> keys;
+    ChunkEncoder encoder;
+    const Vec3i32 svoMin = svo.minIncl();
+    const int shift = chunkLevel + 1;
+    Vec3i32 chunkOrigin(0);
+    uint64_t offset = sizeof(header);
+
+    const auto finishChunk = [&] {
+        encoder.encode(size_t(chunkLevel));
+        file.write(reinterpret_cast<const char *>(encoder.payload.data()), std::streamsize(encoder.payload.size()));
+        table.push_back({ chunkOrigin.x, chunkOrigin.y, chunkOrigin.z, uint32_t(encoder.codes.size()), offset,
+                          uint32_t(encoder.payload.size()), uint32_t(encoder.structureBytes) });
+        keys.push_back(chunkKey(table.back(), svoMin, size_t(chunkLevel)));
+        offset += encoder.payload.size();
+        stats.voxels += encoder.codes.size();
+        encoder.codes.clear();
+        encoder.colors.clear();
+    };
+
+    // forEach runs in Morton order and chunks are octree nodes, so each chunk's voxels
+    // arrive together and already sorted
+    svo.forEach(svo.minIncl(), svo.maxIncl(), [&](Vec3i32 pos, const rgb32_t &color) {
+        const Vec3i32 origin = (((pos - svoMin) >> shift) << shift) + svoMin;
+        if (origin != chunkOrigin && !encoder.codes.empty()) {
+            finishChunk();
+        }
+        chunkOrigin = origin;
+        encoder.codes.push_back(morton(Vec3u32(pos - origin), shift));
+        encoder.colors.push_back(color);
+    });
+    if (!encoder.codes.empty()) {
+        finishChunk();
+    }
+
+    header.chunkCount = uint32_t(table.size());
+    header.tableOffset = offset;
+    file.write(reinterpret_cast<const char *>(table.data()), std::streamsize(table.size() * sizeof(ChunkEntry)));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (!file) {
+        std::cerr << "Failed to write file: " << filepath << std::endl;
+        throw std::runtime_error("Failed to write world file: " + filepath);
+    }
+
+    stats.chunks = table.size();
+    stats.encodedBytes = size_t(offset - sizeof(header));
+    stats.flattenedBytes = 4 * (BRANCH_WORDS * (encoder.branches + countTopBranches(keys, size_t(chunkLevel))) + LEAF_WORDS * encoder.leaves);
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Saved world " << filepath << ": " << stats.chunks << " chunks, " << stats.voxels << " voxels, "
+              << stats.encodedBytes << " bytes (" << stats.ratio() << "x smaller than flattened) in " << stats.seconds
+              << " s" << std::endl;
+    return stats;
+}
+
+WorldFileStats loadWorld(const std::string &filepath, SVO &svo, unsigned threads) {
+    auto start = std::chrono::steady_clock::now();
+    WorldReader reader(filepath);
+    const size_t chunkLevel = reader.header.chunkLevel;
+
+    // payloads are contiguous and in table order
+    std::vector<uint8_t> payloads;
+    if (!reader.table.empty()) {
+        const uint64_t first = reader.table.front().offset;
+        reader.read(first, size_t(reader.header.tableOffset - first), payloads);
+    }
+
+    const unsigned workers = workerCount(threads);
+    std::vector<SVO> partial(workers);
+    std::vector<std::vector<Vec3i32>> positions(workers);
+    std::vector<std::vector<rgb32_t>> colors(workers);
+    std::vector<size_t> voxelCounts(workers, 0), leafCounts(workers, 0);
+
+    parallelFor(reader.table.size(), [&](size_t c, unsigned worker) {
+        PROFILE_SCOPE("Decode chunk");
+        const ChunkEntry &entry = reader.table[c];
+        ChunkDecoder decoder(payloads.data() + (entry.offset - reader.table.front().offset), entry);
+        auto &outPositions = positions[worker];
+        auto &outColors = colors[worker];
+        decodeVoxels(decoder, chunkLevel, Vec3i32(entry.x, entry.y, entry.z), [&](Vec3i32 pos, rgb32_t color) {
+            outPositions.push_back(pos);
+            outColors.push_back(color);
+            if (outPositions.size() == BLOCK) {
+                partial[worker].insertBatch(outPositions, outColors);
+                outPositions.clear();
+                outColors.clear();
+            }
+        });
+        partial[worker].insertBatch(outPositions, outColors);
+        outPositions.clear();
+        outColors.clear();
+        voxelCounts[worker] += entry.voxels;
+        leafCounts[worker] += decoder.leaves;
+    }, workers);
+
+    WorldFileStats stats;
+    size_t leaves = 0;
+    for (unsigned w = 0; w < workers; ++w) {
+        svo.merge(std::move(partial[w]));
+        stats.voxels += voxelCounts[w];
+        leaves += leafCounts[w];
+    }
+    size_t chunkNodes = 0;
+    for (const ChunkEntry &entry : reader.table) {
+        chunkNodes += entry.structureBytes;
+    }
+
+    stats.chunks = reader.table.size();
+    stats.encodedBytes = payloads.size();
+    stats.flattenedBytes = 4 * (BRANCH_WORDS * (chunkNodes - leaves + countTopBranches(reader.keys, chunkLevel)) + LEAF_WORDS * leaves);
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded world " << filepath << ": " << stats.chunks << " chunks, " << stats.voxels << " voxels in "
+              << stats.seconds << " s (" << stats.gigabytesPerSecond() << " GB/s flattened equivalent)" << std::endl;
+    return stats;
+}
+
+WorldFileStats loadWorldFlattened(const std::string &filepath, std::vector<uint32_t> &buffer) {
+    auto start = std::chrono::steady_clock::now();
+    WorldReader reader(filepath);
+    const size_t chunkLevel = reader.header.chunkLevel;
+
+    WorldFileStats stats;
+    std::vector<uint8_t> bytes;
+    uint32_t index = 0;
+    size_t next = 0;
+    buffer.clear();
+
+    // walks the levels above the chunks (rebuilt from the chunk keys) the way
+    // SVO::flattenNode does, reading each chunk's payload as it is reached
+    const auto flattenTop = [&](auto &self, size_t level, size_t begin, size_t end) -> void {
+        if (level == chunkLevel) {
+            const ChunkEntry &entry = reader.table[next++];
+            reader.read(entry.offset, entry.bytes, bytes);
+            ChunkDecoder decoder(bytes.data(), entry);
+            flattenChunkNode(decoder, level, buffer, index);
+            stats.voxels += entry.voxels;
+            stats.encodedBytes += entry.bytes;
+            return;
+        }
+        const uint32_t nodeIndex = index++;
+        buffer.push_back(BRANCH_NODE | nodeIndex);
+        const size_t children = buffer.size();
+        buffer.resize(children + 8, 0);
+        const int shift = int(3 * (level - chunkLevel - 1));
+        for (size_t i = begin; i < end;) {
+            const uint32_t digit = uint32_t(reader.keys[i] >> shift) & 7;
+            size_t j = i + 1;
+            while (j < end && (uint32_t(reader.keys[j] >> shift) & 7) == digit) {
+                ++j;
+            }
+            buffer[children + digit] = uint32_t(buffer.size());
+            self(self, level - 1, i, j);
+            i = j;
+        }
+    };
+    flattenTop(flattenTop, SVO::depth, 0, reader.keys.size());
+
+    stats.chunks = reader.table.size();
+    stats.flattenedBytes = buffer.size() * sizeof(uint32_t);
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Decoded world " << filepath << " to " << stats.flattenedBytes << " flattened bytes in "
+              << stats.seconds << " s (" << stats.gigabytesPerSecond() << " GB/s)" << std::endl;
+    return stats;
+}
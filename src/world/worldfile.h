@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "../render/voxel.h"
+
+struct WorldFileStats {
+    size_t chunks = 0;
+    size_t voxels = 0;
+    size_t encodedBytes = 0;   // chunk payloads
+    size_t flattenedBytes = 0; // the same world in the SVO::flatten layout
+    double seconds = 0.0;
+
+    double ratio() const { return encodedBytes ? double(flattenedBytes) / double(encodedBytes) : 0.0; }
+    // flattened bytes produced (or consumed, when saving) per second
+    double gigabytesPerSecond() const { return seconds > 0.0 ? double(flattenedBytes) / seconds / 1e9 : 0.0; }
+};
+
+// Compressed world files. The world is cut into octree-aligned chunks 2^(chunkLevel + 1)
+// voxels a side, each stored as two streams:
+//  - one child mask byte per node in pre-order, down to the leaves whose mask gives the
+//    set voxels
+//  - the colours of the set voxels in Morton order as runs: a run length followed by the
+//    per-channel difference from the previous run's colour, all zigzag/LEB128 varints
+// Chunks are written in Morton order followed by a table of their origins and offsets,
+// so each one decodes on its own.
+WorldFileStats saveWorld(const std::string &filepath, const SVO &svo, int chunkLevel = 4);
+
+// Decodes the chunks in parallel straight into insertBatch.
+WorldFileStats loadWorld(const std::string &filepath, SVO &svo, unsigned threads = 0);
+
+// Streams the chunks into the SVO::flatten layout without building a tree; the result is
+// what loadWorld followed by flatten would give.
+WorldFileStats loadWorldFlattened(const std::string &filepath, std::vector<uint32_t> &buffer);